@@ -6,10 +6,64 @@
 #include <fstream>
 #include <vector>
 #include <cassert>
+#include <string>
+#include <emmintrin.h>
+
+double euclid_dist_2(int, double*, double*);
+typedef double (*euclid_dist_fn)(int, double*, double*);
+
+/*----< euclid_dist_2_fixed() >----------------------------------------------*/
+/* euclid_dist_2() for numdims == DIM: the loop count is a constant, so the  */
+/* compiler unrolls it, and pairs of coordinates are summed with SSE2        */
+template <int DIM>
+static double euclid_dist_2_fixed(int    numdims,  /* no. dimensions (DIM) */
+	double *coord1,   /* [DIM] */
+	double *coord2)   /* [DIM] */
+{
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	int i = 0;
+
+	for (; i + 4 <= DIM; i += 4) {
+		__m128d t0 = _mm_sub_pd(_mm_loadu_pd(coord1 + i), _mm_loadu_pd(coord2 + i));
+		__m128d t1 = _mm_sub_pd(_mm_loadu_pd(coord1 + i + 2), _mm_loadu_pd(coord2 + i + 2));
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(t0, t0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(t1, t1));
+	}
+	double sum[2];
+	_mm_storeu_pd(sum, _mm_add_pd(acc0, acc1));
+	double ans = sum[0] + sum[1];
+	for (; i < DIM; i++)   /* empty when DIM is a multiple of 4 */
+		ans += (coord1[i] - coord2[i]) * (coord1[i] - coord2[i]);
+
+	return(ans);
+}
+
+/* specialized for common feature widths (784 = MNIST), generic otherwise */
+static euclid_dist_fn choose_dist_2(int numdims)
+{
+	switch (numdims) {
+	case 32: return euclid_dist_2_fixed<32>;
+	case 64: return euclid_dist_2_fixed<64>;
+	case 128: return euclid_dist_2_fixed<128>;
+	case 256: return euclid_dist_2_fixed<256>;
+	case 784: return euclid_dist_2_fixed<784>;
+	default: return euclid_dist_2;
+	}
+}
 
 KMeans::KMeans(int n_clusters = 8)
 {
 	this->n_clusters = n_clusters;
+	dist_2 = euclid_dist_2;
+	clusters = NULL;
+	membership = NULL;
+	context = 0;
+	queue = 0;
+	device = 0;
+	program = 0;
+	kernel = 0;
+	program_dim = 0;
 	cl_uint num;
 	clGetPlatformIDs(0, 0, &num);
 	if (num > 0) {
@@ -20,8 +74,28 @@ KMeans::KMeans(int n_clusters = 8)
 	}
 }
 
+KMeans::~KMeans()
+{
+	free_fit();
+	ocl_release();
+}
+
+/* frees the clusters and membership of the previous fit */
+void KMeans::free_fit()
+{
+	if (clusters) {
+		free(clusters[0]);
+		free(clusters);
+		clusters = NULL;
+	}
+	free(membership);
+	membership = NULL;
+}
+
 void KMeans::fit(double ** x, int n, int dim)
 {
+	free_fit();
+	dist_2 = choose_dist_2(dim);
 	if (ocl)
 		ocl_kmeans(x, dim, n, n_clusters, (double)0.001);
 	else
@@ -45,7 +119,13 @@ double KMeans::get_label(int i)
 	return membership[i];
 }
 
-cl_program KMeans::load_program(cl_context context, const char* filename, cl_device_id device)
+double* KMeans::get_cluster(int i)
+{
+	return clusters[i];
+}
+
+cl_program KMeans::load_program(cl_context context, const char* filename, cl_device_id device,
+	const char* options)
 {
 	std::ifstream in(filename, std::ios_base::binary);
 	if (!in.good()) {
@@ -68,7 +148,7 @@ cl_program KMeans::load_program(cl_context context, const char* filename, cl_dev
 	if (program == 0) {
 		return 0;
 	}
-	int t = clBuildProgram(program, 0, 0, 0, 0, 0);
+	int t = clBuildProgram(program, 0, 0, options, 0, 0);
 	if (t != CL_SUCCESS) {
 		size_t log_size;
 		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
@@ -81,7 +161,92 @@ cl_program KMeans::load_program(cl_context context, const char* filename, cl_dev
 }
 
 
-/*----< seq_kmeans() >-------------------------------------------------------*/
+/*----< ocl_setup() >--------------------------------------------------------*/
+/* creates the context and queue on the first call, and builds the program   */
+/* for numCoords unless the one kept from the last fit was built for it      */
+bool KMeans::ocl_setup(int numCoords)
+{
+	if (program != 0 && program_dim == numCoords)
+		return true;
+	if (context == 0) {
+		cl_int err;
+		cl_uint num;
+		err = clGetPlatformIDs(0, 0, &num);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Unable to get platforms\n";
+			exit(0);
+		}
+		std::vector<cl_platform_id> platforms(num);
+		err = clGetPlatformIDs(num, &platforms[0], &num);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Unable to get platform ID\n";
+			exit(0);
+		}
+
+		cl_context_properties prop[] = { CL_CONTEXT_PLATFORM, 
+			reinterpret_cast<cl_context_properties>(platforms[1]), 0 };
+		context = clCreateContextFromType(prop, CL_DEVICE_TYPE_DEFAULT, NULL, NULL, NULL);
+		if (context == 0) {
+			std::cerr << "Can't create OpenCL context\n";
+			exit(0);
+		}
+
+		size_t cb;
+		clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &cb);
+		std::vector<cl_device_id> devices(cb / sizeof(cl_device_id));
+		clGetContextInfo(context, CL_CONTEXT_DEVICES, cb, &devices[0], 0);
+		device = devices[0];
+
+		//cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, 0, &err);
+		queue = clCreateCommandQueue(context, device, 0, &err);
+		if (queue == 0) {
+			std::cerr << "Can't create command queue\n";
+			clReleaseContext(context);
+			exit(0);
+		}
+	}
+
+	if (kernel != 0)
+		clReleaseKernel(kernel);
+	if (program != 0)
+		clReleaseProgram(program);
+	kernel = 0;
+
+	/* built for numCoords, so that the distance loop has a constant count */
+	std::string options = "-D DIM=" + std::to_string(numCoords);
+	program = load_program(context, "kmeans_kernel.cl", device, options.c_str());
+	program_dim = numCoords;
+	if (program == 0) {
+		std::cerr << "Can't load or build program\n";
+		return false;
+	}
+
+	kernel = clCreateKernel(program, "find_nearest_cluster", 0);
+	if (kernel == 0) {
+		std::cerr << "Can't load kernel\n";
+		return false;
+	}
+	return true;
+}
+
+/* releases the OpenCL objects kept between fits */
+void KMeans::ocl_release()
+{
+	if (kernel != 0)
+		clReleaseKernel(kernel);
+	if (program != 0)
+		clReleaseProgram(program);
+	if (queue != 0)
+		clReleaseCommandQueue(queue);
+	if (context != 0)
+		clReleaseContext(context);
+	kernel = 0;
+	program = 0;
+	queue = 0;
+	context = 0;
+}
+
+/*----< ocl_kmeans() >-------------------------------------------------------*/
 /* return an array of cluster centers of size [numClusters][numCoords]       */
 void KMeans::ocl_kmeans(double **objects,      /* in: [numObjs][numCoords] */
 	int     numCoords,    /* no. features */
@@ -91,52 +256,7 @@ void KMeans::ocl_kmeans(double **objects,      /* in: [numObjs][numCoords] */
 {
 	membership = (int*)malloc(sizeof(int)*numObjs);
 	cl_int err;
-	cl_uint num;
-	err = clGetPlatformIDs(0, 0, &num);
-	if (err != CL_SUCCESS) {
-		std::cerr << "Unable to get platforms\n";
-		exit(0);
-	}
-	std::vector<cl_platform_id> platforms(num);
-	err = clGetPlatformIDs(num, &platforms[0], &num);
-	if (err != CL_SUCCESS) {
-		std::cerr << "Unable to get platform ID\n";
-		exit(0);
-	}
-
-	cl_context_properties prop[] = { CL_CONTEXT_PLATFORM, 
-		reinterpret_cast<cl_context_properties>(platforms[1]), 0 };
-	cl_context context = clCreateContextFromType(prop, CL_DEVICE_TYPE_DEFAULT, NULL, NULL, NULL);
-	if (context == 0) {
-		std::cerr << "Can't create OpenCL context\n";
-		exit(0);
-	}
-
-	size_t cb;
-	clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &cb);
-	std::vector<cl_device_id> devices(cb / sizeof(cl_device_id));
-	clGetContextInfo(context, CL_CONTEXT_DEVICES, cb, &devices[0], 0);
-
-	clGetDeviceInfo(devices[0], CL_DEVICE_NAME, 0, NULL, &cb);
-	std::string devname;
-	devname.resize(cb);
-	clGetDeviceInfo(devices[0], CL_DEVICE_NAME, cb, &devname[0], 0);
-	//std::cout << "Device: " << devname.c_str() << "\n";
-
-	clGetDeviceInfo(devices[0], CL_DEVICE_VERSION, 0, NULL, &cb);
-	std::string devver;
-	devver.resize(cb);
-	clGetDeviceInfo(devices[0], CL_DEVICE_VERSION, cb, &devver[0], 0);
-	//std::cout << "Device: " << devver.c_str() << "\n";
-
-	//int err;
-	//cl_command_queue queue = clCreateCommandQueueWithProperties(context, devices[0], 0, &err);
-	cl_command_queue queue = clCreateCommandQueue(context, devices[0], 0, &err);
-	if (queue == 0) {
-		std::cerr << "Can't create command queue\n";
-		clReleaseContext(context);
-		exit(0);
-	}
+	ocl_setup(numCoords);
 
 	int      i, j, /*index,*/ loop = 0;
 	int     *newClusterSize; /* [numClusters]: no. objects assigned in each
@@ -195,17 +315,6 @@ void KMeans::ocl_kmeans(double **objects,      /* in: [numObjs][numCoords] */
 		std::cerr << "Can't create OpenCL buffer\n";
 	}
 
-	cl_program program = load_program(context, "kmeans_kernel.cl", devices[0]);
-
-	if (program == 0) {
-		std::cerr << "Can't load or build program\n";
-
-	}
-
-	cl_kernel kernel = clCreateKernel(program, "find_nearest_cluster", 0);
-	if (kernel == 0) {
-		std::cerr << "Can't load kernel\n";
-	}
 	clSetKernelArg(kernel, 0, sizeof(int), &numClusters);
 	clSetKernelArg(kernel, 1, sizeof(int), &numCoords);
 	clSetKernelArg(kernel, 2, sizeof(int), &numObjs);
@@ -253,15 +362,14 @@ void KMeans::ocl_kmeans(double **objects,      /* in: [numObjs][numCoords] */
 	for (i = 0; i < numClusters; i++)
 		for (int j = 0; j < numCoords; j++)
 			clusters[i][j] = dimClusters[i*numCoords + j];
-	int ret = clFlush(queue);
-	ret = clFinish(queue);
-	ret = clReleaseKernel(kernel);
-	ret = clReleaseProgram(program);
-	ret = clReleaseMemObject(cl_Objects);
-	ret = clReleaseMemObject(cl_deviceClusters);
-	ret = clReleaseMemObject(cl_membership);
-	ret = clReleaseCommandQueue(queue);
-	ret = clReleaseContext(context);
+	free(dimObjects);
+	free(dimClusters);
+	free(newmembership);
+	clFinish(queue);
+	/* the kernel, program, queue and context are kept for the next fit */
+	clReleaseMemObject(cl_Objects);
+	clReleaseMemObject(cl_deviceClusters);
+	clReleaseMemObject(cl_membership);
 }
 
 double euclid_dist_2(int    numdims,  /* no. dimensions */
@@ -286,10 +394,10 @@ int KMeans::find_nearest_cluster(int     numClusters, /* no. clusters */
 
 	/* find the cluster id that has min distance to object */
 	index = 0;
-	min_dist = euclid_dist_2(numCoords, object, clusters[0]);
+	min_dist = dist_2(numCoords, object, clusters[0]);
 
 	for (i = 1; i < numClusters; i++) {
-		dist = euclid_dist_2(numCoords, object, clusters[i]);
+		dist = dist_2(numCoords, object, clusters[i]);
 		/* no need square root */
 		if (dist < min_dist) { /* find the min and its array index */
 			min_dist = dist;
@@ -300,22 +408,6 @@ int KMeans::find_nearest_cluster(int     numClusters, /* no. clusters */
 }
 
 // sequentail version
-/*----< euclid_dist_2() >----------------------------------------------------*/
-/* square of Euclid distance between two multi-dimensional points            */
-
-double KMeans::seq_euclid_dist_2(int    numdims,  /* no. dimensions */
-	double *coord1,   /* [numdims] */
-	double *coord2)   /* [numdims] */
-{
-	int i;
-	double ans = 0.0;
-
-	for (i = 0; i < numdims; i++)
-		ans += (coord1[i] - coord2[i]) * (coord1[i] - coord2[i]);
-
-	return(ans);
-}
-
 /*----< find_nearest_cluster() >---------------------------------------------*/
 
 int KMeans::seq_find_nearest_cluster(int     numClusters, /* no. clusters */
@@ -328,10 +420,10 @@ int KMeans::seq_find_nearest_cluster(int     numClusters, /* no. clusters */
 
 	/* find the cluster id that has min distance to object */
 	index = 0;
-	min_dist = seq_euclid_dist_2(numCoords, object, clusters[0]);
+	min_dist = dist_2(numCoords, object, clusters[0]);
 
 	for (i = 1; i < numClusters; i++) {
-		dist = seq_euclid_dist_2(numCoords, object, clusters[i]);
+		dist = dist_2(numCoords, object, clusters[i]);
 		/* no need square root */
 		if (dist < min_dist) { /* find the min and its array index */
 			min_dist = dist;
@@ -5,21 +5,41 @@ class KMeans
 {
 public:
 	KMeans(int n_clusters);
+	~KMeans();
 	void fit(double **x, int n, int dim);
 	double predict(double *x, int dim);
 	void predict_multiple(double **x, int n, int dim, double *label);
 	double get_label(int i);
+	double* get_cluster(int i);
 private:
+	KMeans(const KMeans&);	/* not copyable: owns the clusters and OpenCL objects */
+	KMeans& operator=(const KMeans&);
+
 	int find_nearest_cluster(int, int, double*);
+	void free_fit();
+	bool ocl_setup(int);
+	void ocl_release();
 	void ocl_kmeans(double**, int, int, int, double);
-	cl_program load_program(cl_context context, const char* filename, cl_device_id device);
-	double seq_euclid_dist_2(int, double*, double*);
+	cl_program load_program(cl_context context, const char* filename, cl_device_id device,
+		const char* options);
 	int seq_find_nearest_cluster(int, int, double*, double**);
 	void seq_kmeans(double**, int, int, int, double);
 	
+	typedef double (*dist_fn)(int, double*, double*);
+	dist_fn dist_2; /* squared distance, chosen for the dimension in fit() */
+
 	double **clusters;
 	int n_clusters;
 	int *membership;
 	bool ocl;
+
+	/* OpenCL objects, kept between fits; the program is rebuilt only when */
+	/* the dimension changes (it is compiled for one DIM)                  */
+	cl_context context;
+	cl_command_queue queue;
+	cl_device_id device;
+	cl_program program;
+	cl_kernel kernel;
+	int program_dim;
 };
 #endif
@@ -27,6 +27,8 @@
 //----------------------------------------------------------------------
 
 #include <cstdlib>						// C standard lib defs
+#include <chrono>						// search deadlines
+#include <thread>						// hardware thread count
 #include <ANN/ANNx.h>					// all ANN includes
 #include <ANN/ANNperf.h>				// ANN performance 
 
@@ -63,6 +65,18 @@ ANNdist annDist(						// interpoint squared distance
 	return dist;
 }
 
+ANNdist annDistBounded(					// squared distance, abandoned early
+	int					dim,
+	ANNpoint			p,
+	ANNpoint			q,
+	ANNdist				bound)
+{
+	ANN_FLOP(3*dim)					// performance counts
+	ANN_PTS(1)
+	ANN_COORD(dim)
+	return annDistBound(dim, p, q, bound);
+}
+
 //----------------------------------------------------------------------
 //	annPrintPoint() prints a point to a given output stream.
 //----------------------------------------------------------------------
@@ -184,18 +198,104 @@ void annError(const char* msg, ANNerr level)
 //		threshold is 0 (its default)  this means there is no limit
 //		and the algorithm applies its normal termination condition.
 //		This is for applications where there are real time constraints
-//		on the running time of the algorithm.
+//		on the running time of the algorithm.  The threshold is kept
+//		per thread, so concurrent searches can use different limits;
+//		the searches that hand queries to threads of their own pass
+//		the caller's limit on to them.
 //----------------------------------------------------------------------
 
-int	ANNmaxPtsVisited = 0;	// maximum number of pts visited
-int	ANNptsVisited;			// number of pts visited in search
+thread_local int ANNmaxPtsVisited = 0;	// maximum number of pts visited
+thread_local int ANNptsVisited;	// number of pts visited in search
+
+//----------------------------------------------------------------------
+//	Per-query search budget
+//		The clock is read only on every ANN_BUDGET_CLOCK_TICKS-th check,
+//		since reading it costs more than visiting a splitting node.
+//----------------------------------------------------------------------
+
+const int ANN_BUDGET_CLOCK_TICKS = 16;	// checks between clock reads
+
+thread_local const ANNsearchBudget *ANNsearchBudgetP = NULL;	// budget of current query
+thread_local int ANNleavesVisited;		// number of leaves visited
+thread_local ANNbool ANNsearchCut;		// was the search cut off?
+
+static thread_local int ANNbudgetTicks;	// checks since last clock read
+static thread_local chrono::steady_clock::time_point ANNbudgetStart;	// query start
+
+void annBudgetStart(const ANNsearchBudget &budget)
+{
+	ANNsearchBudgetP = &budget;
+	ANNleavesVisited = 0;
+	ANNsearchCut = ANNfalse;
+	ANNbudgetTicks = 0;
+	if (budget.max_usec > 0)
+		ANNbudgetStart = chrono::steady_clock::now();
+}
+
+ANNbool annBudgetEnd()
+{
+	ANNsearchBudgetP = NULL;
+	return (ANNbool) !ANNsearchCut;
+}
+
+ANNbool annBudgetExceeded()
+{
+	const ANNsearchBudget &b = *ANNsearchBudgetP;
+	if ((b.max_pts != 0 && ANNptsVisited > b.max_pts) ||
+		(b.max_leaves != 0 && ANNleavesVisited >= b.max_leaves)) {
+		return ANNsearchCut = ANNtrue;
+	}
+	if (b.max_usec > 0 && ++ANNbudgetTicks >= ANN_BUDGET_CLOCK_TICKS) {
+		ANNbudgetTicks = 0;
+		double usec = chrono::duration<double, micro>(
+					chrono::steady_clock::now() - ANNbudgetStart).count();
+		if (usec > b.max_usec)
+			return ANNsearchCut = ANNtrue;
+	}
+	return ANNfalse;
+}
 
 //----------------------------------------------------------------------
 //	Global function declarations
 //----------------------------------------------------------------------
 
-void annMaxPtsVisit(			// set limit on max. pts to visit in search
+int annMaxPtsVisit(				// set limit on max. pts to visit in search
 	int					maxPts)			// the limit
 {
+	int old = ANNmaxPtsVisited;
 	ANNmaxPtsVisited = maxPts;
+	return old;
+}
+
+//----------------------------------------------------------------------
+//	Number of threads used in tree construction
+//		A limit of 0 (its default) means that all hardware threads
+//		are used.  A limit of 1 gives the original sequential build.
+//		A thread may override the limit for the trees it builds, for
+//		instance when it is one of several threads building at once.
+//----------------------------------------------------------------------
+
+int	ANNbuildThreads = 0;	// max threads used in construction
+thread_local int ANNlocalBuildThreads = 0;	// override for this thread
+
+void annBuildThreads(			// set threads used in construction
+	int					nThreads)		// the limit (0 = all cores)
+{
+	ANNbuildThreads = nThreads;
+}
+
+int annLocalBuildThreads(		// set build threads of this thread
+	int					nThreads)		// the limit (0 = no override)
+{
+	int old = ANNlocalBuildThreads;
+	ANNlocalBuildThreads = nThreads;
+	return old;
+}
+
+int annBuildThreadCount()		// effective number of build threads
+{
+	if (ANNlocalBuildThreads > 0) return ANNlocalBuildThreads;
+	if (ANNbuildThreads > 0) return ANNbuildThreads;
+	int n_hw = (int) thread::hardware_concurrency();
+	return (n_hw > 0 ? n_hw : 1);		// unknown counts as one
 }
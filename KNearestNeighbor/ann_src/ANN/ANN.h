@@ -327,12 +327,16 @@ const ANNbool	ANN_ALLOW_SELF_MATCH	= ANNtrue;
 //				DIFF(x,y)		= y
 //
 //		By default the Euclidean norm is assumed.  To change the norm,
-//		uncomment the appropriate set of macros below.
+//		uncomment the appropriate set of macros below (and comment out
+//		ANN_METRIC_L2, which enables SSE distance code that assumes
+//		the Euclidean norm and float coordinates).  To use several
+//		metrics in one program, see the policies in ANN/ANNmetric.h.
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
 //	Use the following for the Euclidean norm
 //----------------------------------------------------------------------
+#define ANN_METRIC_L2					// Euclidean (SSE distances)
 #define ANN_POW(v)			((v)*(v))
 #define ANN_ROOT(x)			sqrt(x)
 #define ANN_SUM(x,y)		((x) + (y))
@@ -390,6 +394,14 @@ typedef ANNidx*   ANNidxArray;		// an array of point indices
 //			this routine cannot be modified as a method of changing the
 //			metric.
 //
+//		annDistBounded():
+//			Computes the (squared) distance, but stops early once the
+//			partial sum exceeds a given bound.  The sum is checked
+//			after every ANN_DIST_BLOCK coordinates, and if the bound
+//			is exceeded the partial sum (some value greater than the
+//			bound) is returned.  The same routine is used by the
+//			searches, so it gives exactly the distances they report.
+//
 //		Because points (somewhat like strings in C) are stored as
 //		pointers.  Consequently, creating and destroying copies of
 //		points may require storage allocation.  These procedures do
@@ -419,6 +431,12 @@ DLL_API ANNdist annDist(
 	ANNpoint		p,			// points
 	ANNpoint		q);
 
+DLL_API ANNdist annDistBounded(
+	int				dim,		// dimension of space
+	ANNpoint		p,			// points
+	ANNpoint		q,
+	ANNdist			bound);		// stop once the distance exceeds this
+
 DLL_API ANNpoint annAllocPt(
 	int				dim,		// dimension
 	ANNcoord		c = 0);		// coordinate value (all equal)
@@ -483,11 +501,95 @@ DLL_API ANNpoint annCopyPt(
 //		outside a ball of radius r/(1+epsilon), where r is the given
 //		(unsquared) radius bound.
 //
+//		The search algorithm, annRangeSearch, reports every point
+//		lying within the radius bound, not just the k nearest.  The
+//		(index, squared distance) pairs are appended to a growable
+//		ANNrangeResult, in the order found or, if requested, sorted by
+//		increasing distance, and the number of pairs added is returned.
+//		The error bound has the same meaning as for annkFRSearch.
+//		annBatchRangeSearch runs a range search for each point of a
+//		query array in parallel, with one result per query, which is
+//		the usual way of building an epsilon-neighborhood graph.
+//		Structures without their own range search fall back on two
+//		calls to annkFRSearch (one to count, one to fetch).
+//
 //		The generic object from which all the search structures are
 //		dervied is given below.  It is a virtual object, and is useless
 //		by itself.
 //----------------------------------------------------------------------
 
+//----------------------------------------------------------------------
+//	Range search results
+//		An ANNrangeResult is a growable pair of arrays holding point
+//		indices and squared distances.  Searches append to it, so it
+//		can be reused across queries (call clear() in between) without
+//		reallocating.
+//----------------------------------------------------------------------
+
+class DLL_API ANNrangeResult {
+	ANNrangeResult(const ANNrangeResult&);				// not copyable
+	ANNrangeResult& operator=(const ANNrangeResult&);
+	void grow();						// double the capacity
+public:
+	ANNidxArray		idx;				// point indices
+	ANNdistArray	dist;				// squared distances
+	int				n;					// number of pairs
+	int				cap;				// allocated size
+
+	ANNrangeResult()					// constructor
+		{ idx = NULL; dist = NULL; n = 0; cap = 0; }
+	~ANNrangeResult();					// destructor
+
+	void clear()						// remove all pairs
+		{ n = 0; }
+
+	void add(							// append a pair
+		ANNidx			i,				// point index
+		ANNdist			d)				// squared distance
+		{ if (n == cap) grow(); idx[n] = i; dist[n] = d; n++; }
+
+	void sort(							// sort pairs by distance
+		int				from = 0);		// first pair to sort
+};
+
+//----------------------------------------------------------------------
+//	k-nearest neighbor graphs
+//		An ANNknnGraph holds the k nearest neighbors of every point of
+//		a point set in compressed sparse row form: the neighbors of
+//		point i are nbr[offset[i]] .. nbr[offset[i+1]-1], in order of
+//		increasing distance, with their squared distances in dist.
+//		It is filled by the annAllKnn() members of ANNbruteForce and
+//		ANNkd_flat_tree (ANNkd_flat_treeT stores the distances of its
+//		own metric instead).  A point is never its own neighbor (this is
+//		decided by index, so duplicate points are still neighbors of
+//		each other, whatever ANN_ALLOW_SELF_MATCH says), and a point
+//		has fewer than k neighbors only if the set has k or fewer
+//		points or the search was approximate.
+//----------------------------------------------------------------------
+
+class DLL_API ANNknnGraph {
+	ANNknnGraph(const ANNknnGraph&);					// not copyable
+	ANNknnGraph& operator=(const ANNknnGraph&);
+public:
+	int				n_pts;				// number of points
+	ANNidxArray		offset;				// start of each row (n_pts+1)
+	ANNidxArray		nbr;				// neighbor indices
+	ANNdistArray	dist;				// squared distances
+
+	ANNknnGraph()						// constructor
+		{ n_pts = 0; offset = NULL; nbr = NULL; dist = NULL; }
+	~ANNknnGraph();						// destructor
+
+	int degree(int i)					// number of neighbors of point i
+		{ return offset[i+1] - offset[i]; }
+
+	void build(							// fill from k results per point
+		int				n,				// number of points
+		int				k,				// results per point
+		ANNidxArray		idx,			// n*k indices (ANN_NULL_IDX unused)
+		ANNdistArray	dd);			// n*k squared distances
+};
+
 class DLL_API ANNpointSet {
 public:
 	virtual ~ANNpointSet() {}			// virtual distructor
@@ -509,6 +611,22 @@ public:
 		double			eps=0.0			// error bound
 		) = 0;							// pure virtual (defined elsewhere)
 
+	virtual int annRangeSearch(			// report all points in a ball
+		ANNpoint		q,				// query point
+		ANNdist			sqRad,			// squared radius
+		ANNrangeResult&	res,			// points in range (appended)
+		ANNbool			sorted = ANNfalse,	// sort by distance?
+		double			eps=0.0);		// error bound
+
+	void annBatchRangeSearch(			// range search for many queries
+		ANNpointArray	qa,				// query points
+		int				nq,				// number of queries
+		ANNdist			sqRad,			// squared radius
+		ANNrangeResult*	res,			// one result per query (appended)
+		ANNbool			sorted = ANNfalse,	// sort by distance?
+		double			eps=0.0,		// error bound
+		int				nThreads = 0);	// threads to use (0 = all cores)
+
 	virtual int theDim() = 0;			// return dimension of space
 	virtual int nPoints() = 0;			// return number of points
 										// return pointer to points
@@ -525,6 +643,11 @@ public:
 //		of epsilon is ignored, since all distance calculations are
 //		performed exactly.
 //
+//		If order_dims is set, a copy of the points is kept with the
+//		coordinates in order of decreasing variance, which makes the
+//		early abandonment of distance calculations more effective at
+//		the cost of a second copy of the points.
+//
 //		WARNING: This data structure is very slow, and should not be
 //		used unless the number of points is very small.
 //
@@ -533,17 +656,35 @@ public:
 //		This data structure bascially consists of the array of points
 //		(each a pointer to an array of coordinates).  The search is
 //		performed by a simple linear scan of all the points.
+//
+//		annAllKnn() finds the k nearest neighbors of every point (see
+//		ANNknnGraph) by a blocked self-join: a block of query points is
+//		compared against one block of data points at a time, so the
+//		data block stays in cache while all the queries of the block
+//		use it.  Query blocks are divided among the threads.
 //----------------------------------------------------------------------
 
 class DLL_API ANNbruteForce: public ANNpointSet {
 	int				dim;				// dimension
 	int				n_pts;				// number of points
 	ANNpointArray	pts;				// point array
+	int				*dim_order;			// dims by decreasing variance
+	ANNpointArray	ord_pts;			// points with dims in that order
+
+	ANNpoint orderQuery(				// query in scan order
+		ANNpoint		q,				// query point
+		ANNpointArray	&scan_pts);		// points to scan (returned)
 public:
 	ANNbruteForce(						// constructor from point array
 		ANNpointArray	pa,				// point array
 		int				n,				// number of points
-		int				dd);			// dimension
+		int				dd,				// dimension
+		ANNbool			order_dims = ANNfalse);	// order dims by variance?
+
+	void annAllKnn(						// k nearest neighbors of all points
+		int				k,				// number of neighbors
+		ANNknnGraph&	graph,			// the graph (returned)
+		int				nThreads = 0);	// threads to use (0 = all cores)
 
 	~ANNbruteForce();					// destructor
 
@@ -562,6 +703,13 @@ public:
 		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
+	int annRangeSearch(					// report all points in a ball
+		ANNpoint		q,				// query point
+		ANNdist			sqRad,			// squared radius
+		ANNrangeResult&	res,			// points in range (appended)
+		ANNbool			sorted = ANNfalse,	// sort by distance?
+		double			eps=0.0);		// error bound
+
 	int theDim()						// return dimension of space
 		{ return dim; }
 
@@ -694,6 +842,31 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 //
 //----------------------------------------------------------------------
 
+//----------------------------------------------------------------------
+//	Search budgets
+//		A budget bounds the work done by one query: the number of
+//		points visited, the number of leaves visited, or the time since
+//		the search started, in microseconds.  A limit of 0 means no
+//		limit.  When any limit is reached the search stops and returns
+//		the best neighbors found so far.  The budgeted searches return
+//		ANNtrue if the search finished on its own (so the result is as
+//		good as the unbudgeted search with the same eps) and ANNfalse
+//		if it was cut off.  The annMaxPtsVisit() limit still
+//		applies and also counts as a cut-off.
+//----------------------------------------------------------------------
+
+struct ANNsearchBudget {
+	int				max_pts;			// max points visited
+	int				max_leaves;			// max leaves visited
+	double			max_usec;			// max time (microseconds)
+
+	ANNsearchBudget(					// constructor
+		int				pts = 0,		// max points visited
+		int				leaves = 0,		// max leaves visited
+		double			usec = 0)		// max time (microseconds)
+		{ max_pts = pts; max_leaves = leaves; max_usec = usec; }
+};
+
 //----------------------------------------------------------------------
 // Some types and objects used by kd-tree functions
 // See src/kd_tree.h and src/kd_tree.cpp for definitions
@@ -703,6 +876,8 @@ class ANNkd_node;				// generic node in a kd-tree
 typedef ANNkd_node*	ANNkd_ptr;	// pointer to a kd-tree node
 
 class DLL_API ANNkd_tree: public ANNpointSet {
+	friend class ANNkd_forest;			// builds its trees directly
+	friend class ANNkd_flat_tree;		// flattens an existing tree
 protected:
 	int				dim;				// dimension of space
 	int				n_pts;				// number of points in tree
@@ -752,6 +927,22 @@ public:
 		ANNdistArray	dd,				// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
+	ANNbool annkSearch(					// k near neighbor search in budget
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps,			// error bound
+		const ANNsearchBudget& budget);	// limits on the search
+
+	ANNbool annkPriSearch(				// priority search in budget
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps,			// error bound
+		const ANNsearchBudget& budget);	// limits on the search
+
 	int annkFRSearch(					// approx fixed-radius kNN search
 		ANNpoint		q,				// the query point
 		ANNdist			sqRad,			// squared radius of query ball
@@ -760,6 +951,13 @@ public:
 		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
+	int annRangeSearch(					// report all points in a ball
+		ANNpoint		q,				// query point
+		ANNdist			sqRad,			// squared radius
+		ANNrangeResult&	res,			// points in range (appended)
+		ANNbool			sorted = ANNfalse,	// sort by distance?
+		double			eps=0.0);		// error bound
+
 	int theDim()						// return dimension of space
 		{ return dim; }
 
@@ -814,16 +1012,248 @@ public:
 		std::istream&	in);			// input stream for dump file
 };
 
+//----------------------------------------------------------------------
+//	Flattened kd-tree
+//		An immutable copy of a built kd-tree laid out for fast search.
+//		The nodes are stored in one array in breadth-first order, with
+//		the two children of a splitting node next to each other, and
+//		the coordinates of the points of each leaf are copied into one
+//		contiguous block.  The search walks this array with an explicit
+//		stack, so it makes no virtual calls, follows no node pointers
+//		and never goes through the point index array.  It uses no
+//		global state, so several threads may search at once.
+//
+//		Only kd-trees can be flattened (not bd-trees).  The flat tree
+//		does not refer to the original tree, which may be deleted.
+//
+//		DumpBinary() writes the flat tree as a binary file: a header,
+//		the bounding box, the node array, the leaf point indices and
+//		the leaf point coordinates, each section aligned so that it can
+//		be used in place.  The file name constructor maps such a file
+//		into memory read-only and searches it directly, without reading
+//		or converting anything, so loading takes constant time and all
+//		processes mapping the same file share one copy in the page
+//		cache.  For a mapped tree thePoints() builds an array of row
+//		pointers into the mapping on its first call.
+//
+//		annAllKnn() finds the k nearest neighbors of every point of the
+//		tree (see ANNknnGraph).  The points are processed a leaf at a
+//		time: the distances between points of the same leaf are
+//		computed once and seed the neighbor sets of both points, so
+//		each search starts with a tight bound, and then every point of
+//		the leaf searches the rest of the tree.  Leaves are divided
+//		among the threads.  Larger buckets share more work.
+//----------------------------------------------------------------------
+
+struct ANNkd_flat_node;					// node of a flattened kd-tree
+
+class DLL_API ANNkd_flat_tree: public ANNpointSet {
+protected:
+	int				dim;				// dimension of space
+	int				n_pts;				// number of points
+	ANNpointArray	pts;				// the points
+	int				n_nodes;			// number of nodes
+	int				depth;				// depth of tree
+	ANNkd_flat_node	*nodes;				// nodes (root is nodes[0])
+	ANNcoord		*leaf_pts;			// leaf point coordinates
+	ANNidx			*leaf_idx;			// their indices in pts
+	ANNpoint		bnd_box_lo;			// bounding box low point
+	ANNpoint		bnd_box_hi;			// bounding box high point
+	void			*map_addr;			// mapped file (NULL if not mapped)
+	size_t			map_len;			// length of mapping
+	void			*map_handle;		// mapping handle (Windows only)
+
+public:
+	ANNkd_flat_tree(					// flatten a kd-tree
+		ANNkd_tree&		tree);			// the tree
+
+	ANNkd_flat_tree(					// map a binary dump file
+		const char*		file_name);		// name of file
+
+	~ANNkd_flat_tree();					// destructor
+
+	void DumpBinary(					// write binary dump file
+		std::ostream&	out);			// output stream (binary mode)
+
+	void annAllKnn(						// k nearest neighbors of all points
+		int				k,				// number of neighbors
+		ANNknnGraph&	graph,			// the graph (returned)
+		double			eps=0.0,		// error bound
+		int				nThreads = 0);	// threads to use (0 = all cores)
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// squared radius of query ball
+		int				k,				// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// return number of points
+		{ return n_pts; }
+
+	ANNpointArray thePoints();			// return pointer to points
+};
+
+//----------------------------------------------------------------------
+//	Randomized kd-forest
+//		A set of kd-trees over the same points, each splitting along
+//		dimensions chosen at random among those of highest variance.
+//		The trees are searched together by a single priority search
+//		that stops after a fixed number of point checks, which makes
+//		it far faster than one kd-tree in high dimension, at the cost
+//		of returning approximate neighbors.  More trees and more checks
+//		give better recall; checks = 0 means no limit other than
+//		annMaxPtsVisit().
+//----------------------------------------------------------------------
+
+class DLL_API ANNkd_forest: public ANNpointSet {
+protected:
+	int				dim;				// dimension of space
+	int				n_pts;				// number of points
+	ANNpointArray	pts;				// the points
+	int				n_trees;			// number of trees
+	ANNkd_tree**	trees;				// the trees
+	int				max_checks;			// max points checked per query
+	int				depth;				// depth of the deepest tree
+
+public:
+	ANNkd_forest(						// build from point array
+		ANNpointArray	pa,				// point array
+		int				n,				// number of points
+		int				dd,				// dimension
+		int				n_tr = 4,		// number of trees
+		int				checks = 0,		// max points checked per query
+		int				bs = 1);		// bucket size
+
+	~ANNkd_forest();					// forest destructor
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// squared radius of query ball
+		int				k,				// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	void setChecks(						// change the check budget
+		int				checks)			// max points checked per query
+		{ max_checks = checks; }
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// return number of points
+		{ return n_pts; }
+
+	ANNpointArray thePoints()			// return pointer to points
+		{  return pts;  }
+};
+
+//----------------------------------------------------------------------
+//	Ball tree
+//		A binary tree whose nodes are balls (a center and a radius)
+//		rather than axis-aligned boxes.  Each node is split along the
+//		line through two far-apart points of its ball, at the median
+//		of the projections, so the cuts follow the data and not the
+//		coordinate axes; on correlated features the balls are much
+//		tighter than the boxes of a kd-tree.  The lower bound for a
+//		node is the distance from the query to its center less its
+//		radius.  Searches are best-first, with the nodes ordered by
+//		this bound.  The bounds use the triangle inequality, so the
+//		tree is for the Euclidean norm only.
+//----------------------------------------------------------------------
+
+struct ANNball_node;					// node of a ball tree (ball_tree.cpp)
+
+class DLL_API ANNball_tree: public ANNpointSet {
+protected:
+	int				dim;				// dimension of space
+	int				n_pts;				// number of points
+	ANNpointArray	pts;				// the points
+	int				n_nodes;			// number of nodes
+	ANNball_node	*nodes;				// nodes (root is nodes[0])
+	ANNcoord		*centers;			// ball centers (dim per node)
+	ANNcoord		*leaf_pts;			// point coordinates in leaf order
+	ANNidx			*leaf_idx;			// their indices in pts
+
+	ANNdist lowerBound(					// squared distance bound of a node
+		ANNpoint		q,				// query point
+		int				node);			// the node
+
+public:
+	ANNball_tree(						// build from point array
+		ANNpointArray	pa,				// point array
+		int				n,				// number of points
+		int				dd,				// dimension
+		int				bs = 8);		// bucket size
+
+	~ANNball_tree();					// tree destructor
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// squared radius of query ball
+		int				k,				// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// return number of points
+		{ return n_pts; }
+
+	ANNpointArray thePoints()			// return pointer to points
+		{  return pts;  }
+};
+
 //----------------------------------------------------------------------
 //	Other functions
 //	annMaxPtsVisit		Sets a limit on the maximum number of points
-//						to visit in the search.
+//						to visit in the searches of the calling
+//						thread, and returns the previous limit.
+//	annBuildThreads		Sets the number of threads used to build kd-
+//						and bd-trees (0, the default, uses all cores).
+//	annLocalBuildThreads	Overrides annBuildThreads() for the trees
+//						built by the calling thread (0 removes the
+//						override), and returns the previous override.
 //  annClose			Can be called when all use of ANN is finished.
 //						It clears up a minor memory leak.
 //----------------------------------------------------------------------
 
-DLL_API void annMaxPtsVisit(	// max. pts to visit in search
-	int				maxPts);	// the limit
+DLL_API int annMaxPtsVisit(	// max. pts to visit in search
+	int				maxPts);	// the limit (returns the old one)
+
+DLL_API void annBuildThreads(	// threads used in tree construction
+	int				nThreads);	// the limit (0 = all cores)
+
+DLL_API int annLocalBuildThreads(	// build threads of the calling thread
+	int				nThreads);	// the limit (returns the old one)
 
 DLL_API void annClose();		// called to end use of ANN
 
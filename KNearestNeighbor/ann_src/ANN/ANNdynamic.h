@@ -0,0 +1,138 @@
+//----------------------------------------------------------------------
+//	File:			ANNdynamic.h
+//	Description:	Dynamic kd-tree index (insertions and deletions)
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#ifndef ANNdynamic_H
+#define ANNdynamic_H
+
+#include <ANN/ANN.h>					// basic ANN includes
+
+#include <atomic>						// merge completion flag
+#include <mutex>						// index state
+#include <thread>						// background merges
+#include <vector>
+
+//----------------------------------------------------------------------
+//	Dynamic kd-tree index
+//		The kd-tree is static, so this index uses the logarithmic
+//		method: the points live in a set of static trees (flattened
+//		kd-trees), level i holding at most buf_size*2^i points, plus
+//		an unsorted buffer of up to buf_size recent insertions that
+//		is searched by brute force.  When the buffer fills, it and
+//		levels 0..j-1 are merged into a new tree at the first empty
+//		level j, like a carry in a binary counter, so each point is
+//		rebuilt O(log n) times over the life of the index.
+//
+//		The merge tree is built by a background thread.  Until it is
+//		done, searches use the levels and buffer being merged, and
+//		insertions go to a new buffer; the new level replaces them at
+//		the next operation after the build has finished.  If the
+//		buffer fills again first, that operation waits for the build.
+//
+//		Deletion marks a point deleted (a tombstone).  A level with
+//		deleted points is searched for k plus that many neighbors, so
+//		k live ones remain after they are dropped, and a level more
+//		than half deleted is rebuilt without them.  Merges leave the
+//		deleted points out.
+//
+//		Point indices are given in order of insertion, starting with
+//		the n points passed to the constructor, and never change.  The
+//		index keeps its own copy of every point, deleted ones included.
+//		Operations on one index are serialized.
+//----------------------------------------------------------------------
+
+struct ANNdynLevel;						// one static tree (kd_dynamic.cpp)
+
+class DLL_API ANNkd_dynamic: public ANNpointSet {
+	int				dim;				// dimension of space
+	int				buf_size;			// insertions kept in the buffer
+	int				n_live;				// points not deleted
+	std::vector<ANNpoint> pts;			// all points, by index
+	std::vector<char> dead;				// deleted?
+	std::vector<int> where;				// level of each point (-1: buffer)
+	std::vector<ANNdynLevel*> levels;	// level i (NULL if empty)
+	std::vector<int> buffer;			// recent insertions
+
+	std::mutex		lock;				// protects the index
+	std::thread		merger;				// builds the merge tree
+	std::atomic<bool> merge_done;		// the build has finished
+	bool			merging;			// a merge is in progress
+	int				merge_level;		// level it goes to
+	std::vector<int> merge_buffer;		// buffer being merged
+	ANNdynLevel		*merge_result;		// the tree built
+
+	ANNdynLevel *newLevel(				// level over some points (no tree)
+		const std::vector<int>& ids);	// their indices
+
+	void startMerge();					// merge the full buffer
+	void finishMerge();					// wait for and install a merge
+	void poll();						// install a finished merge
+	void rebuildLevel(int i);			// drop the deleted points of level i
+
+	void search(						// k nearest, deleted ones skipped
+		ANNpoint		q,				// query point
+		ANNdist			sqRad,			// squared radius (ANN_DIST_INF: kNN)
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps,			// error bound
+		int				&in_range);		// live points in range (returned)
+
+public:
+	ANNkd_dynamic(						// build from point array
+		ANNpointArray	pa,				// point array (copied)
+		int				n,				// number of points
+		int				dd,				// dimension
+		int				bs = 1024);		// insertions kept in the buffer
+
+	~ANNkd_dynamic();					// destructor
+
+	int insert(							// add a point
+		ANNpoint		p);				// the point (copied)
+
+	void remove(						// delete a point
+		int				idx);			// its index
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// squared radius of query ball
+		int				k = 0,			// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int nLive()							// number of points not deleted
+		{ return n_live; }
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// number of indices given out
+		{ return (int) pts.size(); }
+
+	ANNpointArray thePoints()			// return pointer to points
+		{ return pts.empty() ? NULL : &pts[0]; }	// (moves on insert)
+};
+
+#endif
@@ -0,0 +1,149 @@
+//----------------------------------------------------------------------
+//	File:			ANNhnsw.h
+//	Description:	Hierarchical Navigable Small World graph index
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#ifndef ANNhnsw_H
+#define ANNhnsw_H
+
+#include <ANN/ANN.h>					// basic ANN includes
+
+#include <atomic>						// entry point during construction
+#include <iostream>						// save and load
+#include <mutex>						// per-node locks
+#include <vector>
+
+//----------------------------------------------------------------------
+//	HNSW graph index
+//		Every point is a node of a proximity graph on level 0, and a
+//		geometrically shrinking random subset of the points also forms
+//		graphs on levels 1, 2, ...  A search walks greedily down the
+//		sparse upper levels to a good starting node, then runs a best-
+//		first search on level 0 that keeps the efSearch closest nodes
+//		seen.  Query time grows roughly logarithmically with n, even in
+//		high dimension, but the results are approximate.
+//
+//		Parameters:
+//			M				Links per node on the upper levels (2*M on
+//							level 0).  Larger M gives better recall and
+//							a larger, slower-to-build graph.
+//			efConstruction	Candidates kept while inserting a point.
+//			efSearch		Candidates kept while searching (at least k
+//							are always kept).  This is the main
+//							recall-versus-time setting.
+//
+//		The points are inserted concurrently by annBuildThreads()
+//		threads, each node being locked only while its links change.
+//		Once built, the index is read-only and any number of threads
+//		may search it at once without locking.
+//
+//		Save() writes the graph and the points in binary form, and the
+//		stream constructor reads them back (the loaded index owns its
+//		copy of the points).
+//----------------------------------------------------------------------
+
+class DLL_API ANNhnsw: public ANNpointSet {
+protected:
+	int				dim;				// dimension of space
+	int				n_pts;				// number of points
+	ANNpointArray	pts;				// the points
+	bool			own_pts;			// were the points loaded here?
+
+	int				M;					// max links per upper-level node
+	int				M0;					// max links per level-0 node
+	int				ef_construction;	// candidates kept during insertion
+	int				ef_search;			// candidates kept during search
+	double			level_mult;			// scale of the random level
+
+	std::vector<int>				level;	// top level of each node
+	std::vector<int>				links0;	// level-0 links, M0+1 per node
+	std::vector<std::vector<int> >	links;	// upper links, M+1 per level
+	std::atomic<int>				entry;	// entry point (top node)
+	std::atomic<int>				max_level;	// level of entry point
+	std::vector<std::mutex>			node_lock;	// locks during construction
+	std::mutex						entry_lock;	// lock on entry point
+
+	int* linkList(int i, int lev)		// link list: count, then ids
+		{ return lev == 0 ? &links0[(size_t) i*(M0+1)]
+						 : &links[i][(size_t)(lev-1)*(M+1)]; }
+
+	void insert(int i, int lev);		// insert point i up to level lev
+
+	int greedy(							// closest node on one level
+		ANNpoint		q,				// query point
+		int				ep,				// starting node
+		int				lev,			// level to search
+		bool			locked);		// lock nodes while reading?
+
+	void searchLevel(					// best-first search of one level
+		ANNpoint		q,				// query point
+		int				ep,				// starting node
+		int				ef,				// candidates to keep
+		int				lev,			// level to search
+		bool			locked,			// lock nodes while reading?
+		std::vector<std::pair<ANNdist,int> >& res);	// result (modified)
+
+	void selectNeighbors(				// prune candidates to m links
+		std::vector<std::pair<ANNdist,int> >& cand,	// sorted (modified)
+		int				m);				// max number to keep
+
+public:
+	ANNhnsw(							// build from point array
+		ANNpointArray	pa,				// point array
+		int				n,				// number of points
+		int				dd,				// dimension
+		int				m = 16,			// links per node
+		int				efC = 200,		// candidates during construction
+		int				efS = 50);		// candidates during search
+
+	ANNhnsw(							// load from Save() output
+		std::istream&	in);			// input stream (binary)
+
+	~ANNhnsw();							// destructor
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound (ignored)
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// squared radius of query ball
+		int				k,				// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound (ignored)
+
+	void setEfSearch(					// change search candidates
+		int				efS)			// candidates kept during search
+		{ ef_search = efS; }
+
+	void Save(							// save index in binary form
+		std::ostream&	out);			// output stream (binary)
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// return number of points
+		{ return n_pts; }
+
+	ANNpointArray thePoints()			// return pointer to points
+		{  return pts;  }
+};
+
+#endif
@@ -0,0 +1,333 @@
+//----------------------------------------------------------------------
+//	File:			ANNmetric.h
+//	Description:	Compile-time distance metrics
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#ifndef ANNmetric_H
+#define ANNmetric_H
+
+#include <ANN/ANN.h>					// basic ANN includes
+
+#include <xmmintrin.h>					// SSE distances
+
+//----------------------------------------------------------------------
+//	Metric policies
+//		The ANN_POW, ANN_SUM and ANN_DIFF macros fix one metric for the
+//		whole library.  The policies below let a search structure be
+//		instantiated for a metric instead, so that each metric gets its
+//		own inlined SSE inner loop with no per-coordinate branching.
+//		Each policy provides:
+//
+//			power(v)		contribution of one coordinate difference
+//			sum(x,y)		combination of two contributions
+//			diff(x,y)		change from contribution x to y (used to
+//							update distances to boxes incrementally)
+//			dist(dim,p,q,bound)
+//							the distance, which may stop early and
+//							return any value greater than bound once
+//							the result is known to exceed it
+//			is_metric		nonzero if the distance may be used to
+//							prune kd-tree cells
+//
+//		As elsewhere in ANN, distances are reported as powers (squared
+//		for L2).  The inner product policy reports the negated inner
+//		product, so that smaller is still closer; it is not a metric
+//		and can only be used by brute force.  For cosine similarity,
+//		normalize the points and queries with annNormalizePts() and
+//		use L2 (for unit vectors |p-q|^2 = 2 - 2 cos(p,q), so the order
+//		of neighbors is the same) or the inner product.
+//
+//		All policies assume float coordinates (ANNcoord).  Distances
+//		are checked against the bound once per block of 8 coordinates.
+//----------------------------------------------------------------------
+
+const int ANN_METRIC_BLOCK = 8;			// coordinates between bound checks
+
+inline float annHsum(__m128 s)			// sum of the four lanes
+{
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+inline float annHmax(__m128 s)			// max of the four lanes
+{
+	s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+inline __m128 annAbs(__m128 v)			// absolute value of each lane
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+struct ANNmetricL2 {					// Euclidean (squared)
+	enum { is_metric = 1 };
+	static ANNdist power(ANNcoord v) { return v*v; }
+	static ANNdist sum(ANNdist x, ANNdist y) { return x + y; }
+	static ANNdist diff(ANNdist x, ANNdist y) { return y - x; }
+
+	static ANNdist dist(int dim, const ANNcoord *p, const ANNcoord *q, ANNdist bound)
+	{
+		ANNdist dist = 0;
+		int d = 0;
+		for (; d + ANN_METRIC_BLOCK <= dim; d += ANN_METRIC_BLOCK) {
+			__m128 t0 = _mm_sub_ps(_mm_loadu_ps(q + d), _mm_loadu_ps(p + d));
+			__m128 t1 = _mm_sub_ps(_mm_loadu_ps(q + d + 4), _mm_loadu_ps(p + d + 4));
+			dist += annHsum(_mm_add_ps(_mm_mul_ps(t0, t0), _mm_mul_ps(t1, t1)));
+			if (dist > bound) return dist;
+		}
+		for (; d < dim; d++) {			// remaining coordinates
+			ANNcoord t = q[d] - p[d];
+			dist += t*t;
+		}
+		return dist;
+	}
+};
+
+struct ANNmetricL1 {					// Manhattan
+	enum { is_metric = 1 };
+	static ANNdist power(ANNcoord v) { return v < 0 ? -v : v; }
+	static ANNdist sum(ANNdist x, ANNdist y) { return x + y; }
+	static ANNdist diff(ANNdist x, ANNdist y) { return y - x; }
+
+	static ANNdist dist(int dim, const ANNcoord *p, const ANNcoord *q, ANNdist bound)
+	{
+		ANNdist dist = 0;
+		int d = 0;
+		for (; d + ANN_METRIC_BLOCK <= dim; d += ANN_METRIC_BLOCK) {
+			__m128 t0 = annAbs(_mm_sub_ps(_mm_loadu_ps(q + d), _mm_loadu_ps(p + d)));
+			__m128 t1 = annAbs(_mm_sub_ps(_mm_loadu_ps(q + d + 4), _mm_loadu_ps(p + d + 4)));
+			dist += annHsum(_mm_add_ps(t0, t1));
+			if (dist > bound) return dist;
+		}
+		for (; d < dim; d++)			// remaining coordinates
+			dist += power(q[d] - p[d]);
+		return dist;
+	}
+};
+
+struct ANNmetricLinf {					// max norm
+	enum { is_metric = 1 };
+	static ANNdist power(ANNcoord v) { return v < 0 ? -v : v; }
+	static ANNdist sum(ANNdist x, ANNdist y) { return x > y ? x : y; }
+	static ANNdist diff(ANNdist /*x*/, ANNdist y) { return y; }
+
+	static ANNdist dist(int dim, const ANNcoord *p, const ANNcoord *q, ANNdist bound)
+	{
+		ANNdist dist = 0;
+		int d = 0;
+		for (; d + ANN_METRIC_BLOCK <= dim; d += ANN_METRIC_BLOCK) {
+			__m128 t0 = annAbs(_mm_sub_ps(_mm_loadu_ps(q + d), _mm_loadu_ps(p + d)));
+			__m128 t1 = annAbs(_mm_sub_ps(_mm_loadu_ps(q + d + 4), _mm_loadu_ps(p + d + 4)));
+			dist = sum(dist, annHmax(_mm_max_ps(t0, t1)));
+			if (dist > bound) return dist;
+		}
+		for (; d < dim; d++)			// remaining coordinates
+			dist = sum(dist, power(q[d] - p[d]));
+		return dist;
+	}
+};
+
+struct ANNmetricIP {					// negated inner product
+	enum { is_metric = 0 };
+	static ANNdist dist(int dim, const ANNcoord *p, const ANNcoord *q, ANNdist /*bound*/)
+	{
+		__m128 acc = _mm_setzero_ps();	// no early exit: terms may be < 0
+		int d = 0;
+		for (; d + 4 <= dim; d += 4)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(p + d), _mm_loadu_ps(q + d)));
+		ANNdist dot = annHsum(acc);
+		for (; d < dim; d++)			// remaining coordinates
+			dot += p[d]*q[d];
+		return -dot;
+	}
+};
+
+//----------------------------------------------------------------------
+//	Fixed dimension
+//		ANNmetricL2fixed<DIM> is ANNmetricL2 for points of exactly DIM
+//		coordinates (the dim argument is ignored).  The coordinates are
+//		summed in chunks of ANN_FIXED_CHUNK whose SSE code is unrolled
+//		at compile time by ANNl2Chunk, with the bound checked between
+//		chunks; the scalar remainder loop is empty when DIM is a
+//		multiple of 4.  It is instantiated for the widths in
+//		annL2DistFunc() (metric.cpp), which picks the variant once for
+//		a given dimension.
+//----------------------------------------------------------------------
+
+const int ANN_FIXED_CHUNK = 64;			// coordinates between bound checks
+
+template <int D>						// squares of D coordinates (D%4 == 0)
+struct ANNl2Chunk {
+	static __m128 sum(const ANNcoord *p, const ANNcoord *q)
+	{
+		__m128 t = _mm_sub_ps(_mm_loadu_ps(q), _mm_loadu_ps(p));
+		return _mm_add_ps(_mm_mul_ps(t, t), ANNl2Chunk<D-4>::sum(p + 4, q + 4));
+	}
+};
+
+template <>
+struct ANNl2Chunk<0> {
+	static __m128 sum(const ANNcoord * /*p*/, const ANNcoord * /*q*/)
+		{ return _mm_setzero_ps(); }
+};
+
+template <int DIM>
+struct ANNmetricL2fixed: public ANNmetricL2 {
+	static ANNdist dist(int /*dim*/, const ANNcoord *p, const ANNcoord *q, ANNdist bound)
+	{
+		const int rest = (DIM % ANN_FIXED_CHUNK) & ~3;
+		ANNdist dist = 0;
+		int d = 0;
+		for (; d + ANN_FIXED_CHUNK <= DIM; d += ANN_FIXED_CHUNK) {
+			dist += annHsum(ANNl2Chunk<ANN_FIXED_CHUNK>::sum(p + d, q + d));
+			if (dist > bound) return dist;
+		}
+		dist += annHsum(ANNl2Chunk<rest>::sum(p + d, q + d));
+		for (d += rest; d < DIM; d++) {	// remaining coordinates
+			ANNcoord t = q[d] - p[d];
+			dist += t*t;
+		}
+		return dist;
+	}
+};
+
+typedef ANNdist (*ANNdistFunc)(			// a policy's dist()
+	int				dim,				// dimension
+	const ANNcoord	*p,					// the points
+	const ANNcoord	*q,
+	ANNdist			bound);				// stop once above this
+
+DLL_API ANNdistFunc annL2DistFunc(		// squared L2 for a dimension
+	int				dim);				// dimension
+
+//----------------------------------------------------------------------
+//	annNormalizePt(), annNormalizePts()
+//		Scale points to unit L2 length (zero points are left alone),
+//		for cosine similarity.
+//----------------------------------------------------------------------
+
+DLL_API void annNormalizePt(
+	int				dim,				// dimension
+	ANNpoint		p);					// the point (modified)
+
+DLL_API void annNormalizePts(
+	ANNpointArray	pa,					// the points (modified)
+	int				n,					// number of points
+	int				dim);				// dimension
+
+//----------------------------------------------------------------------
+//	Brute-force search for a given metric
+//		The same as ANNbruteForce, but with the distance of Metric.
+//		Instantiated (in metric.cpp) for the four policies above.
+//----------------------------------------------------------------------
+
+template <class Metric>
+class DLL_API ANNbruteForceT: public ANNpointSet {
+	int				dim;				// dimension
+	int				n_pts;				// number of points
+	ANNpointArray	pts;				// point array
+public:
+	ANNbruteForceT(						// constructor from point array
+		ANNpointArray	pa,				// point array
+		int				n,				// number of points
+		int				dd)				// dimension
+		{ dim = dd;  n_pts = n;  pts = pa; }
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound (ignored)
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// query point
+		ANNdist			sqRad,			// radius (as a distance)
+		int				k = 0,			// number of near neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound (ignored)
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// return number of points
+		{ return n_pts; }
+
+	ANNpointArray thePoints()			// return pointer to points
+		{  return pts;  }
+};
+
+//----------------------------------------------------------------------
+//	annNewL2BruteForce()
+//		Brute-force search structure for squared L2 that uses
+//		ANNmetricL2fixed when dd is one of the specialized widths, and
+//		ANNbruteForce otherwise.
+//----------------------------------------------------------------------
+
+DLL_API ANNpointSet* annNewL2BruteForce(
+	ANNpointArray	pa,					// point array
+	int				n,					// number of points
+	int				dd);				// dimension
+
+//----------------------------------------------------------------------
+//	Flat kd-tree search for a given metric
+//		A kd-tree's cells do not depend on the metric, so a tree built
+//		as usual can be searched with any metric whose is_metric is
+//		set.  Instantiated (in metric.cpp) for L2, L1 and L_inf.
+//		annAllKnn() also builds its graph in the metric (all_knn.cpp).
+//----------------------------------------------------------------------
+
+class ANNmin_k;							// k smallest keys (pr_queue_k.h)
+
+template <class Metric>
+class DLL_API ANNkd_flat_treeT: public ANNkd_flat_tree {
+	int search(							// search with kNN or radius bound
+		ANNpoint		q,				// query point
+		ANNmin_k		&mk,			// k closest points (modified)
+		ANNdist			rad,			// radius (ANN_DIST_INF for none)
+		double			eps);			// error bound
+public:
+	ANNkd_flat_treeT(					// flatten a kd-tree
+		ANNkd_tree&		tree)			// the tree
+		: ANNkd_flat_tree(tree) {}
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// radius (as a distance)
+		int				k,				// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	void annAllKnn(						// k nearest neighbors of all points
+		int				k,				// number of neighbors
+		ANNknnGraph&	graph,			// the graph (returned)
+		double			eps=0.0,		// error bound
+		int				nThreads = 0);	// threads to use (0 = all cores)
+};
+
+#endif
@@ -0,0 +1,155 @@
+//----------------------------------------------------------------------
+//	File:			ANNshard.h
+//	Description:	Sharded search structure
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#ifndef ANNshard_H
+#define ANNshard_H
+
+#include <ANN/ANN.h>					// basic ANN includes
+
+#include <condition_variable>			// worker wakeup
+#include <functional>					// shard builders
+#include <mutex>						// job state
+#include <thread>						// shard workers
+#include <vector>
+
+//----------------------------------------------------------------------
+//	Sharded index
+//		The points are split into P contiguous shards, and each shard
+//		gets its own copy of its points and its own search structure,
+//		made by a builder function (a kd-tree, brute force, or any
+//		other ANNpointSet).  Each shard is owned by a worker thread
+//		that copies the points and builds the structure itself, so
+//		that with first-touch allocation its memory lives on the node
+//		the thread runs on.  With numa set, the worker of shard s is
+//		pinned to NUMA node s mod annNumaNodes().
+//
+//		A search is handed to all workers at once; each returns its k
+//		nearest (indices shifted back to the whole point set), and the
+//		P lists are merged into the overall k nearest.  The searches
+//		of one index are serialized, so for throughput pass many
+//		queries to annkSearchBatch(), which hands each worker the whole
+//		batch and merges afterwards.
+//
+//		A builder is called as build(pa, n, dd) on the shard's copy of
+//		its points and returns a new structure, which the index
+//		deletes.  Searches of different shards run at the same time,
+//		so the structures must not share search state; the ANN
+//		structures keep theirs in thread-local storage.
+//----------------------------------------------------------------------
+
+typedef std::function<ANNpointSet* (ANNpointArray pa, int n, int dd)>
+		ANNshardBuilder;
+
+struct ANNshard;						// one shard (shard.cpp)
+
+class DLL_API ANNsharded: public ANNpointSet {
+	int				dim;				// dimension of space
+	int				n_pts;				// number of points
+	ANNpointArray	pts;				// the points
+	std::vector<ANNshard*> shards;		// the shards
+
+	std::mutex		lock;				// protects the job state
+	std::mutex		search_lock;		// one search at a time
+	std::condition_variable	work_cv;	// a job or stop is posted
+	std::condition_variable	done_cv;	// a worker has finished
+	unsigned		job_gen;			// number of jobs posted
+	int				pending;			// workers still busy
+	bool			stop;				// workers should exit
+
+	ANNpointArray	job_q;				// queries of the job
+	int				job_nq;				// number of queries
+	int				job_k;				// neighbors per query
+	bool			job_fr;				// fixed-radius search?
+	ANNdist			job_rad;			// its squared radius
+	double			job_eps;			// error bound
+	int				job_max_pts;		// caller's annMaxPtsVisit() limit
+
+	void worker(						// body of a shard's thread
+		ANNshard		*s,				// the shard
+		ANNshardBuilder	build);			// its builder
+
+	void run(							// post a job and wait for it
+		ANNpointArray	qa,				// queries
+		int				nq,				// number of queries
+		int				k,				// neighbors per query
+		bool			fr,				// fixed-radius search?
+		ANNdist			rad,			// its squared radius
+		double			eps);			// error bound
+
+	int merge(							// merge shard results of a query
+		int				qi,				// query within the job
+		int				k,				// neighbors to return
+		ANNidxArray		nn_idx,			// merged indices (modified)
+		ANNdistArray	dd);			// merged distances (modified)
+
+public:
+	ANNsharded(							// build from point array
+		ANNpointArray	pa,				// point array
+		int				n,				// number of points
+		int				dd,				// dimension
+		int				n_shards,		// number of shards (P)
+		ANNshardBuilder	build,			// builds a shard's structure
+		bool			numa = false);	// pin shards to NUMA nodes?
+
+	~ANNsharded();						// destructor
+
+	void annkSearch(					// approx k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	int annkFRSearch(					// approx fixed-radius kNN search
+		ANNpoint		q,				// the query point
+		ANNdist			sqRad,			// squared radius of query ball
+		int				k = 0,			// number of neighbors to return
+		ANNidxArray		nn_idx = NULL,	// nearest neighbor array (modified)
+		ANNdistArray	dd = NULL,		// dist to near neighbors (modified)
+		double			eps=0.0);		// error bound
+
+	void annkSearchBatch(				// k near neighbors of many queries
+		ANNpointArray	qa,				// query points
+		int				nq,				// number of queries
+		int				k,				// neighbors per query
+		ANNidxArray		nn_idx,			// nq*k indices (modified)
+		ANNdistArray	dd,				// nq*k distances (modified)
+		double			eps=0.0);		// error bound
+
+	int nShards()						// return number of shards
+		{ return (int) shards.size(); }
+
+	int theDim()						// return dimension of space
+		{ return dim; }
+
+	int nPoints()						// return number of points
+		{ return n_pts; }
+
+	ANNpointArray thePoints()			// return pointer to points
+		{  return pts;  }
+};
+
+//----------------------------------------------------------------------
+//	annNumaNodes()
+//		Number of NUMA nodes of the machine (1 if it is not NUMA or the
+//		count is not available).
+//----------------------------------------------------------------------
+
+DLL_API int annNumaNodes();
+
+#endif
@@ -39,6 +39,10 @@
 #include <iomanip>				// I/O manipulators
 #include <ANN/ANN.h>			// ANN includes
 
+#ifdef ANN_METRIC_L2
+#include <ANN/ANNmetric.h>		// SSE distances
+#endif
+
 //----------------------------------------------------------------------
 //	Global constants and types
 //----------------------------------------------------------------------
@@ -55,8 +59,90 @@ enum ANNerr {ANNwarn = 0, ANNabort = 1};
 //	and the algorithm applies its normal termination condition.
 //----------------------------------------------------------------------
 
-extern int		ANNmaxPtsVisited;	// maximum number of pts visited
-extern int		ANNptsVisited;		// number of pts visited in search
+extern thread_local int ANNmaxPtsVisited;	// maximum number of pts visited (per thread)
+extern thread_local int ANNptsVisited;	// number of pts visited in search
+
+//----------------------------------------------------------------------
+//	Per-query search budget
+//	ANNsearchBudgetP is the budget of the current query (NULL if the
+//	query has none).  annSearchStop() is called by the searches where
+//	they check ANNmaxPtsVisited; it returns ANNtrue, and sets
+//	ANNsearchCut, once either limit is exceeded.  annBudgetStart()
+//	and annBudgetEnd() bracket a budgeted query; the latter returns
+//	ANNtrue if the query was not cut off.
+//----------------------------------------------------------------------
+
+extern thread_local const ANNsearchBudget *ANNsearchBudgetP;	// budget of current query
+extern thread_local int ANNleavesVisited;	// number of leaves visited in search
+extern thread_local ANNbool ANNsearchCut;	// was the search cut off?
+
+ANNbool annBudgetExceeded();		// is the current budget used up?
+void annBudgetStart(const ANNsearchBudget &budget);	// start budget
+ANNbool annBudgetEnd();				// end budget (ANNtrue if exact)
+
+inline ANNbool annSearchStop()		// should the search stop now?
+{
+	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited)
+		return ANNsearchCut = ANNtrue;
+	if (ANNsearchBudgetP != NULL)
+		return annBudgetExceeded();
+	return ANNfalse;
+}
+
+//----------------------------------------------------------------------
+//	Distance with early abandonment
+//	annDistBound() computes the distance from q to p, stopping once
+//	the partial sum exceeds bound.  Rather than testing after every
+//	coordinate, the sum is tested once per block of ANN_DIST_BLOCK
+//	coordinates; for the Euclidean norm this is ANNmetricL2::dist(),
+//	which sums a block with SSE.
+//	A return value greater than bound means the point was abandoned.
+//	All the exact leaf and brute-force scans use this routine, so
+//	they agree on distances to the last bit.
+//----------------------------------------------------------------------
+
+const int ANN_DIST_BLOCK = 8;		// coordinates between bound checks
+
+inline ANNdist annDistBound(		// distance, abandoned above bound
+	int				dim,		// dimension of space
+	const ANNcoord	*p,			// data point
+	const ANNcoord	*q,			// query point
+	ANNdist			bound)		// stop once the distance exceeds this
+{
+#ifdef ANN_METRIC_L2
+	return ANNmetricL2::dist(dim, p, q, bound);
+#else
+	ANNdist dist = 0;
+	int d = 0;
+	for (; d + ANN_DIST_BLOCK <= dim; d += ANN_DIST_BLOCK) {
+		for (int e = d; e < d + ANN_DIST_BLOCK; e++) {
+			ANNcoord t = q[e] - p[e];
+			dist = ANN_SUM(dist, ANN_POW(t));
+		}
+		if (dist > bound) return dist;
+	}
+	for (; d < dim; d++) {			// remaining coordinates
+		ANNcoord t = q[d] - p[d];
+		dist = ANN_SUM(dist, ANN_POW(t));
+	}
+	return dist;
+#endif
+}
+
+//----------------------------------------------------------------------
+//	Number of threads used in tree construction
+//	Subtrees of large kd- and bd-trees are built concurrently, and
+//	the point scans of the top-level splits are divided among the
+//	threads left over.  ANNbuildThreads is set by annBuildThreads();
+//	if it is 0 (its default) annBuildThreadCount() returns the number
+//	of hardware threads.  ANNlocalBuildThreads, set by
+//	annLocalBuildThreads(), overrides it on one thread when nonzero.
+//----------------------------------------------------------------------
+
+extern int		ANNbuildThreads;	// max threads used in construction
+extern thread_local int ANNlocalBuildThreads;	// override for this thread
+
+int annBuildThreadCount();			// effective number of build threads
 
 //----------------------------------------------------------------------
 //	Global function declarations
@@ -0,0 +1,334 @@
+//----------------------------------------------------------------------
+// File:			all_knn.cpp
+// Description:		k-nearest neighbor graphs of whole point sets
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include "kd_flat.h"					// flat kd-tree declarations
+
+#include <ANN/ANNmetric.h>				// metric policies
+
+#include <atomic>						// shared work counter
+#include <thread>						// parallel construction
+#include <vector>						// STL vector
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	ANNknnGraph
+//----------------------------------------------------------------------
+
+ANNknnGraph::~ANNknnGraph()
+{
+	delete [] offset;
+	delete [] nbr;
+	delete [] dist;
+}
+
+void ANNknnGraph::build(
+	int					n,				// number of points
+	int					k,				// results per point
+	ANNidxArray			idx,			// n*k indices (ANN_NULL_IDX unused)
+	ANNdistArray		dd)				// n*k squared distances
+{
+	delete [] offset;
+	delete [] nbr;
+	delete [] dist;
+
+	n_pts = n;
+	offset = new ANNidx[n+1];
+	offset[0] = 0;
+	for (int i = 0; i < n; i++) {		// count the neighbors found
+		int deg = 0;
+		while (deg < k && idx[(size_t) i*k + deg] != ANN_NULL_IDX)
+			deg++;
+		offset[i+1] = offset[i] + deg;
+	}
+	nbr = new ANNidx[offset[n]];
+	dist = new ANNdist[offset[n]];
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < degree(i); j++) {
+			nbr[offset[i] + j] = idx[(size_t) i*k + j];
+			dist[offset[i] + j] = dd[(size_t) i*k + j];
+		}
+	}
+}
+
+//----------------------------------------------------------------------
+//	annAllKnnThreads - run work(0) .. work(n_items-1) in parallel
+//		Threads take items from a shared counter.
+//----------------------------------------------------------------------
+
+template <class Work>
+static void annAllKnnThreads(
+	int					n_items,		// number of work items
+	int					nThreads,		// threads to use (0 = all cores)
+	Work				work)			// work(i) processes item i
+{
+	int n_thr = nThreads;
+	if (n_thr <= 0) {
+		n_thr = (int) thread::hardware_concurrency();
+		if (n_thr <= 0) n_thr = 1;		// unknown counts as one
+	}
+	if (n_thr > n_items) n_thr = (n_items > 0 ? n_items : 1);
+
+	atomic<int> next(0);				// next item
+	int max_pts = ANNmaxPtsVisited;		// the caller's limit
+	auto worker = [&]() {
+		ANNmaxPtsVisited = max_pts;
+		for (int i = next++; i < n_items; i = next++)
+			work(i);
+	};
+	vector<thread> helpers;
+	for (int t = 1; t < n_thr; t++)
+		helpers.push_back(thread(worker));
+	worker();
+	for (size_t t = 0; t < helpers.size(); t++)
+		helpers[t].join();
+}
+
+static void annAllKnnStore(				// store k results of a point
+	ANNmin_k			&mk,			// its k closest points
+	int					k,				// number of neighbors
+	ANNidxArray			idx,			// row of k indices (modified)
+	ANNdistArray		dd)				// row of k distances (modified)
+{
+	for (int i = 0; i < k; i++) {
+		idx[i] = mk.ith_smallest_info(i);
+		dd[i] = mk.ith_smallest_key(i);
+	}
+}
+
+//----------------------------------------------------------------------
+//	Brute-force all-kNN (blocked self-join)
+//----------------------------------------------------------------------
+
+const int ANN_JOIN_QBLOCK = 32;			// query points per block
+const int ANN_JOIN_DBLOCK = 256;		// data points per block
+
+void ANNbruteForce::annAllKnn(
+	int					k,				// number of neighbors
+	ANNknnGraph			&graph,			// the graph (returned)
+	int					nThreads)		// threads to use (0 = all cores)
+{
+	ANNpointArray scan_pts = (ord_pts != NULL ? ord_pts : pts);
+	ANNidxArray idx = new ANNidx[(size_t) n_pts*k];
+	ANNdistArray dd = new ANNdist[(size_t) n_pts*k];
+	int n_blocks = (n_pts + ANN_JOIN_QBLOCK - 1) / ANN_JOIN_QBLOCK;
+
+	annAllKnnThreads(n_blocks, nThreads, [&](int b) {
+		int q_lo = b*ANN_JOIN_QBLOCK;
+		int q_hi = min(n_pts, q_lo + ANN_JOIN_QBLOCK);
+		vector<ANNmin_k*> mk(q_hi - q_lo);
+		for (int q = q_lo; q < q_hi; q++)
+			mk[q-q_lo] = new ANNmin_k(k);
+
+		for (int d_lo = 0; d_lo < n_pts; d_lo += ANN_JOIN_DBLOCK) {
+			int d_hi = min(n_pts, d_lo + ANN_JOIN_DBLOCK);
+			for (int q = q_lo; q < q_hi; q++) {
+				ANNmin_k &qk = *mk[q-q_lo];
+				ANNdist min_dist = qk.max_key();
+				for (int i = d_lo; i < d_hi; i++) {
+					if (i == q) continue;	// not its own neighbor
+					ANNdist dist = annDistBound(dim, scan_pts[i], scan_pts[q], min_dist);
+					if (dist <= min_dist) {
+						qk.insert(dist, i);
+						min_dist = qk.max_key();
+					}
+				}
+			}
+		}
+
+		for (int q = q_lo; q < q_hi; q++) {
+			annAllKnnStore(*mk[q-q_lo], k, idx + (size_t) q*k, dd + (size_t) q*k);
+			delete mk[q-q_lo];
+		}
+	});
+
+	graph.build(n_pts, k, idx, dd);
+	delete [] idx;
+	delete [] dd;
+}
+
+//----------------------------------------------------------------------
+//	Flat kd-tree all-kNN
+//		annFlatSearchRest() is the search of ANNkd_flat_tree::annkSearch
+//		for a query point of leaf skip, with the k closest points already
+//		seeded from that leaf, so the leaf itself is not scanned again.
+//		Both it and annFlatAllKnn() take the metric as a policy (see
+//		ANNmetric.h), so that ANNkd_flat_treeT builds its graph in its
+//		own metric.  ANNmetricANN is the metric of the ANN_POW, ANN_SUM
+//		and ANN_DIFF macros, which ANNkd_flat_tree itself searches with.
+//----------------------------------------------------------------------
+
+struct ANNmetricANN {					// the library's compiled metric
+	static ANNdist power(ANNcoord v) { return ANN_POW(v); }
+	static ANNdist sum(ANNdist x, ANNdist y) { return ANN_SUM(x, y); }
+	static ANNdist diff(ANNdist x, ANNdist y) { return ANN_DIFF(x, y); }
+
+	static ANNdist dist(int dim, const ANNcoord *p, const ANNcoord *q, ANNdist bound)
+		{ return annDistBound(dim, p, q, bound); }
+};
+
+struct ANNflat_view {					// arrays of a flat tree
+	int					dim;			// dimension of space
+	int					n_pts;			// number of points
+	int					n_nodes;		// number of nodes
+	int					depth;			// depth of tree
+	const ANNkd_flat_node *nodes;		// nodes
+	const ANNcoord		*leaf_pts;		// leaf point coordinates
+	const ANNidx		*leaf_idx;		// their indices
+	ANNpoint			lo;				// bounding box low point
+	ANNpoint			hi;				// bounding box high point
+};
+
+template <class Metric>
+static void annFlatSearchRest(
+	const ANNflat_view	&t,				// the tree
+	const ANNcoord		*q,				// query point
+	int					skip,			// leaf already searched
+	double				max_err,		// max tolerable error factor
+	ANNmin_k			&mk,			// k closest points (modified)
+	ANNkd_flat_stack	*stack)			// search stack (depth+1 entries)
+{
+	int top = 0;
+	stack[top].node = 0;
+	stack[top].dist = annBoxDistanceT<Metric>(q, t.lo, t.hi, t.dim);
+	top++;
+
+	while (top > 0) {
+		top--;
+		int ni = stack[top].node;
+		ANNdist box_dist = stack[top].dist;
+		if (box_dist * max_err >= mk.max_key())
+			continue;					// box too far
+
+		while (t.nodes[ni].cut_dim >= 0) {	// descend to the closer leaf
+			const ANNkd_flat_node &nd = t.nodes[ni];
+			ANNcoord cut_diff = q[nd.cut_dim] - nd.cut_val;
+			ANNcoord box_diff;
+			int near_c, far_c;
+			if (cut_diff < 0) {			// left of cutting plane
+				box_diff = nd.cd_bnds[ANN_LO] - q[nd.cut_dim];
+				near_c = nd.first;
+				far_c = nd.first + 1;
+			}
+			else {						// right of cutting plane
+				box_diff = q[nd.cut_dim] - nd.cd_bnds[ANN_HI];
+				near_c = nd.first + 1;
+				far_c = nd.first;
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// stack further child unless empty
+			if (t.nodes[far_c].cut_dim >= 0 || t.nodes[far_c].n > 0) {
+				stack[top].node = far_c;
+				stack[top].dist = Metric::sum(box_dist,
+						Metric::diff(Metric::power(box_diff), Metric::power(cut_diff)));
+				top++;
+			}
+			ni = near_c;
+		}
+		if (ni == skip) continue;		// seeded already
+
+		const ANNkd_flat_node &lf = t.nodes[ni];
+		ANNdist min_dist = mk.max_key();// k-th smallest distance so far
+		const ANNcoord *pp = t.leaf_pts + (size_t) lf.first*t.dim;
+		for (int i = 0; i < lf.n; i++, pp += t.dim) {
+			ANNdist dist = Metric::dist(t.dim, pp, q, min_dist);
+			if (dist <= min_dist) {		// among the k best?
+				mk.insert(dist, t.leaf_idx[lf.first + i]);
+				min_dist = mk.max_key();
+			}
+		}
+	}
+}
+
+template <class Metric>
+static void annFlatAllKnn(
+	const ANNflat_view	&t,				// the tree
+	int					k,				// number of neighbors
+	ANNknnGraph			&graph,			// the graph (returned)
+	double				eps,			// error bound
+	int					nThreads)		// threads to use (0 = all cores)
+{
+	int dim = t.dim;
+	ANNidxArray idx = new ANNidx[(size_t) t.n_pts*k];
+	ANNdistArray dd = new ANNdist[(size_t) t.n_pts*k];
+	double max_err = Metric::power((ANNcoord) (1.0 + eps));
+
+	vector<int> leaves;					// nonempty leaves
+	for (int i = 0; i < t.n_nodes; i++) {
+		if (t.nodes[i].cut_dim < 0 && t.nodes[i].n > 0)
+			leaves.push_back(i);
+	}
+
+	annAllKnnThreads((int) leaves.size(), nThreads, [&](int li) {
+		const ANNkd_flat_node &lf = t.nodes[leaves[li]];
+		const ANNcoord *base = t.leaf_pts + (size_t) lf.first*dim;
+		const ANNidx *ids = t.leaf_idx + lf.first;
+		vector<ANNmin_k*> mk(lf.n);
+		for (int a = 0; a < lf.n; a++)
+			mk[a] = new ANNmin_k(k);
+										// pairs within the leaf, once
+		for (int a = 0; a < lf.n; a++) {
+			for (int b = a+1; b < lf.n; b++) {
+				ANNdist dist = Metric::dist(dim, base + (size_t) b*dim,
+						base + (size_t) a*dim, ANN_DIST_INF);
+				mk[a]->insert(dist, ids[b]);
+				mk[b]->insert(dist, ids[a]);
+			}
+		}
+										// then the rest of the tree
+		ANNkd_flat_stack *stack = annFlatStack(t.depth);
+		for (int a = 0; a < lf.n; a++) {
+			annFlatSearchRest<Metric>(t, base + (size_t) a*dim, leaves[li],
+					max_err, *mk[a], stack);
+			annAllKnnStore(*mk[a], k, idx + (size_t) ids[a]*k, dd + (size_t) ids[a]*k);
+			delete mk[a];
+		}
+	});
+
+	graph.build(t.n_pts, k, idx, dd);
+	delete [] idx;
+	delete [] dd;
+}
+
+void ANNkd_flat_tree::annAllKnn(
+	int					k,				// number of neighbors
+	ANNknnGraph			&graph,			// the graph (returned)
+	double				eps,			// error bound
+	int					nThreads)		// threads to use (0 = all cores)
+{
+	ANNflat_view t = { dim, n_pts, n_nodes, depth, nodes, leaf_pts, leaf_idx,
+					   bnd_box_lo, bnd_box_hi };
+	annFlatAllKnn<ANNmetricANN>(t, k, graph, eps, nThreads);
+}
+
+template <class Metric>
+void ANNkd_flat_treeT<Metric>::annAllKnn(
+	int					k,				// number of neighbors
+	ANNknnGraph			&graph,			// the graph (returned)
+	double				eps,			// error bound
+	int					nThreads)		// threads to use (0 = all cores)
+{
+	ANNflat_view t = { dim, n_pts, n_nodes, depth, nodes, leaf_pts, leaf_idx,
+					   bnd_box_lo, bnd_box_hi };
+	annFlatAllKnn<Metric>(t, k, graph, eps, nThreads);
+}
+
+template void ANNkd_flat_treeT<ANNmetricL2>::annAllKnn(int, ANNknnGraph&, double, int);
+template void ANNkd_flat_treeT<ANNmetricL1>::annAllKnn(int, ANNknnGraph&, double, int);
+template void ANNkd_flat_treeT<ANNmetricLinf>::annAllKnn(int, ANNknnGraph&, double, int);
@@ -0,0 +1,307 @@
+//----------------------------------------------------------------------
+// File:			ball_tree.cpp
+// Description:		Ball tree for Euclidean nearest neighbor search
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include <ANN/ANNx.h>					// all ANN includes
+#include "pr_queue.h"					// priority queue of nodes
+#include "pr_queue_k.h"					// k-element priority queue
+
+#include <algorithm>					// nth_element
+#include <cmath>						// sqrt
+#include <cstdint>						// intptr_t
+#include <vector>						// construction work lists
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	ANNball_node
+//		The points of a node are leaf_idx[first..first+n-1], and their
+//		coordinates the same rows of leaf_pts.  The two children of a
+//		splitting node are consecutive.
+//----------------------------------------------------------------------
+
+struct ANNball_node {
+	int					first;			// its first point
+	int					n;				// number of points
+	int					child;			// first child (-1 for a leaf)
+	ANNdist				radius;			// radius of its ball (not squared)
+};
+
+//----------------------------------------------------------------------
+//	Construction
+//		A node's center is the centroid of its points and its radius
+//		the largest distance from the centroid.  A node with more than
+//		bs points is split: a is the point farthest from the centroid,
+//		b the point farthest from a, and the points are divided at the
+//		median of their projections on b - a.  The node at slot is
+//		filled in, and its children are given slots at the end of the
+//		list before either subtree is built.
+//----------------------------------------------------------------------
+
+static int annFarthest(					// point of pidx[lo..hi) farthest from c
+	ANNpointArray		pa,				// points
+	ANNidxArray			pidx,			// point indices
+	int					lo,				// first
+	int					hi,				// one past last
+	int					dim,			// dimension
+	const ANNcoord		*c)				// the center
+{
+	int best = pidx[lo];
+	ANNdist best_dist = -1;
+	for (int i = lo; i < hi; i++) {
+		ANNdist d = annDistBound(dim, pa[pidx[i]], c, ANN_DIST_INF);
+		if (d > best_dist) {
+			best_dist = d;
+			best = pidx[i];
+		}
+	}
+	return best;
+}
+
+static void annBuildBall(
+	vector<ANNball_node>	&nodes,		// nodes (modified)
+	vector<ANNcoord>	&centers,		// centers (modified)
+	ANNpointArray		pa,				// points
+	ANNidxArray			pidx,			// point indices (permuted)
+	int					lo,				// first point of the node
+	int					hi,				// one past its last point
+	int					dim,			// dimension
+	int					bs,				// bucket size
+	int					slot)			// index of the node
+{
+	ANNcoord *c = &centers[(size_t) slot*dim];
+	for (int d = 0; d < dim; d++) c[d] = 0;
+	for (int i = lo; i < hi; i++)
+		for (int d = 0; d < dim; d++) c[d] += pa[pidx[i]][d];
+	for (int d = 0; d < dim; d++) c[d] /= (hi - lo);
+
+	ANNdist r2 = 0;
+	for (int i = lo; i < hi; i++)
+		r2 = max(r2, annDistBound(dim, pa[pidx[i]], c, ANN_DIST_INF));
+
+	ANNball_node nd;
+	nd.first = lo;
+	nd.n = hi - lo;
+	nd.child = -1;
+	nd.radius = (ANNdist) sqrt((double) r2);
+	if (hi - lo <= bs || r2 == 0) {		// leaf (or all points equal)
+		nodes[slot] = nd;
+		return;
+	}
+
+	int a = annFarthest(pa, pidx, lo, hi, dim, c);
+	int b = annFarthest(pa, pidx, lo, hi, dim, pa[a]);
+	vector<ANNcoord> dir(dim);
+	for (int d = 0; d < dim; d++) dir[d] = pa[b][d] - pa[a][d];
+	vector<pair<ANNcoord, ANNidx> > proj(hi - lo);
+	for (int i = lo; i < hi; i++) {
+		ANNcoord s = 0;
+		for (int d = 0; d < dim; d++) s += pa[pidx[i]][d] * dir[d];
+		proj[i - lo] = make_pair(s, pidx[i]);
+	}
+	int mid = (hi - lo) / 2;
+	nth_element(proj.begin(), proj.begin() + mid, proj.end());
+	for (int i = lo; i < hi; i++) pidx[i] = proj[i - lo].second;
+
+	nd.child = (int) nodes.size();
+	nodes[slot] = nd;
+	nodes.resize(nodes.size() + 2);
+	centers.resize(nodes.size() * dim);
+	annBuildBall(nodes, centers, pa, pidx, lo, lo + mid, dim, bs, nd.child);
+	annBuildBall(nodes, centers, pa, pidx, lo + mid, hi, dim, bs, nd.child + 1);
+}
+
+ANNball_tree::ANNball_tree(
+	ANNpointArray		pa,				// point array
+	int					n,				// number of points
+	int					dd,				// dimension
+	int					bs)				// bucket size
+{
+	dim = dd;
+	n_pts = n;
+	pts = pa;
+	leaf_idx = new ANNidx[max(n, 1)];
+	leaf_pts = new ANNcoord[(size_t) max(n, 1)*dim];
+	for (int i = 0; i < n; i++) leaf_idx[i] = i;
+
+	vector<ANNball_node> work(n > 0 ? 1 : 0);
+	vector<ANNcoord> work_c(work.size()*dim);
+	if (n > 0)
+		annBuildBall(work, work_c, pa, leaf_idx, 0, n, dim, max(bs, 1), 0);
+
+	n_nodes = (int) work.size();
+	nodes = new ANNball_node[max(n_nodes, 1)];
+	centers = new ANNcoord[(size_t) max(n_nodes, 1)*dim];
+	copy(work.begin(), work.end(), nodes);
+	copy(work_c.begin(), work_c.end(), centers);
+	for (int i = 0; i < n; i++)			// coordinates in leaf order
+		for (int d = 0; d < dim; d++)
+			leaf_pts[(size_t) i*dim + d] = pa[leaf_idx[i]][d];
+}
+
+ANNball_tree::~ANNball_tree()
+{
+	delete [] nodes;
+	delete [] centers;
+	delete [] leaf_pts;
+	delete [] leaf_idx;
+}
+
+//----------------------------------------------------------------------
+//	lowerBound - squared distance from q to the ball of a node
+//		(zero if q is inside the ball).  The distances are float sums,
+//		so the bound is lowered by BALL_SLACK (relative) to stay below
+//		the computed distances of the points in the ball.
+//----------------------------------------------------------------------
+
+const double BALL_SLACK = 1e-5;
+
+ANNdist ANNball_tree::lowerBound(
+	ANNpoint			q,				// query point
+	int					node)			// the node
+{
+	ANNdist dc = annDistBound(dim, centers + (size_t) node*dim, q, ANN_DIST_INF);
+	double gap = sqrt((double) dc)*(1 - BALL_SLACK) - nodes[node].radius*(1 + BALL_SLACK);
+	return (ANNdist) (gap > 0 ? gap*gap : 0);
+}
+
+//----------------------------------------------------------------------
+//	annkSearch - k nearest neighbors
+//		The nodes wait in an ANNpr_queue keyed by their lower bound.
+//		The closest is taken; a leaf has its points checked, and a
+//		splitting node has its children queued unless their bounds
+//		already exceed the k-th distance found (reduced by the error
+//		factor).  The search ends when the closest node left is too far.
+//----------------------------------------------------------------------
+
+void ANNball_tree::annkSearch(
+	ANNpoint			q,				// the query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
+	}
+	double max_err = ANN_POW(1.0 + eps);
+	ANNmin_k mk(k);						// set of k closest points
+	ANNpr_queue pq(max(n_nodes, 1));	// nodes to visit
+	int pts_visited = 0;
+	if (n_nodes > 0)
+		pq.insert(lowerBound(q, 0), (PQinfo) (intptr_t) 0);
+
+	while (pq.non_empty()) {
+		if (ANNmaxPtsVisited != 0 && pts_visited > ANNmaxPtsVisited)
+			break;
+		PQkey bound;
+		PQinfo info;
+		pq.extr_min(bound, info);
+		if (bound * max_err >= mk.max_key())
+			break;						// all the rest are farther
+		const ANNball_node &nd = nodes[(intptr_t) info];
+
+		if (nd.child >= 0) {			// queue the children
+			for (int c = nd.child; c < nd.child + 2; c++) {
+				ANNdist lb = lowerBound(q, c);
+				if (lb * max_err < mk.max_key())
+					pq.insert(lb, (PQinfo) (intptr_t) c);
+			}
+			continue;
+		}
+
+		ANNdist min_dist = mk.max_key();// k-th smallest distance so far
+		const ANNcoord *pp = leaf_pts + (size_t) nd.first*dim;
+		for (int i = 0; i < nd.n; i++, pp += dim) {
+			ANNdist dist = annDistBound(dim, pp, q, min_dist);
+			if (dist <= min_dist &&				// among the k best?
+			   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
+				mk.insert(dist, leaf_idx[nd.first + i]);
+				min_dist = mk.max_key();
+			}
+		}
+		pts_visited += nd.n;
+	}
+
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		dd[i] = mk.ith_smallest_key(i);
+		nn_idx[i] = mk.ith_smallest_info(i);
+	}
+}
+
+//----------------------------------------------------------------------
+//	annkFRSearch - fixed-radius search
+//		As annkSearch(), but a node is visited when its ball comes
+//		within the search radius, and every point within the radius is
+//		counted.
+//----------------------------------------------------------------------
+
+int ANNball_tree::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	double max_err = ANN_POW(1.0 + eps);
+	ANNmin_k mk(k);						// set of k closest points
+	ANNpr_queue pq(max(n_nodes, 1));	// nodes to visit
+	int pts_visited = 0;
+	int pts_in_range = 0;
+	if (n_nodes > 0)
+		pq.insert(lowerBound(q, 0), (PQinfo) (intptr_t) 0);
+
+	while (pq.non_empty()) {
+		if (ANNmaxPtsVisited != 0 && pts_visited > ANNmaxPtsVisited)
+			break;
+		PQkey bound;
+		PQinfo info;
+		pq.extr_min(bound, info);
+		if (bound * max_err > sqRad)
+			break;						// ball out of range
+		const ANNball_node &nd = nodes[(intptr_t) info];
+
+		if (nd.child >= 0) {
+			for (int c = nd.child; c < nd.child + 2; c++) {
+				ANNdist lb = lowerBound(q, c);
+				if (lb * max_err <= sqRad)
+					pq.insert(lb, (PQinfo) (intptr_t) c);
+			}
+			continue;
+		}
+
+		const ANNcoord *pp = leaf_pts + (size_t) nd.first*dim;
+		for (int i = 0; i < nd.n; i++, pp += dim) {
+			ANNdist dist = annDistBound(dim, pp, q, sqRad);
+			if (dist <= sqRad &&				// within range?
+			   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
+				mk.insert(dist, leaf_idx[nd.first + i]);
+				pts_in_range++;
+			}
+		}
+		pts_visited += nd.n;
+	}
+
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		if (dd != NULL)
+			dd[i] = mk.ith_smallest_key(i);
+		if (nn_idx != NULL)
+			nn_idx[i] = mk.ith_smallest_info(i);
+	}
+	return pts_in_range;
+}
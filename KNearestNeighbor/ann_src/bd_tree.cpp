@@ -32,6 +32,8 @@
 
 #include <ANN/ANNperf.h>				// performance evaluation
 
+#include <thread>						// parallel construction
+
 //----------------------------------------------------------------------
 //	Printing a bd-tree 
 //		These routines print a bd-tree.   See the analogous procedure
@@ -111,7 +113,8 @@ ANNkd_ptr rbd_tree(						// recursive construction of bd-tree
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
 	ANNkd_splitter		splitter,		// splitting routine
-	ANNshrinkRule		shrink);		// shrinking rule
+	ANNshrinkRule		shrink,			// shrinking rule
+	int					n_thr);			// threads available to build it
 
 ANNbd_tree::ANNbd_tree(					// construct from point array
 	ANNpointArray		pa,				// point array (with at least n pts)
@@ -125,6 +128,9 @@ ANNbd_tree::ANNbd_tree(					// construct from point array
 	pts = pa;							// where the points are
 	if (n == 0) return;					// no points--no sweat
 
+	int n_thr = annBuildThreadCount();	// threads used to build
+	ANNbuildThrBudget = n_thr;
+
 	ANNorthRect bnd_box(dd);			// bounding box for points
 										// construct bounding rectangle
 	annEnclRect(pa, pidx, n, dd, bnd_box);
@@ -134,25 +140,30 @@ ANNbd_tree::ANNbd_tree(					// construct from point array
 
 	switch (split) {					// build by rule
 	case ANN_KD_STD:					// standard kd-splitting rule
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split, shrink,
+						n_thr);
 		break;
 	case ANN_KD_MIDPT:					// midpoint split
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split, shrink,
+						n_thr);
 		break;
 	case ANN_KD_SUGGEST:				// best (in our opinion)
 	case ANN_KD_SL_MIDPT:				// sliding midpoint split
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split, shrink,
+						n_thr);
 		break;
 	case ANN_KD_FAIR:					// fair split
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split, shrink,
+						n_thr);
 		break;
 	case ANN_KD_SL_FAIR:				// sliding fair split
 		root = rbd_tree(pa, pidx, n, dd, bs,
-						bnd_box, sl_fair_split, shrink);
+						bnd_box, sl_fair_split, shrink, n_thr);
 		break;
 	default:
 		annError("Illegal splitting method", ANNabort);
 	}
+	ANNbuildThrBudget = 1;				// back to sequential scans
 }
 
 //----------------------------------------------------------------------
@@ -330,6 +341,11 @@ ANNdecomp selectDecomp(			// select decomposition method
 //		appropriate shrinking bounds, and create a shrinking node.
 //		Finally the points are subdivided, and the procedure is
 //		invoked recursively on the two subsets to form the children.
+//
+//		As in rkd_tree(), the two children of a large node are built
+//		concurrently when more than one thread is available.  For a
+//		shrinking node the in-child uses the inner box and the out-child
+//		the (unmodified) enclosing box, so no copy is needed.
 //----------------------------------------------------------------------
 
 ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
@@ -340,7 +356,8 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
 	ANNkd_splitter		splitter,		// splitting routine
-	ANNshrinkRule		shrink)			// shrinking rule
+	ANNshrinkRule		shrink,			// shrinking rule
+	int					n_thr)			// threads available to build it
 {
 	ANNdecomp decomp;					// decomposition method
 
@@ -352,7 +369,8 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 		else							// construct the node and return
 			return new ANNkd_leaf(n, pidx); 
 	}
-	
+
+	ANNbuildThrBudget = n_thr;			// threads for point scans
 	decomp = selectDecomp(				// select decomposition method
 				pa, pidx,				// points and indices
 				n, dim,					// number of points and dimension
@@ -369,18 +387,36 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 
 		ANNcoord lv = bnd_box.lo[cd];	// save bounds for cutting dimension
 		ANNcoord hv = bnd_box.hi[cd];
-
-		bnd_box.hi[cd] = cv;			// modify bounds for left subtree
-		ANNkd_ptr lo = rbd_tree(		// build left subtree
-				pa, pidx, n_lo,			// ...from pidx[0..n_lo-1]
-				dim, bsp, bnd_box, splitter, shrink);
-		bnd_box.hi[cd] = hv;			// restore bounds
-
-		bnd_box.lo[cd] = cv;			// modify bounds for right subtree
-		ANNkd_ptr hi = rbd_tree(		// build right subtree
-				pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
-				dim, bsp, bnd_box, splitter, shrink);
-		bnd_box.lo[cd] = lv;			// restore bounds
+		ANNkd_ptr lo, hi;				// low and high children
+
+		if (n_thr > 1 && n >= ANN_PAR_SUBTREE_PTS) {
+			int lo_thr = annSplitThreads(n_thr, n, n_lo);
+			ANNorthRect lo_box(dim, bnd_box);	// bounds for left subtree
+			lo_box.hi[cd] = cv;
+			thread lo_task([&]() {		// build left subtree concurrently
+				lo = rbd_tree(pa, pidx, n_lo,
+						dim, bsp, lo_box, splitter, shrink, lo_thr);
+			});
+			bnd_box.lo[cd] = cv;		// modify bounds for right subtree
+			hi = rbd_tree(				// build right subtree
+					pa, pidx + n_lo, n-n_lo,
+					dim, bsp, bnd_box, splitter, shrink, n_thr - lo_thr);
+			bnd_box.lo[cd] = lv;		// restore bounds
+			lo_task.join();				// wait for left subtree
+		}
+		else {
+			bnd_box.hi[cd] = cv;		// modify bounds for left subtree
+			lo = rbd_tree(				// build left subtree
+					pa, pidx, n_lo,		// ...from pidx[0..n_lo-1]
+					dim, bsp, bnd_box, splitter, shrink, n_thr);
+			bnd_box.hi[cd] = hv;		// restore bounds
+
+			bnd_box.lo[cd] = cv;		// modify bounds for right subtree
+			hi = rbd_tree(				// build right subtree
+					pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
+					dim, bsp, bnd_box, splitter, shrink, n_thr);
+			bnd_box.lo[cd] = lv;		// restore bounds
+		}
 										// create the splitting node
 		return new ANNkd_split(cd, cv, lv, hv, lo, hi);
 	}
@@ -396,10 +432,27 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 				inner_box,				// inner box
 				n_in);					// number of points inside (returned)
 
-		ANNkd_ptr in = rbd_tree(		// build inner subtree pidx[0..n_in-1]
-				pa, pidx, n_in, dim, bsp, inner_box, splitter, shrink);
-		ANNkd_ptr out = rbd_tree(		// build outer subtree pidx[n_in..n]
-				pa, pidx+n_in, n - n_in, dim, bsp, bnd_box, splitter, shrink);
+		ANNkd_ptr in, out;				// inner and outer children
+
+		if (n_thr > 1 && n >= ANN_PAR_SUBTREE_PTS) {
+			int in_thr = annSplitThreads(n_thr, n, n_in);
+			thread in_task([&]() {		// build inner subtree concurrently
+				in = rbd_tree(pa, pidx, n_in,
+						dim, bsp, inner_box, splitter, shrink, in_thr);
+			});
+			out = rbd_tree(				// build outer subtree pidx[n_in..n]
+					pa, pidx+n_in, n - n_in,
+					dim, bsp, bnd_box, splitter, shrink, n_thr - in_thr);
+			in_task.join();				// wait for inner subtree
+		}
+		else {
+			in = rbd_tree(				// build inner subtree pidx[0..n_in-1]
+					pa, pidx, n_in, dim, bsp, inner_box, splitter, shrink,
+					n_thr);
+			out = rbd_tree(				// build outer subtree pidx[n_in..n]
+					pa, pidx+n_in, n - n_in, dim, bsp, bnd_box, splitter,
+					shrink, n_thr);
+		}
 
 		ANNorthHSArray bnds = NULL;		// bounds (alloc in Box2Bnds and
 										// ...freed in bd_shrink destroyer)
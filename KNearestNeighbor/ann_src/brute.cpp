@@ -39,17 +39,74 @@
 //		Note that the error bound eps is passed in, but it is ignored.
 //		These routines compute exact nearest neighbors (which is needed
 //		for validation purposes in ann_test.cpp).
+//
+//		Each distance is abandoned once it exceeds the current k-th
+//		smallest distance (or the radius), see annDistBound().  If the
+//		structure is built with order_dims, it keeps a copy of the
+//		points with the coordinates sorted by decreasing variance, and
+//		the query is permuted the same way, so that the coordinates
+//		most likely to differ are summed first and the abandonment
+//		happens sooner.  The distances are the same up to rounding.
 //----------------------------------------------------------------------
 
 ANNbruteForce::ANNbruteForce(			// constructor from point array
 	ANNpointArray		pa,				// point array
 	int					n,				// number of points
-	int					dd)				// dimension
+	int					dd,				// dimension
+	ANNbool				order_dims)		// order dims by variance?
 {
 	dim = dd;  n_pts = n;  pts = pa;
+	dim_order = NULL;
+	ord_pts = NULL;
+	if (!order_dims || n == 0) return;
+
+	ANNdist *var = new ANNdist[dim];	// variance of each dimension
+	dim_order = new int[dim];
+	for (int d = 0; d < dim; d++) {
+		double sum = 0, sum2 = 0;
+		for (int i = 0; i < n; i++) {
+			sum += pa[i][d];
+			sum2 += (double) pa[i][d] * pa[i][d];
+		}
+		var[d] = (ANNdist) (sum2/n - (sum/n)*(sum/n));
+		dim_order[d] = d;
+	}
+	for (int d = 1; d < dim; d++) {		// insertion sort, decreasing
+		int od = dim_order[d];
+		int e;
+		for (e = d; e > 0 && var[dim_order[e-1]] < var[od]; e--)
+			dim_order[e] = dim_order[e-1];
+		dim_order[e] = od;
+	}
+	delete [] var;
+
+	ord_pts = annAllocPts(n, dim);		// permuted copy of the points
+	for (int i = 0; i < n; i++) {
+		for (int d = 0; d < dim; d++)
+			ord_pts[i][d] = pa[i][dim_order[d]];
+	}
 }
 
-ANNbruteForce::~ANNbruteForce() { }		// destructor (empty)
+ANNbruteForce::~ANNbruteForce()			// destructor
+{
+	delete [] dim_order;
+	if (ord_pts != NULL) annDeallocPts(ord_pts);
+}
+
+ANNpoint ANNbruteForce::orderQuery(		// query in scan order
+	ANNpoint			q,				// query point
+	ANNpointArray		&scan_pts)		// points to scan (returned)
+{
+	if (ord_pts == NULL) {				// coordinates in original order
+		scan_pts = pts;
+		return q;
+	}
+	scan_pts = ord_pts;
+	ANNpoint oq = annAllocPt(dim);
+	for (int d = 0; d < dim; d++)
+		oq[d] = q[dim_order[d]];
+	return oq;
+}
 
 void ANNbruteForce::annkSearch(			// approx k near neighbor search
 	ANNpoint			q,				// query point
@@ -64,13 +121,20 @@ void ANNbruteForce::annkSearch(			// approx k near neighbor search
 	if (k > n_pts) {					// too many near neighbors?
 		annError("Requesting more near neighbors than data points", ANNabort);
 	}
+	ANNpointArray scan_pts;				// points in scan order
+	ANNpoint sq = orderQuery(q, scan_pts);
+	ANNdist min_dist = mk.max_key();	// k-th smallest distance so far
 										// run every point through queue
 	for (i = 0; i < n_pts; i++) {
 										// compute distance to point
-		ANNdist sqDist = annDist(dim, pts[i], q);
-		if (ANN_ALLOW_SELF_MATCH || sqDist != 0)
+		ANNdist sqDist = annDistBound(dim, scan_pts[i], sq, min_dist);
+		if (sqDist <= min_dist &&		// among the k best?
+			(ANN_ALLOW_SELF_MATCH || sqDist != 0)) {
 			mk.insert(sqDist, i);
+			min_dist = mk.max_key();
+		}
 	}
+	if (sq != q) annDeallocPt(sq);
 	for (i = 0; i < k; i++) {			// extract the k closest points
 		dd[i] = mk.ith_smallest_key(i);
 		nn_idx[i] = mk.ith_smallest_info(i);
@@ -88,16 +152,19 @@ int ANNbruteForce::annkFRSearch(		// approx fixed-radius kNN search
 	ANNmin_k mk(k);						// construct a k-limited priority queue
 	int i;
 	int pts_in_range = 0;				// number of points in query range
+	ANNpointArray scan_pts;				// points in scan order
+	ANNpoint sq = orderQuery(q, scan_pts);
 										// run every point through queue
 	for (i = 0; i < n_pts; i++) {
 										// compute distance to point
-		ANNdist sqDist = annDist(dim, pts[i], q);
+		ANNdist sqDist = annDistBound(dim, scan_pts[i], sq, sqRad);
 		if (sqDist <= sqRad &&			// within radius bound
 			(ANN_ALLOW_SELF_MATCH || sqDist != 0)) { // ...and no self match
 			mk.insert(sqDist, i);
 			pts_in_range++;
 		}
 	}
+	if (sq != q) annDeallocPt(sq);
 	for (i = 0; i < k; i++) {			// extract the k closest points
 		if (dd != NULL)
 			dd[i] = mk.ith_smallest_key(i);
@@ -107,3 +174,25 @@ int ANNbruteForce::annkFRSearch(		// approx fixed-radius kNN search
 
 	return pts_in_range;
 }
+
+int ANNbruteForce::annRangeSearch(		// report all points in a ball
+	ANNpoint			q,				// query point
+	ANNdist				sqRad,			// squared radius
+	ANNrangeResult		&res,			// points in range (appended)
+	ANNbool				sorted,			// sort by distance?
+	double				eps)			// error bound
+{
+	int first = res.n;					// first pair added by this search
+	ANNpointArray scan_pts;				// points in scan order
+	ANNpoint sq = orderQuery(q, scan_pts);
+	for (int i = 0; i < n_pts; i++) {
+		ANNdist sqDist = annDistBound(dim, scan_pts[i], sq, sqRad);
+		if (sqDist <= sqRad &&			// within radius bound
+			(ANN_ALLOW_SELF_MATCH || sqDist != 0)) { // ...and no self match
+			res.add(i, sqDist);
+		}
+	}
+	if (sq != q) annDeallocPt(sq);
+	if (sorted) res.sort(first);		// sort the new pairs
+	return res.n - first;
+}
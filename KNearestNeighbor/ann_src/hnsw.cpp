@@ -0,0 +1,513 @@
+//----------------------------------------------------------------------
+// File:			hnsw.cpp
+// Description:		Hierarchical Navigable Small World graph index
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include <ANN/ANNhnsw.h>				// HNSW declarations
+#include <ANN/ANNx.h>					// all ANN includes
+
+#include <algorithm>					// sort
+#include <cmath>						// log
+#include <cstring>						// memcmp
+#include <functional>					// greater
+#include <queue>						// priority_queue
+#include <random>						// random levels
+#include <thread>						// parallel construction
+
+using namespace std;					// make std:: available
+
+typedef pair<ANNdist,int> ANNhnswCand;	// candidate: distance and node
+
+static const char ANNhnswMagic[8] = "ANNhnsw";	// header of saved index
+static const int ANNhnswVersion = 1;			// format of saved index
+
+//----------------------------------------------------------------------
+//	annHnswDist - squared distance between two points
+//----------------------------------------------------------------------
+
+static inline ANNdist annHnswDist(int dim, ANNpoint p, ANNpoint q)
+{
+	register ANNdist dist = 0;
+	for (register int d = 0; d < dim; d++) {
+		register ANNcoord t = p[d] - q[d];
+		dist = ANN_SUM(dist, ANN_POW(t));
+	}
+	return dist;
+}
+
+//----------------------------------------------------------------------
+//	annHnswLevel - random level of a point
+//		Levels are geometrically distributed with mean 1/ln(M).  The
+//		generator is seeded from the point index, so the levels (and
+//		hence the shape of the graph) do not depend on the order in
+//		which threads insert the points.
+//----------------------------------------------------------------------
+
+static int annHnswLevel(int i, double mult)
+{
+	minstd_rand gen((unsigned) i * 2654435761u + 1);
+	uniform_real_distribution<double> unif(0.0, 1.0);
+	double u = unif(gen);
+	if (u <= 0) u = 1e-12;
+	return (int) (-log(u) * mult);
+}
+
+//----------------------------------------------------------------------
+//	annHnswCopy - copy the link list of a node
+//		During construction the list may be changed by another thread,
+//		so it is copied under the node's lock.  Afterwards the graph is
+//		read-only and no lock is taken.
+//----------------------------------------------------------------------
+
+static inline void annHnswCopy(const int *list, vector<int> &out)
+{
+	out.assign(list + 1, list + 1 + list[0]);
+}
+
+//----------------------------------------------------------------------
+//	Constructor
+//		Levels and link storage for every point are set up first, so a
+//		node can be reached as soon as a neighbor links to it.  The
+//		first point is inserted alone as the entry point; the rest are
+//		taken from a shared counter by annBuildThreadCount() threads.
+//----------------------------------------------------------------------
+
+ANNhnsw::ANNhnsw(
+	ANNpointArray		pa,				// point array
+	int					n,				// number of points
+	int					dd,				// dimension
+	int					m,				// links per node
+	int					efC,			// candidates during construction
+	int					efS)			// candidates during search
+	: entry(-1), max_level(-1)
+{
+	dim = dd;
+	n_pts = n;
+	pts = pa;
+	own_pts = false;
+
+	M = (m < 2 ? 2 : m);
+	M0 = 2*M;
+	ef_construction = (efC < M ? M : efC);
+	ef_search = efS;
+	level_mult = 1.0 / log((double) M);
+
+	level.resize(n);
+	links0.assign((size_t) n*(M0+1), 0);
+	links.resize(n);
+	vector<mutex>(n).swap(node_lock);
+
+	for (int i = 0; i < n; i++) {		// levels and upper link lists
+		level[i] = annHnswLevel(i, level_mult);
+		links[i].assign((size_t) level[i]*(M+1), 0);
+	}
+	if (n == 0) return;					// no points--no sweat
+
+	insert(0, level[0]);				// first point is the entry
+
+	atomic<int> next(1);				// next point to insert
+	auto worker = [&]() {
+		for (int i = next++; i < n; i = next++)
+			insert(i, level[i]);
+	};
+	int n_thr = annBuildThreadCount();
+	if (n_thr > n - 1) n_thr = (n > 1 ? n - 1 : 1);
+
+	vector<thread> helpers;
+	for (int t = 1; t < n_thr; t++)
+		helpers.push_back(thread(worker));
+	worker();
+	for (size_t t = 0; t < helpers.size(); t++)
+		helpers[t].join();
+}
+
+ANNhnsw::~ANNhnsw()
+{
+	if (own_pts) annDeallocPts(pts);
+}
+
+//----------------------------------------------------------------------
+//	greedy - walk to the closest node on one level
+//		Moves to the closest neighbor of the current node for as long
+//		as that brings it closer to q.
+//----------------------------------------------------------------------
+
+int ANNhnsw::greedy(
+	ANNpoint			q,				// query point
+	int					ep,				// starting node
+	int					lev,			// level to search
+	bool				locked)			// lock nodes while reading?
+{
+	ANNdist d = annHnswDist(dim, q, pts[ep]);
+	vector<int> nbrs;
+	bool changed = true;
+
+	while (changed) {
+		changed = false;
+		if (locked) {
+			lock_guard<mutex> g(node_lock[ep]);
+			annHnswCopy(linkList(ep, lev), nbrs);
+		}
+		else
+			annHnswCopy(linkList(ep, lev), nbrs);
+
+		for (size_t j = 0; j < nbrs.size(); j++) {
+			ANNdist dj = annHnswDist(dim, q, pts[nbrs[j]]);
+			if (dj < d) {
+				d = dj;
+				ep = nbrs[j];
+				changed = true;
+			}
+		}
+	}
+	return ep;
+}
+
+//----------------------------------------------------------------------
+//	searchLevel - best-first search of one level
+//		Expands the closest unexpanded candidate until it is farther
+//		than the ef-th best node found.  Visited nodes are marked with
+//		a per-thread stamp, so concurrent searches need no shared state.
+//		On return res holds up to ef nodes in increasing distance.
+//----------------------------------------------------------------------
+
+void ANNhnsw::searchLevel(
+	ANNpoint			q,				// query point
+	int					ep,				// starting node
+	int					ef,				// candidates to keep
+	int					lev,			// level to search
+	bool				locked,			// lock nodes while reading?
+	vector<ANNhnswCand>	&res)			// result (modified)
+{
+	static thread_local vector<unsigned> visited;
+	static thread_local unsigned tag = 0;
+	if ((int) visited.size() < n_pts)
+		visited.resize(n_pts, 0);
+	if (++tag == 0) {					// stamps wrapped around
+		fill(visited.begin(), visited.end(), 0);
+		tag = 1;
+	}
+										// closest unexpanded first
+	priority_queue<ANNhnswCand, vector<ANNhnswCand>,
+				greater<ANNhnswCand> > cand;
+	priority_queue<ANNhnswCand> best;	// farthest kept first
+
+	ANNdist d = annHnswDist(dim, q, pts[ep]);
+	cand.push(ANNhnswCand(d, ep));
+	best.push(ANNhnswCand(d, ep));
+	visited[ep] = tag;
+
+	vector<int> nbrs;
+	while (!cand.empty()) {
+		ANNhnswCand c = cand.top();
+		if (c.first > best.top().first && (int) best.size() >= ef)
+			break;						// cannot improve the result
+		cand.pop();
+
+		if (locked) {
+			lock_guard<mutex> g(node_lock[c.second]);
+			annHnswCopy(linkList(c.second, lev), nbrs);
+		}
+		else
+			annHnswCopy(linkList(c.second, lev), nbrs);
+
+		for (size_t j = 0; j < nbrs.size(); j++) {
+			int e = nbrs[j];
+			if (visited[e] == tag) continue;
+			visited[e] = tag;
+
+			ANNdist de = annHnswDist(dim, q, pts[e]);
+			if ((int) best.size() < ef || de < best.top().first) {
+				cand.push(ANNhnswCand(de, e));
+				best.push(ANNhnswCand(de, e));
+				if ((int) best.size() > ef) best.pop();
+			}
+		}
+	}
+
+	res.resize(best.size());			// unload in increasing distance
+	for (int i = (int) best.size() - 1; i >= 0; i--) {
+		res[i] = best.top();
+		best.pop();
+	}
+}
+
+//----------------------------------------------------------------------
+//	selectNeighbors - choose links among sorted candidates
+//		A candidate is kept only if it is closer to the base point than
+//		to every candidate already kept.  This spreads the links in
+//		different directions, which keeps the graph navigable in
+//		clustered data.
+//----------------------------------------------------------------------
+
+void ANNhnsw::selectNeighbors(
+	vector<ANNhnswCand>	&cand,			// sorted candidates (modified)
+	int					m)				// max number to keep
+{
+	if ((int) cand.size() <= m) return;
+
+	vector<ANNhnswCand> kept;
+	for (size_t i = 0; i < cand.size() && (int) kept.size() < m; i++) {
+		bool good = true;
+		for (size_t j = 0; j < kept.size(); j++) {
+			if (annHnswDist(dim, pts[cand[i].second],
+							pts[kept[j].second]) < cand[i].first) {
+				good = false;
+				break;
+			}
+		}
+		if (good) kept.push_back(cand[i]);
+	}
+	cand.swap(kept);
+}
+
+//----------------------------------------------------------------------
+//	insert - add point i to the graph on levels 0..lev
+//		The entry lock is held for the whole insertion only when i
+//		becomes the new top node; otherwise only the nodes whose links
+//		change are locked, one at a time.
+//----------------------------------------------------------------------
+
+void ANNhnsw::insert(int i, int lev)
+{
+	unique_lock<mutex> top(entry_lock);
+	int cur_max = max_level;
+	if (cur_max < 0) {					// first point
+		entry = i;
+		max_level = lev;
+		return;
+	}
+	if (lev <= cur_max) top.unlock();	// entry point will not change
+
+	ANNpoint q = pts[i];
+	int ep = entry;
+	for (int l = cur_max; l > lev; l--)	// descend to level lev
+		ep = greedy(q, ep, l, true);
+
+	vector<ANNhnswCand> cand, others;
+	for (int l = (lev < cur_max ? lev : cur_max); l >= 0; l--) {
+		searchLevel(q, ep, ef_construction, l, true, cand);
+		ep = cand[0].second;			// start of next level down
+		selectNeighbors(cand, M);
+
+		{								// set links of the new node
+			lock_guard<mutex> g(node_lock[i]);
+			int *list = linkList(i, l);
+			list[0] = (int) cand.size();
+			for (size_t j = 0; j < cand.size(); j++)
+				list[j+1] = cand[j].second;
+		}
+
+		int cap = (l == 0 ? M0 : M);	// link back from each neighbor
+		for (size_t j = 0; j < cand.size(); j++) {
+			int e = cand[j].second;
+			lock_guard<mutex> g(node_lock[e]);
+			int *list = linkList(e, l);
+			if (list[0] < cap) {		// room for one more
+				list[++list[0]] = i;
+				continue;
+			}
+										// full: re-select among old + i
+			others.clear();
+			others.push_back(ANNhnswCand(annHnswDist(dim, pts[e], q), i));
+			for (int t = 1; t <= list[0]; t++)
+				others.push_back(ANNhnswCand(
+					annHnswDist(dim, pts[e], pts[list[t]]), list[t]));
+			sort(others.begin(), others.end());
+			selectNeighbors(others, cap);
+			list[0] = (int) others.size();
+			for (size_t t = 0; t < others.size(); t++)
+				list[t+1] = others[t].second;
+		}
+	}
+
+	if (lev > cur_max) {				// new top node (lock still held)
+		entry = i;
+		max_level = lev;
+	}
+}
+
+//----------------------------------------------------------------------
+//	annkSearch - approximate k nearest neighbors
+//		No locks are taken, so any number of threads may search the
+//		index at once.
+//----------------------------------------------------------------------
+
+void ANNhnsw::annkSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// dist to near neighbors (returned)
+	double				eps)			// error bound (ignored)
+{
+	vector<ANNhnswCand> res;
+	if (n_pts > 0) {
+		int ep = entry;
+		for (int l = max_level; l > 0; l--)
+			ep = greedy(q, ep, l, false);
+		searchLevel(q, ep, (ef_search > k ? ef_search : k), 0, false, res);
+	}
+
+	int j = 0;
+	for (size_t i = 0; i < res.size() && j < k; i++) {
+		if (!ANN_ALLOW_SELF_MATCH && res[i].first == 0)
+			continue;					// skip self-match
+		dd[j] = res[i].first;
+		nn_idx[j] = res[i].second;
+		j++;
+	}
+	for (; j < k; j++) {				// fewer than k points found
+		dd[j] = ANN_DIST_INF;
+		nn_idx[j] = ANN_NULL_IDX;
+	}
+}
+
+//----------------------------------------------------------------------
+//	annkFRSearch - approximate fixed-radius search
+//		Counts the points within the radius among the nodes found by
+//		an ordinary search, so points in range may be missed when the
+//		range holds more than efSearch points.
+//----------------------------------------------------------------------
+
+int ANNhnsw::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius search bound
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound (ignored)
+{
+	vector<ANNhnswCand> res;
+	if (n_pts > 0) {
+		int ep = entry;
+		for (int l = max_level; l > 0; l--)
+			ep = greedy(q, ep, l, false);
+		searchLevel(q, ep, (ef_search > k ? ef_search : k), 0, false, res);
+	}
+
+	int n_in = 0;						// points in range
+	for (size_t i = 0; i < res.size() && res[i].first <= sqRad; i++) {
+		if (!ANN_ALLOW_SELF_MATCH && res[i].first == 0)
+			continue;					// skip self-match
+		if (n_in < k) {
+			if (dd != NULL) dd[n_in] = res[i].first;
+			if (nn_idx != NULL) nn_idx[n_in] = res[i].second;
+		}
+		n_in++;
+	}
+	for (int j = n_in; j < k; j++) {	// fewer than k points in range
+		if (dd != NULL) dd[j] = ANN_DIST_INF;
+		if (nn_idx != NULL) nn_idx[j] = ANN_NULL_IDX;
+	}
+	return n_in;
+}
+
+//----------------------------------------------------------------------
+//	Save and load
+//		The format is a header (magic string, version, dimension,
+//		number of points, parameters and entry point) followed by the
+//		point coordinates, the level of each point, the level-0 links
+//		and the upper-level links, all in native binary form.  The
+//		loader rejects a file whose header, levels or link ids are
+//		out of range, since the search follows them unchecked.
+//----------------------------------------------------------------------
+
+template <class T>
+static inline void annHnswPut(ostream &out, const T *v, size_t n)
+{
+	out.write((const char*) v, n*sizeof(T));
+}
+
+template <class T>
+static inline void annHnswGet(istream &in, T *v, size_t n)
+{
+	in.read((char*) v, n*sizeof(T));
+	if (!in) annError("Unexpected end of hnsw file", ANNabort);
+}
+
+void ANNhnsw::Save(ostream &out)
+{
+	int hdr[8] = { ANNhnswVersion, dim, n_pts, M, ef_construction,
+				   ef_search, entry, max_level };
+	annHnswPut(out, ANNhnswMagic, sizeof(ANNhnswMagic));
+	annHnswPut(out, hdr, 8);
+
+	for (int i = 0; i < n_pts; i++)
+		annHnswPut(out, pts[i], dim);
+	annHnswPut(out, level.data(), n_pts);
+	annHnswPut(out, links0.data(), links0.size());
+	for (int i = 0; i < n_pts; i++)
+		annHnswPut(out, links[i].data(), links[i].size());
+}
+
+ANNhnsw::ANNhnsw(istream &in)
+	: entry(-1), max_level(-1)
+{
+	char magic[sizeof(ANNhnswMagic)];
+	int hdr[8];
+	annHnswGet(in, magic, sizeof(magic));
+	if (memcmp(magic, ANNhnswMagic, sizeof(magic)) != 0)
+		annError("Incorrect header for hnsw file", ANNabort);
+	annHnswGet(in, hdr, 8);
+	if (hdr[0] != ANNhnswVersion)
+		annError("Unsupported hnsw file version", ANNabort);
+	if (hdr[1] <= 0 || hdr[2] < 0 || hdr[3] < 2 ||
+		(hdr[2] == 0 ? hdr[6] != -1 || hdr[7] != -1
+					 : hdr[6] < 0 || hdr[6] >= hdr[2] || hdr[7] < 0))
+		annError("Corrupt hnsw file header", ANNabort);
+
+	dim = hdr[1];
+	n_pts = hdr[2];
+	M = hdr[3];
+	M0 = 2*M;
+	ef_construction = hdr[4];
+	ef_search = hdr[5];
+	entry = hdr[6];
+	max_level = hdr[7];
+	level_mult = 1.0 / log((double) M);
+
+	pts = annAllocPts(n_pts, dim);		// the index owns its points
+	own_pts = true;
+	for (int i = 0; i < n_pts; i++)
+		annHnswGet(in, pts[i], dim);
+
+	level.resize(n_pts);
+	annHnswGet(in, level.data(), n_pts);
+	for (int i = 0; i < n_pts; i++) {
+		if (level[i] < 0 || level[i] > max_level)
+			annError("Corrupt hnsw file levels", ANNabort);
+	}
+	if (n_pts > 0 && level[entry] != max_level)
+		annError("Corrupt hnsw file levels", ANNabort);
+	links0.resize((size_t) n_pts*(M0+1));
+	annHnswGet(in, links0.data(), links0.size());
+	links.resize(n_pts);
+	for (int i = 0; i < n_pts; i++) {
+		links[i].resize((size_t) level[i]*(M+1));
+		annHnswGet(in, links[i].data(), links[i].size());
+	}
+	for (int i = 0; i < n_pts; i++) {	// check every link list
+		for (int lev = 0; lev <= level[i]; lev++) {
+			const int *list = linkList(i, lev);
+			int m = (lev == 0 ? M0 : M);
+			bool ok = (list[0] >= 0 && list[0] <= m);
+			for (int j = 1; ok && j <= list[0]; j++)
+				ok = (list[j] >= 0 && list[j] < n_pts);
+			if (!ok) annError("Corrupt hnsw file links", ANNabort);
+		}
+	}
+	vector<mutex>(n_pts).swap(node_lock);
+}
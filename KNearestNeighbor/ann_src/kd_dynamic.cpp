@@ -0,0 +1,346 @@
+//----------------------------------------------------------------------
+// File:			kd_dynamic.cpp
+// Description:		Dynamic kd-tree index (insertions and deletions)
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include <ANN/ANNdynamic.h>				// dynamic index declarations
+#include <ANN/ANNx.h>					// all ANN includes
+#include "pr_queue_k.h"					// k-element priority queue
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	ANNdynLevel
+//		A static tree over some of the points.  Its point array holds
+//		pointers to the index's copies, and ids maps the indices the
+//		tree returns back to indices of the whole index.
+//----------------------------------------------------------------------
+
+struct ANNdynLevel {
+	vector<int>			ids;			// index of each tree point
+	ANNpointArray		pa;				// the tree's point array
+	ANNkd_flat_tree		*tree;			// the tree (NULL until built)
+	int					n_dead;			// its deleted points
+};
+
+static void annBuildLevel(				// build the tree of a level
+	ANNdynLevel			*lv,			// the level
+	int					dim)			// dimension
+{										// touches nothing else, so it
+	ANNkd_tree kd(lv->pa, (int) lv->ids.size(), dim);	// runs in the merger
+	lv->tree = new ANNkd_flat_tree(kd);
+}
+
+static void annDeleteLevel(				// delete a level
+	ANNdynLevel			*lv)			// the level (may be NULL)
+{
+	if (lv == NULL) return;
+	delete lv->tree;
+	delete [] lv->pa;
+	delete lv;
+}
+
+ANNdynLevel *ANNkd_dynamic::newLevel(
+	const vector<int>&	ids)			// indices of its points
+{
+	if (ids.empty()) return NULL;		// no empty trees
+	ANNdynLevel *lv = new ANNdynLevel;
+	lv->ids = ids;
+	lv->pa = new ANNpoint[ids.size()];
+	for (size_t i = 0; i < ids.size(); i++)
+		lv->pa[i] = pts[ids[i]];
+	lv->tree = NULL;
+	lv->n_dead = 0;
+	return lv;
+}
+
+//----------------------------------------------------------------------
+//	Construction and destruction
+//		The initial points form a single level, the lowest one large
+//		enough for them.
+//----------------------------------------------------------------------
+
+ANNkd_dynamic::ANNkd_dynamic(
+	ANNpointArray		pa,				// point array (copied)
+	int					n,				// number of points
+	int					dd,				// dimension
+	int					bs)				// insertions kept in the buffer
+{
+	dim = dd;
+	buf_size = max(bs, 1);
+	n_live = n;
+	merge_done = false;
+	merging = false;
+	merge_level = 0;
+	merge_result = NULL;
+
+	vector<int> ids(n);
+	for (int i = 0; i < n; i++) {
+		pts.push_back(annCopyPt(dim, pa[i]));
+		dead.push_back(0);
+		ids[i] = i;
+	}
+	if (n == 0) return;
+
+	int l = 0;
+	while ((long long) buf_size << l < n) l++;
+	levels.assign(l + 1, NULL);
+	levels[l] = newLevel(ids);
+	annBuildLevel(levels[l], dim);
+	where.assign(n, l);
+}
+
+ANNkd_dynamic::~ANNkd_dynamic()
+{
+	if (merger.joinable()) merger.join();
+	annDeleteLevel(merge_result);
+	for (size_t i = 0; i < levels.size(); i++)
+		annDeleteLevel(levels[i]);
+	for (size_t i = 0; i < pts.size(); i++)
+		annDeallocPt(pts[i]);
+}
+
+//----------------------------------------------------------------------
+//	Merges
+//		startMerge() is called, with the lock held, when the buffer is
+//		full.  It gathers the live points of the buffer and of levels
+//		0..j-1 (j the first empty level) and hands them to the merger
+//		thread.  finishMerge() waits for the thread and puts the new
+//		tree in place of the levels it replaces.
+//----------------------------------------------------------------------
+
+void ANNkd_dynamic::startMerge()
+{
+	if (merging) finishMerge();			// one merge at a time
+
+	int j = 0;							// first empty level
+	while (j < (int) levels.size() && levels[j] != NULL) j++;
+	if (j == (int) levels.size()) levels.push_back(NULL);
+
+	vector<int> ids;
+	for (size_t b = 0; b < buffer.size(); b++)
+		if (!dead[buffer[b]]) ids.push_back(buffer[b]);
+	for (int i = 0; i < j; i++)
+		for (size_t t = 0; t < levels[i]->ids.size(); t++)
+			if (!dead[levels[i]->ids[t]]) ids.push_back(levels[i]->ids[t]);
+
+	merge_buffer.swap(buffer);			// still searched until installed
+	buffer.clear();
+	merge_level = j;
+	merge_result = newLevel(ids);
+	merging = true;
+	merge_done = false;
+	if (merge_result == NULL) {			// everything was deleted
+		merge_done = true;
+		return;
+	}
+	ANNdynLevel *lv = merge_result;
+	merger = thread([this, lv] {
+		annBuildLevel(lv, dim);
+		merge_done = true;
+	});
+}
+
+void ANNkd_dynamic::finishMerge()
+{
+	if (merger.joinable()) merger.join();
+	for (int i = 0; i < merge_level; i++) {
+		annDeleteLevel(levels[i]);
+		levels[i] = NULL;
+	}
+
+	ANNdynLevel *lv = merge_result;		// deleted while being built?
+	levels[merge_level] = lv;
+	merge_result = NULL;
+	merge_buffer.clear();
+	merging = false;
+	if (lv == NULL) return;
+
+	for (size_t t = 0; t < lv->ids.size(); t++) {
+		where[lv->ids[t]] = merge_level;
+		if (dead[lv->ids[t]]) lv->n_dead++;
+	}
+	if (2*lv->n_dead > (int) lv->ids.size())
+		rebuildLevel(merge_level);
+}
+
+void ANNkd_dynamic::poll()
+{
+	if (merging && merge_done) finishMerge();
+}
+
+void ANNkd_dynamic::rebuildLevel(int i)
+{
+	ANNdynLevel *old = levels[i];
+	vector<int> ids;
+	for (size_t t = 0; t < old->ids.size(); t++)
+		if (!dead[old->ids[t]]) ids.push_back(old->ids[t]);
+	levels[i] = newLevel(ids);
+	if (levels[i] != NULL) annBuildLevel(levels[i], dim);
+	annDeleteLevel(old);
+}
+
+//----------------------------------------------------------------------
+//	Updates
+//----------------------------------------------------------------------
+
+int ANNkd_dynamic::insert(
+	ANNpoint			p)				// the point (copied)
+{
+	lock_guard<mutex> lk(lock);
+	poll();
+	int id = (int) pts.size();
+	pts.push_back(annCopyPt(dim, p));
+	dead.push_back(0);
+	where.push_back(-1);
+	buffer.push_back(id);
+	n_live++;
+	if ((int) buffer.size() >= buf_size)
+		startMerge();
+	return id;
+}
+
+void ANNkd_dynamic::remove(
+	int					idx)			// index of the point
+{
+	lock_guard<mutex> lk(lock);
+	poll();
+	if (idx < 0 || idx >= (int) pts.size() || dead[idx]) return;
+	dead[idx] = 1;
+	n_live--;
+
+	int l = where[idx];
+	if (l < 0 || levels[l] == NULL) return;	// in a buffer
+	ANNdynLevel *lv = levels[l];
+	lv->n_dead++;
+	if (merging && l < merge_level) return;	// being replaced anyway
+	if (2*lv->n_dead > (int) lv->ids.size())
+		rebuildLevel(l);
+}
+
+//----------------------------------------------------------------------
+//	search - k nearest live points, within sqRad
+//		The buffers are scanned; each level is searched for enough
+//		neighbors that k live ones remain once its deleted points are
+//		dropped.  For fixed-radius searches, levels with deleted
+//		points return all points in range so that the live ones can
+//		be counted.
+//----------------------------------------------------------------------
+
+void ANNkd_dynamic::search(
+	ANNpoint			q,				// query point
+	ANNdist				sqRad,			// squared radius (ANN_DIST_INF: kNN)
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor array (modified)
+	ANNdistArray		dd,				// dist to near neighbors (modified)
+	double				eps,			// error bound
+	int					&in_range)		// live points in range (returned)
+{
+	static thread_local vector<ANNidx> t_idx;	// results of one level
+	static thread_local vector<ANNdist> t_dist;
+	bool fr = (sqRad < ANN_DIST_INF);
+	ANNmin_k mk(max(k, 1));
+	in_range = 0;
+
+	const vector<int> *bufs[2] = { &buffer, &merge_buffer };
+	for (int b = 0; b < 2; b++) {
+		const vector<int> &buf = *bufs[b];
+		for (size_t t = 0; t < buf.size(); t++) {
+			int id = buf[t];
+			if (dead[id]) continue;
+			ANNdist bound = (fr ? sqRad : mk.max_key());
+			ANNdist d = annDistBound(dim, pts[id], q, bound);
+			if (d > bound || (!ANN_ALLOW_SELF_MATCH && d == 0)) continue;
+			if (fr) in_range++;
+			if (k > 0) mk.insert(d, id);
+		}
+	}
+
+	for (size_t l = 0; l < levels.size(); l++) {
+		ANNdynLevel *lv = levels[l];
+		if (lv == NULL) continue;
+		int n = (int) lv->ids.size();
+		int kk;
+		if (fr) {
+			int c = lv->tree->annkFRSearch(q, sqRad, 0, NULL, NULL, eps);
+			if (lv->n_dead == 0) {
+				in_range += c;
+				kk = min(k, c);
+			}
+			else
+				kk = c;
+			if (kk == 0) continue;
+			t_idx.resize(kk);
+			t_dist.resize(kk);
+			lv->tree->annkFRSearch(q, sqRad, kk, &t_idx[0], &t_dist[0], eps);
+		}
+		else {
+			kk = min(n, k + lv->n_dead);
+			if (kk == 0) continue;
+			t_idx.resize(kk);
+			t_dist.resize(kk);
+			lv->tree->annkSearch(q, kk, &t_idx[0], &t_dist[0], eps);
+		}
+		for (int i = 0; i < kk; i++) {
+			if (t_idx[i] == ANN_NULL_IDX) break;
+			int id = lv->ids[t_idx[i]];
+			if (dead[id]) continue;
+			if (fr && lv->n_dead > 0) in_range++;
+			if (k > 0) mk.insert(t_dist[i], id);
+		}
+	}
+
+	for (int i = 0; i < k; i++) {		// extract the k closest points
+		if (dd != NULL)
+			dd[i] = mk.ith_smallest_key(i);
+		if (nn_idx != NULL)
+			nn_idx[i] = mk.ith_smallest_info(i);
+	}
+}
+
+//----------------------------------------------------------------------
+//	Searches
+//		With fewer than k live points the rest of the results are
+//		ANN_NULL_IDX (the point set may shrink).
+//----------------------------------------------------------------------
+
+void ANNkd_dynamic::annkSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor array (modified)
+	ANNdistArray		dd,				// dist to near neighbors (modified)
+	double				eps)			// error bound
+{
+	lock_guard<mutex> lk(lock);
+	poll();
+	int in_range;
+	search(q, ANN_DIST_INF, k, nn_idx, dd, eps, in_range);
+}
+
+int ANNkd_dynamic::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius of query ball
+	int					k,				// number of neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor array (modified)
+	ANNdistArray		dd,				// dist to near neighbors (modified)
+	double				eps)			// error bound
+{
+	lock_guard<mutex> lk(lock);
+	poll();
+	int in_range;
+	search(q, sqRad, k, nn_idx, dd, eps, in_range);
+	return in_range;
+}
@@ -39,17 +39,24 @@
 //----------------------------------------------------------------------
 //		To keep argument lists short, a number of global variables
 //		are maintained which are common to all the recursive calls.
-//		These are given below.
+//		These are given below.  They are thread-local, so that
+//		different threads may search the same tree at the same time
+//		(see annBatchRangeSearch()).
+//
+//		When ANNkdFRResult is set (by annRangeSearch()) the points in
+//		range are appended to it instead of being inserted in
+//		ANNkdFRPointMK.
 //----------------------------------------------------------------------
 
-int				ANNkdFRDim;				// dimension of space
-ANNpoint		ANNkdFRQ;				// query point
-ANNdist			ANNkdFRSqRad;			// squared radius search bound
-double			ANNkdFRMaxErr;			// max tolerable squared error
-ANNpointArray	ANNkdFRPts;				// the points
-ANNmin_k*		ANNkdFRPointMK;			// set of k closest points
-int				ANNkdFRPtsVisited;		// total points visited
-int				ANNkdFRPtsInRange;		// number of points in the range
+thread_local int			ANNkdFRDim;			// dimension of space
+thread_local ANNpoint		ANNkdFRQ;			// query point
+thread_local ANNdist		ANNkdFRSqRad;		// squared radius search bound
+thread_local double			ANNkdFRMaxErr;		// max tolerable squared error
+thread_local ANNpointArray	ANNkdFRPts;			// the points
+thread_local ANNmin_k*		ANNkdFRPointMK;		// set of k closest points
+thread_local ANNrangeResult* ANNkdFRResult;		// all points in range
+thread_local int			ANNkdFRPtsVisited;	// total points visited
+thread_local int			ANNkdFRPtsInRange;	// number of points in the range
 
 //----------------------------------------------------------------------
 //	annkFRSearch - fixed radius search for k nearest neighbors
@@ -74,6 +81,7 @@ int ANNkd_tree::annkFRSearch(
 	ANN_FLOP(2)							// increment floating op count
 
 	ANNkdFRPointMK = new ANNmin_k(k);	// create set for closest k points
+	ANNkdFRResult = NULL;
 										// search starting at the root
 	root->ann_FR_search(annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim));
 
@@ -88,6 +96,41 @@ int ANNkd_tree::annkFRSearch(
 	return ANNkdFRPtsInRange;			// return final point count
 }
 
+//----------------------------------------------------------------------
+//	annRangeSearch - fixed radius search for all points in range
+//		The same search as annkFRSearch, but every point in range is
+//		appended to the result rather than only the k closest.
+//----------------------------------------------------------------------
+
+int ANNkd_tree::annRangeSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius search bound
+	ANNrangeResult		&res,			// points in range (appended)
+	ANNbool				sorted,			// sort by distance?
+	double				eps)			// the error bound
+{
+	int first = res.n;					// first pair added by this search
+
+	ANNkdFRDim = dim;					// copy arguments to static equivs
+	ANNkdFRQ = q;
+	ANNkdFRSqRad = sqRad;
+	ANNkdFRPts = pts;
+	ANNkdFRPtsVisited = 0;				// initialize count of points visited
+	ANNkdFRPtsInRange = 0;				// ...and points in the range
+
+	ANNkdFRMaxErr = ANN_POW(1.0 + eps);
+	ANN_FLOP(2)							// increment floating op count
+
+	ANNkdFRPointMK = NULL;				// points go straight to the result
+	ANNkdFRResult = &res;
+										// search starting at the root
+	root->ann_FR_search(annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim));
+
+	ANNkdFRResult = NULL;
+	if (sorted) res.sort(first);		// sort the new pairs
+	return ANNkdFRPtsInRange;			// return final point count
+}
+
 //----------------------------------------------------------------------
 //	kd_split::ann_FR_search - search a splitting node
 //		Note: This routine is similar in structure to the standard kNN
@@ -148,32 +191,20 @@ void ANNkd_split::ann_FR_search(ANNdist box_dist)
 void ANNkd_leaf::ann_FR_search(ANNdist box_dist)
 {
 	register ANNdist dist;				// distance to data point
-	register ANNcoord* pp;				// data coordinate pointer
-	register ANNcoord* qq;				// query coordinate pointer
-	register ANNcoord t;
-	register int d;
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
+		ANN_COORD(ANNkdFRDim)			// coordinates hit (at most)
+		ANN_FLOP(5*ANNkdFRDim)			// increment floating ops
+										// abandoned outside the radius
+		dist = annDistBound(ANNkdFRDim, ANNkdFRPts[bkt[i]], ANNkdFRQ, ANNkdFRSqRad);
 
-		pp = ANNkdFRPts[bkt[i]];		// first coord of next data point
-		qq = ANNkdFRQ;					// first coord of query point
-		dist = 0;
-
-		for(d = 0; d < ANNkdFRDim; d++) {
-			ANN_COORD(1)				// one more coordinate hit
-			ANN_FLOP(5)					// increment floating ops
-
-			t = *(qq++) - *(pp++);		// compute length and adv coordinate
-										// exceeds dist to k-th smallest?
-			if( (dist = ANN_SUM(dist, ANN_POW(t))) > ANNkdFRSqRad) {
-				break;
-			}
-		}
-
-		if (d >= ANNkdFRDim &&					// among the k best?
+		if (dist <= ANNkdFRSqRad &&				// within the radius?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
-			ANNkdFRPointMK->insert(dist, bkt[i]);
+			if (ANNkdFRResult != NULL)
+				ANNkdFRResult->add(bkt[i], dist);
+			else
+				ANNkdFRPointMK->insert(dist, bkt[i]);
 			ANNkdFRPtsInRange++;				// increment point count
 		}
 	}
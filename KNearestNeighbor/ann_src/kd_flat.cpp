@@ -0,0 +1,321 @@
+//----------------------------------------------------------------------
+// File:			kd_flat.cpp
+// Description:		Flattened (cache-friendly) kd-tree
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include "kd_flat.h"					// flat kd-tree declarations
+
+#include <vector>						// construction work lists
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	Flattening
+//		The tree is walked breadth-first.  When a splitting node is
+//		reached, its two children are appended to the list together,
+//		so they get consecutive indices.  The points of each leaf are
+//		then copied, in the order the leaves appear in the array, into
+//		one block of coordinates.  The canonical empty leaf (KD_TRIVIAL)
+//		becomes an ordinary leaf with no points.
+//----------------------------------------------------------------------
+
+ANNkd_flat_tree::ANNkd_flat_tree(
+	ANNkd_tree			&tree)			// the tree
+{
+	dim = tree.dim;
+	n_pts = tree.n_pts;
+	pts = tree.pts;
+	n_nodes = 0;
+	depth = 0;
+	nodes = NULL;
+	leaf_pts = NULL;
+	leaf_idx = NULL;
+	bnd_box_lo = bnd_box_hi = NULL;
+	map_addr = map_handle = NULL;
+	map_len = 0;
+	if (tree.root == NULL) return;		// empty tree
+
+	bnd_box_lo = annCopyPt(dim, tree.bnd_box_lo);
+	bnd_box_hi = annCopyPt(dim, tree.bnd_box_hi);
+
+	vector<ANNkd_ptr> order;			// nodes in breadth-first order
+	vector<int> level;					// depth of each node
+	order.push_back(tree.root);
+	level.push_back(0);
+	for (size_t i = 0; i < order.size(); i++) {
+		ANNkd_split *sp = dynamic_cast<ANNkd_split*>(order[i]);
+		if (sp != NULL) {
+			order.push_back(sp->child[ANN_LO]);
+			order.push_back(sp->child[ANN_HI]);
+			level.push_back(level[i] + 1);
+			level.push_back(level[i] + 1);
+		}
+		else if (dynamic_cast<ANNkd_leaf*>(order[i]) == NULL) {
+			annError("Only kd-trees can be flattened", ANNabort);
+		}
+	}
+
+	n_nodes = (int) order.size();
+	nodes = new ANNkd_flat_node[n_nodes];
+	leaf_pts = new ANNcoord[(size_t) n_pts * dim];
+	leaf_idx = new ANNidx[n_pts];
+
+	int next_child = 1;					// index of next child pair
+	int next_pt = 0;					// next free point slot
+	for (int i = 0; i < n_nodes; i++) {
+		ANNkd_flat_node &nd = nodes[i];
+		if (level[i] > depth) depth = level[i];
+
+		ANNkd_split *sp = dynamic_cast<ANNkd_split*>(order[i]);
+		if (sp != NULL) {				// splitting node
+			nd.cut_dim = sp->cut_dim;
+			nd.cut_val = sp->cut_val;
+			nd.cd_bnds[ANN_LO] = sp->cd_bnds[ANN_LO];
+			nd.cd_bnds[ANN_HI] = sp->cd_bnds[ANN_HI];
+			nd.first = next_child;
+			nd.n = 0;
+			next_child += 2;
+		}
+		else {							// leaf: copy its points
+			ANNkd_leaf *lf = (ANNkd_leaf*) order[i];
+			int n = (lf == KD_TRIVIAL ? 0 : lf->n_pts);
+			nd.cut_dim = -1;
+			nd.cut_val = nd.cd_bnds[ANN_LO] = nd.cd_bnds[ANN_HI] = 0;
+			nd.first = next_pt;
+			nd.n = n;
+			for (int j = 0; j < n; j++) {
+				ANNidx idx = lf->bkt[j];
+				leaf_idx[next_pt] = idx;
+				for (int d = 0; d < dim; d++)
+					leaf_pts[(size_t) next_pt*dim + d] = pts[idx][d];
+				next_pt++;
+			}
+		}
+	}
+}
+
+ANNkd_flat_tree::~ANNkd_flat_tree()
+{
+	if (map_addr != NULL) {				// arrays live in the mapping
+		annUnmapFlat(map_addr, map_len, map_handle);
+		if (pts != NULL) delete [] pts;	// row pointers from thePoints()
+		return;
+	}
+	delete [] nodes;
+	delete [] leaf_pts;
+	delete [] leaf_idx;
+	if (bnd_box_lo != NULL) annDeallocPt(bnd_box_lo);
+	if (bnd_box_hi != NULL) annDeallocPt(bnd_box_hi);
+}
+
+//----------------------------------------------------------------------
+//	thePoints - the points of the tree
+//		A flattened tree returns the points of the original tree.  A
+//		mapped tree has only the leaf-ordered coordinates, so an array
+//		of row pointers into them is built on the first call.
+//----------------------------------------------------------------------
+
+ANNpointArray ANNkd_flat_tree::thePoints()
+{
+	if (pts == NULL && map_addr != NULL && n_pts > 0) {
+		pts = new ANNpoint[n_pts];
+		for (int i = 0; i < n_pts; i++)
+			pts[leaf_idx[i]] = leaf_pts + (size_t) i*dim;
+	}
+	return pts;
+}
+
+ANNkd_flat_stack *annFlatStack(
+	int					depth)			// depth of tree
+{
+	static thread_local vector<ANNkd_flat_stack> stack;
+	if ((int) stack.size() < depth + 1)
+		stack.resize(depth + 1);
+	return stack.data();
+}
+
+//----------------------------------------------------------------------
+//	annkSearch - standard k-nearest neighbor search
+//		This visits the nodes in the same order as ANNkd_tree's search.
+//		The recursion is replaced by a stack holding the farther child
+//		of each splitting node passed, together with the distance to
+//		its box.  A stacked child is skipped when it is popped if its
+//		box is then too far to contain a closer point.  The stack never
+//		holds more entries than the depth of the tree.
+//----------------------------------------------------------------------
+
+void ANNkd_flat_tree::annkSearch(
+	ANNpoint			q,				// the query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
+	}
+	double max_err = ANN_POW(1.0 + eps);
+	ANNmin_k mk(k);						// set of k closest points
+	int pts_visited = 0;
+
+	ANNkd_flat_stack *stack = annFlatStack(depth);
+	int top = 0;
+	if (n_nodes > 0) {
+		stack[top].node = 0;
+		stack[top].dist = annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim);
+		top++;
+	}
+
+	while (top > 0) {
+		if (ANNmaxPtsVisited != 0 && pts_visited > ANNmaxPtsVisited)
+			break;
+		top--;
+		int ni = stack[top].node;
+		ANNdist box_dist = stack[top].dist;
+		if (box_dist * max_err >= mk.max_key())
+			continue;					// box too far
+
+		while (nodes[ni].cut_dim >= 0) {// descend to the closer leaf
+			const ANNkd_flat_node &nd = nodes[ni];
+			ANNcoord cut_diff = q[nd.cut_dim] - nd.cut_val;
+			ANNcoord box_diff;
+			int near_c, far_c;
+			if (cut_diff < 0) {			// left of cutting plane
+				box_diff = nd.cd_bnds[ANN_LO] - q[nd.cut_dim];
+				near_c = nd.first;
+				far_c = nd.first + 1;
+			}
+			else {						// right of cutting plane
+				box_diff = q[nd.cut_dim] - nd.cd_bnds[ANN_HI];
+				near_c = nd.first + 1;
+				far_c = nd.first;
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// stack further child unless empty
+			if (nodes[far_c].cut_dim >= 0 || nodes[far_c].n > 0) {
+				stack[top].node = far_c;
+				stack[top].dist = (ANNdist) ANN_SUM(box_dist,
+						ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
+				top++;
+			}
+			ni = near_c;
+		}
+
+		const ANNkd_flat_node &lf = nodes[ni];
+		ANNdist min_dist = mk.max_key();// k-th smallest distance so far
+		const ANNcoord *pp = leaf_pts + (size_t) lf.first*dim;
+		for (int i = 0; i < lf.n; i++, pp += dim) {
+			ANNdist dist = annDistBound(dim, pp, q, min_dist);
+			if (dist <= min_dist &&				// among the k best?
+			   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
+				mk.insert(dist, leaf_idx[lf.first + i]);
+				min_dist = mk.max_key();
+			}
+		}
+		pts_visited += lf.n;
+	}
+
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		dd[i] = mk.ith_smallest_key(i);
+		nn_idx[i] = mk.ith_smallest_info(i);
+	}
+}
+
+//----------------------------------------------------------------------
+//	annkFRSearch - fixed-radius search
+//		As annkSearch(), but a box is visited when it lies within the
+//		search radius, and every point within the radius is counted.
+//----------------------------------------------------------------------
+
+int ANNkd_flat_tree::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius search bound
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	double max_err = ANN_POW(1.0 + eps);
+	ANNmin_k mk(k);						// set of k closest points
+	int pts_visited = 0;
+	int pts_in_range = 0;
+
+	ANNkd_flat_stack *stack = annFlatStack(depth);
+	int top = 0;
+	if (n_nodes > 0) {
+		stack[top].node = 0;
+		stack[top].dist = annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim);
+		top++;
+	}
+
+	while (top > 0) {
+		if (ANNmaxPtsVisited != 0 && pts_visited > ANNmaxPtsVisited)
+			break;
+		top--;
+		int ni = stack[top].node;
+		ANNdist box_dist = stack[top].dist;
+		if (box_dist * max_err > sqRad)
+			continue;					// box out of range
+
+		while (nodes[ni].cut_dim >= 0) {// descend to the closer leaf
+			const ANNkd_flat_node &nd = nodes[ni];
+			ANNcoord cut_diff = q[nd.cut_dim] - nd.cut_val;
+			ANNcoord box_diff;
+			int near_c, far_c;
+			if (cut_diff < 0) {			// left of cutting plane
+				box_diff = nd.cd_bnds[ANN_LO] - q[nd.cut_dim];
+				near_c = nd.first;
+				far_c = nd.first + 1;
+			}
+			else {						// right of cutting plane
+				box_diff = q[nd.cut_dim] - nd.cd_bnds[ANN_HI];
+				near_c = nd.first + 1;
+				far_c = nd.first;
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// stack further child unless empty
+			if (nodes[far_c].cut_dim >= 0 || nodes[far_c].n > 0) {
+				stack[top].node = far_c;
+				stack[top].dist = (ANNdist) ANN_SUM(box_dist,
+						ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
+				top++;
+			}
+			ni = near_c;
+		}
+
+		const ANNkd_flat_node &lf = nodes[ni];
+		const ANNcoord *pp = leaf_pts + (size_t) lf.first*dim;
+		for (int i = 0; i < lf.n; i++, pp += dim) {
+			ANNdist dist = annDistBound(dim, pp, q, sqRad);
+			if (dist <= sqRad &&				// within range?
+			   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
+				mk.insert(dist, leaf_idx[lf.first + i]);
+				pts_in_range++;
+			}
+		}
+		pts_visited += lf.n;
+	}
+
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		if (dd != NULL)
+			dd[i] = mk.ith_smallest_key(i);
+		if (nn_idx != NULL)
+			nn_idx[i] = mk.ith_smallest_info(i);
+	}
+	return pts_in_range;
+}
@@ -0,0 +1,94 @@
+//----------------------------------------------------------------------
+// File:			kd_flat.h
+// Description:		Flattened (cache-friendly) kd-tree
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#ifndef ANN_kd_flat_H
+#define ANN_kd_flat_H
+
+#include "kd_tree.h"					// kd-tree declarations
+#include "kd_util.h"					// kd-tree utilities
+#include "pr_queue_k.h"					// k-element priority queue
+
+//----------------------------------------------------------------------
+//	Flat kd-tree node
+//		A splitting node holds its cutting plane, the bounds of its
+//		cell along the cutting dimension, and the index of its low
+//		child (the high child follows it).  A leaf has cut_dim = -1
+//		and holds the position and number of its points in the leaf
+//		point arrays.
+//----------------------------------------------------------------------
+
+struct ANNkd_flat_node {
+	int					cut_dim;		// cutting dimension (-1 for leaf)
+	ANNcoord			cut_val;		// location of cutting plane
+	ANNcoord			cd_bnds[2];		// cell bounds along cut_dim
+	int					first;			// low child, or first leaf point
+	int					n;				// number of points (leaf only)
+};
+
+//----------------------------------------------------------------------
+//	Search stack entry: a node still to visit and the distance from
+//	the query to its cell.
+//----------------------------------------------------------------------
+
+struct ANNkd_flat_stack {
+	int					node;			// index of node
+	ANNdist				dist;			// distance to its cell
+};
+
+//----------------------------------------------------------------------
+//	annFlatStack - search stack of the calling thread
+//		Queries take their stack from here rather than the heap.  It
+//		is grown to depth+1 entries when needed and kept for the next
+//		query on the same thread.
+//----------------------------------------------------------------------
+
+ANNkd_flat_stack *annFlatStack(			// get a stack for one query
+	int					depth);			// depth of tree
+
+//----------------------------------------------------------------------
+//	annBoxDistanceT - annBoxDistance() with the distance of a metric
+//		policy (see ANNmetric.h).
+//----------------------------------------------------------------------
+
+template <class Metric>
+inline ANNdist annBoxDistanceT(			// distance from point to box
+	const ANNcoord		*q,				// the point
+	const ANNcoord		*lo,			// low point of box
+	const ANNcoord		*hi,			// high point of box
+	int					dim)			// dimension of space
+{
+	ANNdist dist = 0;
+	for (int d = 0; d < dim; d++) {
+		if (q[d] < lo[d])				// q is left of box
+			dist = Metric::sum(dist, Metric::power(lo[d] - q[d]));
+		else if (q[d] > hi[d])			// q is right of box
+			dist = Metric::sum(dist, Metric::power(q[d] - hi[d]));
+	}
+	return dist;
+}
+
+//----------------------------------------------------------------------
+//	Memory mapping (kd_flat_dump.cpp)
+//----------------------------------------------------------------------
+
+void annUnmapFlat(						// release a mapped dump file
+	void				*addr,			// start of mapping
+	size_t				len,			// length of mapping
+	void				*handle);		// mapping handle (Windows only)
+
+#endif
@@ -0,0 +1,317 @@
+//----------------------------------------------------------------------
+// File:			kd_flat_dump.cpp
+// Description:		Binary dump and memory mapping of flat kd-trees
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include "kd_flat.h"					// flat kd-tree declarations
+
+#include <cstring>						// memcmp, memcpy
+#include <vector>						// node depths
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>					// CreateFileMapping, MapViewOfFile
+#else
+#include <fcntl.h>						// open
+#include <sys/mman.h>					// mmap
+#include <sys/stat.h>					// fstat
+#include <unistd.h>						// close
+#endif
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	ANN flat kd-tree binary dump format
+//		The file starts with a fixed header, followed by four sections,
+//		each starting at an offset that is a multiple of FLAT_ALIGN:
+//
+//			bounding box		2*dim coordinates (low point, high point)
+//			nodes				n_nodes ANNkd_flat_node records
+//			leaf indices		n_pts point indices (ANNidx)
+//			leaf points			n_pts*dim coordinates, in leaf order
+//
+//		All values are in the byte order and representation of the
+//		machine that wrote the file.  The header records the byte
+//		order, the size of a coordinate and the size of a node, and a
+//		file written with different values is rejected.
+//----------------------------------------------------------------------
+
+const int		FLAT_ALIGN		= 64;	// section alignment (a cache line)
+const int		FLAT_VERSION	= 1;	// version of file format
+const int		FLAT_BYTE_ORDER	= 0x01020304;	// written in native order
+
+static const char FLAT_MAGIC[8] = "ANNflat";	// start of file
+
+struct ANNflat_header {
+	char				magic[8];		// FLAT_MAGIC
+	int					version;		// FLAT_VERSION
+	int					byte_order;		// FLAT_BYTE_ORDER
+	int					coord_size;		// sizeof(ANNcoord)
+	int					node_size;		// sizeof(ANNkd_flat_node)
+	int					dim;			// dimension of space
+	int					n_pts;			// number of points
+	int					n_nodes;		// number of nodes
+	int					depth;			// depth of tree (not trusted on load)
+	long long			box_off;		// offset of bounding box
+	long long			node_off;		// offset of nodes
+	long long			idx_off;		// offset of leaf indices
+	long long			pts_off;		// offset of leaf points
+	long long			file_len;		// length of file
+};
+
+static long long annFlatAlign(long long off)
+{
+	return (off + FLAT_ALIGN - 1) / FLAT_ALIGN * FLAT_ALIGN;
+}
+
+//----------------------------------------------------------------------
+//	DumpBinary - write the flat tree
+//		The stream must be opened in binary mode.
+//----------------------------------------------------------------------
+
+static void annFlatWrite(				// write a section and pad it
+	ostream				&out,			// output stream
+	long long			&pos,			// current offset (modified)
+	long long			off,			// offset of section
+	const void			*data,			// section contents
+	size_t				len)			// length of contents
+{
+	static const char zeros[FLAT_ALIGN] = { 0 };
+	out.write(zeros, (streamsize) (off - pos));
+	out.write((const char*) data, (streamsize) len);
+	pos = off + (long long) len;
+}
+
+void ANNkd_flat_tree::DumpBinary(
+	ostream				&out)			// output stream
+{
+	ANNflat_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FLAT_MAGIC, sizeof(hdr.magic));
+	hdr.version = FLAT_VERSION;
+	hdr.byte_order = FLAT_BYTE_ORDER;
+	hdr.coord_size = sizeof(ANNcoord);
+	hdr.node_size = sizeof(ANNkd_flat_node);
+	hdr.dim = dim;
+	hdr.n_pts = n_pts;
+	hdr.n_nodes = n_nodes;
+	hdr.depth = depth;
+
+	size_t box_len = (n_nodes > 0 ? 2 * (size_t) dim * sizeof(ANNcoord) : 0);
+	size_t node_len = (size_t) n_nodes * sizeof(ANNkd_flat_node);
+	size_t idx_len = (n_nodes > 0 ? (size_t) n_pts * sizeof(ANNidx) : 0);
+	size_t pts_len = (n_nodes > 0 ? (size_t) n_pts * dim * sizeof(ANNcoord) : 0);
+
+	hdr.box_off = annFlatAlign(sizeof(hdr));
+	hdr.node_off = annFlatAlign(hdr.box_off + box_len);
+	hdr.idx_off = annFlatAlign(hdr.node_off + node_len);
+	hdr.pts_off = annFlatAlign(hdr.idx_off + idx_len);
+	hdr.file_len = hdr.pts_off + pts_len;
+
+	long long pos = 0;
+	annFlatWrite(out, pos, 0, &hdr, sizeof(hdr));
+	if (n_nodes > 0) {
+		annFlatWrite(out, pos, hdr.box_off, bnd_box_lo, box_len/2);
+		annFlatWrite(out, pos, hdr.box_off + box_len/2, bnd_box_hi, box_len/2);
+	}
+	annFlatWrite(out, pos, hdr.node_off, nodes, node_len);
+	annFlatWrite(out, pos, hdr.idx_off, leaf_idx, idx_len);
+	annFlatWrite(out, pos, hdr.pts_off, leaf_pts, pts_len);
+	if (!out) annError("Error writing binary dump file", ANNabort);
+}
+
+//----------------------------------------------------------------------
+//	Memory mapping
+//		annMapFlat() maps a whole file read-only and shared, so the
+//		pages come straight from the page cache and are shared by every
+//		process that maps the same file.  annUnmapFlat() releases it.
+//----------------------------------------------------------------------
+
+static void *annMapFlat(				// map a file read-only
+	const char			*file_name,		// name of file
+	size_t				&len,			// length of file (returned)
+	void				*&handle)		// mapping handle (returned)
+{
+	void *addr = NULL;
+	len = 0;
+	handle = NULL;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ,
+				NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map != NULL) {
+			addr = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			if (addr != NULL) {
+				len = (size_t) size.QuadPart;
+				handle = map;
+			}
+			else CloseHandle(map);
+		}
+	}
+	CloseHandle(file);					// the mapping keeps the file open
+#else
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) addr = NULL;
+		else len = (size_t) st.st_size;
+	}
+	close(fd);							// the mapping keeps the file open
+#endif
+	return addr;
+}
+
+void annUnmapFlat(
+	void				*addr,			// start of mapping
+	size_t				len,			// length of mapping
+	void				*handle)		// mapping handle (Windows only)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(addr);
+	CloseHandle((HANDLE) handle);
+#else
+	munmap(addr, len);
+#endif
+}
+
+//----------------------------------------------------------------------
+//	Mapping constructor
+//		The header is checked against this machine and the file length,
+//		each section is checked to be aligned and to lie within the
+//		file, and the member arrays are pointed into the mapping.  The
+//		nodes and leaf indices are then read once by annFlatCheck(),
+//		so that a corrupt file cannot lead a search outside the
+//		mapping.  The leaf points are not read, so their pages are
+//		brought in by the searches themselves.
+//----------------------------------------------------------------------
+
+static bool annFlatFits(				// does a section fit in the file?
+	long long			off,			// offset of section
+	long long			count,			// number of items
+	long long			size,			// size of an item
+	long long			file_len)		// length of file
+{
+	if (off < (long long) sizeof(ANNflat_header) || off % FLAT_ALIGN != 0 ||
+		off > file_len) return false;
+	return count <= (file_len - off) / size;	// no overflow
+}
+
+//----------------------------------------------------------------------
+//	annFlatCheck - check the nodes and leaf indices of a mapped file
+//		Children always follow their parent in the node array, so
+//		requiring that keeps the search from looping.  Each splitting
+//		node must cut a dimension of the space, each leaf must lie
+//		within the leaf arrays, and each leaf index must name a
+//		point.  The depth is recomputed rather than trusted, since it
+//		sizes the search stack.  Returns the depth, or -1 if the
+//		file is corrupt.
+//----------------------------------------------------------------------
+
+static int annFlatCheck(
+	const ANNkd_flat_node	*nodes,		// the nodes
+	int					n_nodes,		// number of nodes
+	const ANNidx		*leaf_idx,		// leaf point indices
+	int					n_pts,			// number of points
+	int					dim)			// dimension of space
+{
+	vector<int> level(n_nodes, 0);		// depth of each node
+	int depth = 0;
+	for (int i = 0; i < n_nodes; i++) {
+		const ANNkd_flat_node &nd = nodes[i];
+		if (nd.cut_dim >= dim) return -1;
+		if (nd.cut_dim >= 0) {			// splitting node
+			if (nd.first <= i || nd.first >= n_nodes - 1) return -1;
+			for (int c = nd.first; c <= nd.first + 1; c++)
+				if (level[c] < level[i] + 1) level[c] = level[i] + 1;
+		}
+		else {							// leaf
+			if (nd.first < 0 || nd.n < 0 || nd.first > n_pts - nd.n)
+				return -1;
+			if (level[i] > depth) depth = level[i];
+		}
+	}
+	if (n_nodes > 0) {					// indices are unused without nodes
+		for (int i = 0; i < n_pts; i++)
+			if (leaf_idx[i] < 0 || leaf_idx[i] >= n_pts) return -1;
+	}
+	return depth;
+}
+
+ANNkd_flat_tree::ANNkd_flat_tree(
+	const char			*file_name)		// name of file
+{
+	map_addr = annMapFlat(file_name, map_len, map_handle);
+	if (map_addr == NULL) {
+		annError("Cannot map binary dump file", ANNabort);
+	}
+
+	const char *base = (const char*) map_addr;
+	const ANNflat_header *hdr = (const ANNflat_header*) base;
+	if (map_len < sizeof(ANNflat_header) ||
+		memcmp(hdr->magic, FLAT_MAGIC, sizeof(hdr->magic)) != 0) {
+		annError("Incorrect header for binary dump file", ANNabort);
+	}
+	if (hdr->version != FLAT_VERSION ||
+		hdr->byte_order != FLAT_BYTE_ORDER ||
+		hdr->coord_size != (int) sizeof(ANNcoord) ||
+		hdr->node_size != (int) sizeof(ANNkd_flat_node)) {
+		annError("Binary dump file was written by an incompatible machine",
+					ANNabort);
+	}
+	if ((long long) map_len < hdr->file_len) {
+		annError("Binary dump file is truncated", ANNabort);
+	}
+	long long len = hdr->file_len;
+	long long used = (hdr->n_nodes > 0 ? 1 : 0);	// sections are empty without nodes
+	if (hdr->dim < 1 || hdr->n_pts < 0 || hdr->n_nodes < 0 ||
+		!annFlatFits(hdr->box_off, used * 2 * hdr->dim,
+					sizeof(ANNcoord), len) ||
+		!annFlatFits(hdr->node_off, hdr->n_nodes,
+					sizeof(ANNkd_flat_node), len) ||
+		!annFlatFits(hdr->idx_off, used * hdr->n_pts,
+					sizeof(ANNidx), len) ||
+		!annFlatFits(hdr->pts_off, used * hdr->n_pts * hdr->dim,
+					sizeof(ANNcoord), len)) {
+		annError("Binary dump file has corrupt section offsets", ANNabort);
+	}
+
+	dim = hdr->dim;
+	n_pts = hdr->n_pts;
+	n_nodes = hdr->n_nodes;
+	pts = NULL;							// built on demand by thePoints()
+
+	if (n_nodes > 0) {
+		bnd_box_lo = (ANNpoint) (base + hdr->box_off);
+		bnd_box_hi = bnd_box_lo + dim;
+	}
+	else {
+		bnd_box_lo = bnd_box_hi = NULL;
+	}
+	nodes = (ANNkd_flat_node*) (base + hdr->node_off);
+	leaf_idx = (ANNidx*) (base + hdr->idx_off);
+	leaf_pts = (ANNcoord*) (base + hdr->pts_off);
+
+	depth = annFlatCheck(nodes, n_nodes, leaf_idx, n_pts, dim);
+	if (depth < 0) {
+		annError("Binary dump file has corrupt nodes", ANNabort);
+	}
+}
@@ -0,0 +1,312 @@
+//----------------------------------------------------------------------
+// File:			kd_forest.cpp
+// Description:		Randomized kd-forest for approximate search
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include "kd_tree.h"					// kd-tree declarations
+#include "kd_util.h"					// kd-tree utilities
+#include "kd_pr_search.h"				// kd priority search declarations
+
+#include <ANN/ANNperf.h>				// performance evaluation
+
+#include <algorithm>					// partial_sort
+#include <atomic>						// seeding of split generators
+#include <memory>						// per-thread box queue
+#include <random>						// split generators
+#include <vector>						// per-thread point stamps
+
+//----------------------------------------------------------------------
+//	Randomized kd-forest
+//		In high dimension a single kd-tree cuts only along the few
+//		coordinates of largest spread, and a priority search must visit
+//		nearly every leaf before it reaches the true neighbors.  A
+//		forest builds several trees, each cutting along a dimension
+//		drawn at random from the highest-variance coordinates of the
+//		cell.  The trees partition space differently, so a neighbor
+//		split away from the query in one tree is likely to share a
+//		leaf with it in another.
+//
+//		All trees are searched together from a single priority queue
+//		of boxes, and the search stops after a fixed number of point
+//		checks.  The number of trees and the check budget trade recall
+//		against query time.  A point stored in several trees is
+//		checked only once per query.
+//
+//		The per-query scratch state (the point stamps and the box
+//		queue) is kept per thread, so one forest can be searched from
+//		several threads at once.
+//----------------------------------------------------------------------
+
+//----------------------------------------------------------------------
+//	Constants
+//		RKD_TOP_DIMS		Number of highest-variance dimensions the
+//							cutting dimension is drawn from.
+//		RKD_SAMPLE			Number of points sampled to estimate the
+//							variance of each dimension.
+//----------------------------------------------------------------------
+
+const int RKD_TOP_DIMS = 5;
+const int RKD_SAMPLE = 100;
+
+//----------------------------------------------------------------------
+//	Split generators
+//		Subtrees may be built on several threads (see rkd_tree()), so
+//		each thread draws from its own generator.  The seeds are taken
+//		from a shared counter so that threads do not repeat each
+//		other's choices.
+//----------------------------------------------------------------------
+
+static std::atomic<unsigned> ANNrkdSeed(5489u);
+
+static std::mt19937& annRkdRand()
+{
+	static thread_local std::mt19937 gen(ANNrkdSeed++);
+	return gen;
+}
+
+//----------------------------------------------------------------------
+//	rkd_split - randomized splitting rule
+//		Estimate the mean and variance of each coordinate from a sample
+//		of the points, pick one of the RKD_TOP_DIMS dimensions of
+//		largest variance at random, and cut at its mean.  If all the
+//		points fall on one side of the cut, the points are split at
+//		the median instead.
+//----------------------------------------------------------------------
+
+static void rkd_split(
+	ANNpointArray		pa,				// point array
+	ANNidxArray			pidx,			// point indices (permuted on return)
+	const ANNorthRect	&/*bnds*/,		// bounding rectangle (unused)
+	int					n,				// number of points
+	int					dim,			// dimension of space
+	int					&cut_dim,		// cutting dimension (returned)
+	ANNcoord			&cut_val,		// cutting value (returned)
+	int					&n_lo)			// num of points on low side (returned)
+{
+	std::mt19937 &gen = annRkdRand();
+	int n_smp = (n < RKD_SAMPLE ? n : RKD_SAMPLE);
+
+	double *mean = new double[dim];		// sample mean and variance
+	double *var = new double[dim];
+	for (int d = 0; d < dim; d++) {
+		mean[d] = var[d] = 0;
+	}
+	for (int i = 0; i < n_smp; i++) {	// sample evenly spaced points
+		ANNpoint p = pa[pidx[(int)((long long) i * n / n_smp)]];
+		for (int d = 0; d < dim; d++) {
+			mean[d] += p[d];
+			var[d] += (double) p[d] * p[d];
+		}
+	}
+	for (int d = 0; d < dim; d++) {
+		mean[d] /= n_smp;
+		var[d] = var[d]/n_smp - mean[d]*mean[d];
+	}
+										// rank dimensions by variance
+	int n_top = (dim < RKD_TOP_DIMS ? dim : RKD_TOP_DIMS);
+	int *order = new int[dim];
+	for (int d = 0; d < dim; d++) order[d] = d;
+	std::partial_sort(order, order + n_top, order + dim,
+		[var](int a, int b) { return var[a] > var[b]; });
+
+	cut_dim = order[gen() % n_top];		// random top-variance dimension
+	cut_val = (ANNcoord) mean[cut_dim];
+
+	delete [] order;
+	delete [] mean;
+	delete [] var;
+										// permute points accordingly
+	int br1, br2;
+	annPlaneSplit(pa, pidx, n, cut_dim, cut_val, br1, br2);
+
+	if (br1 > 0 && br2 < n) {			// nontrivial cut
+		if (br1 > n/2) n_lo = br1;		// balance points equal to cut
+		else if (br2 < n/2) n_lo = br2;
+		else n_lo = n/2;
+	}
+	else {								// trivial cut: use median
+		n_lo = n/2;
+		annMedianSplit(pa, pidx, n, cut_dim, cut_val, n_lo);
+	}
+}
+
+//----------------------------------------------------------------------
+//	kd-forest constructor
+//		Each tree starts as a skeleton tree (which holds its own
+//		permutation of the point indices) and is then built with the
+//		randomized splitting rule.
+//----------------------------------------------------------------------
+
+ANNkd_forest::ANNkd_forest(
+	ANNpointArray		pa,				// point array
+	int					n,				// number of points
+	int					dd,				// dimension
+	int					n_tr,			// number of trees
+	int					checks,			// max points checked per query
+	int					bs)				// bucket size
+{
+	dim = dd;
+	n_pts = n;
+	pts = pa;
+	n_trees = (n_tr < 1 ? 1 : n_tr);
+	max_checks = checks;
+
+	trees = new ANNkd_tree*[n_trees];
+	depth = 0;
+
+	int n_thr = annBuildThreadCount();	// threads used to build
+	for (int t = 0; t < n_trees; t++) {
+		ANNkd_tree *tr = new ANNkd_tree(n, dd, bs);
+		trees[t] = tr;
+		tr->pts = pa;
+		if (n == 0) continue;			// no points--no sweat
+
+		ANNbuildThrBudget = n_thr;
+		ANNorthRect bnd_box(dd);		// bounding box for points
+		annEnclRect(pa, tr->pidx, n, dd, bnd_box);
+		tr->bnd_box_lo = annCopyPt(dd, bnd_box.lo);
+		tr->bnd_box_hi = annCopyPt(dd, bnd_box.hi);
+
+		tr->root = rkd_tree(pa, tr->pidx, n, dd, bs, bnd_box, rkd_split,
+						n_thr);
+
+		ANNkdStats st;					// depth bounds the box queue
+		tr->getStats(st);
+		if (st.depth > depth) depth = st.depth;
+	}
+	ANNbuildThrBudget = 1;				// back to sequential scans
+}
+
+ANNkd_forest::~ANNkd_forest()			// forest destructor
+{
+	for (int t = 0; t < n_trees; t++) delete trees[t];
+	delete [] trees;
+}
+
+//----------------------------------------------------------------------
+//	annkSearch - search the forest
+//		This is annkPriSearch() run over all trees at once: the box
+//		queue is seeded with every root, and the closest box of any
+//		tree is expanded next.  The leaves skip points already checked
+//		in this query, which they recognize by the current stamp
+//		value.  The search ends when the queue is empty, the closest
+//		box cannot improve the result, or max_checks points (or the
+//		annMaxPtsVisit() limit, whichever is lower) have been checked.
+//
+//		The stamps and the box queue belong to the calling thread and
+//		are reused from query to query.  Every split leaves points on
+//		both sides, so a tree has fewer splits than points, and each
+//		descent inserts at most one box per level.  The queue thus
+//		never holds more than n_trees*n_pts boxes, nor, under a check
+//		budget, more than n_trees plus (budget+1)*depth boxes, since
+//		every descent checks at least one point.
+//----------------------------------------------------------------------
+
+void ANNkd_forest::annkSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// dist to near neighbors (returned)
+	double				eps)			// error bound
+{
+										// max tolerable squared error
+	ANNprMaxErr = ANN_POW(1.0 + eps);
+	ANN_FLOP(2)							// increment floating ops
+
+	ANNprDim = dim;						// copy arguments to static equivs
+	ANNprQ = q;
+	ANNprPts = pts;
+	ANNptsVisited = 0;					// initialize count of points visited
+
+	static thread_local std::vector<int> stamp;
+	static thread_local int stamp_val = 0;
+	if ((int) stamp.size() < n_pts)
+		stamp.resize(n_pts, 0);
+	if (++stamp_val == 0) {				// stamps wrapped around?
+		std::fill(stamp.begin(), stamp.end(), 0);
+		stamp_val = 1;
+	}
+	ANNprStamp = stamp.data();			// skip points seen in other trees
+	ANNprStampVal = stamp_val;
+
+	int budget = max_checks;			// effective limit on checks
+	if (ANNmaxPtsVisited != 0 && (budget == 0 || ANNmaxPtsVisited < budget))
+		budget = ANNmaxPtsVisited;
+
+	long long max_boxes = (long long) n_trees * n_pts;
+	if (budget != 0) {					// budget caps the descents
+		long long cap = n_trees + ((long long) budget + 1) * depth;
+		if (cap < max_boxes) max_boxes = cap;
+	}
+	static thread_local std::unique_ptr<ANNpr_queue> box_pq;
+	static thread_local long long box_pq_size = 0;
+	if (box_pq_size < max_boxes) {		// grow the queue for boxes
+		box_pq.reset(new ANNpr_queue((int) max_boxes));
+		box_pq_size = max_boxes;
+	}
+	box_pq->reset();
+	ANNprBoxPQ = box_pq.get();
+
+	ANNprPointMK = new ANNmin_k(k);		// create set for closest k points
+
+	for (int t = 0; t < n_trees; t++) {	// insert the root of each tree
+		if (trees[t]->root == NULL) continue;
+		ANNdist box_dist = annBoxDistance(q,
+					trees[t]->bnd_box_lo, trees[t]->bnd_box_hi, dim);
+		ANNprBoxPQ->insert(box_dist, trees[t]->root);
+	}
+
+	while (ANNprBoxPQ->non_empty() &&
+		(!(budget != 0 && ANNptsVisited > budget))) {
+		ANNdist box_dist;				// distance to next box
+		ANNkd_ptr np;					// next box from prior queue
+
+										// extract closest box from queue
+		ANNprBoxPQ->extr_min(box_dist, (void *&) np);
+
+		ANN_FLOP(2)						// increment floating ops
+		if (box_dist*ANNprMaxErr >= ANNprPointMK->max_key())
+			break;
+
+		np->ann_pri_search(box_dist);	// search this subtree.
+	}
+
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		dd[i] = ANNprPointMK->ith_smallest_key(i);
+		nn_idx[i] = ANNprPointMK->ith_smallest_info(i);
+	}
+
+	ANNprStamp = NULL;					// plain kd-trees do not use stamps
+	ANNprBoxPQ = NULL;					// the queue stays for reuse
+	delete ANNprPointMK;				// deallocate closest point set
+}
+
+//----------------------------------------------------------------------
+//	annkFRSearch - fixed-radius search
+//		Every tree holds all the points, so the first tree alone
+//		answers fixed-radius queries.
+//----------------------------------------------------------------------
+
+int ANNkd_forest::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius search bound
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	return trees[0]->annkFRSearch(q, sqRad, k, nn_idx, dd, eps);
+}
@@ -72,13 +72,15 @@
 //		These are given below.
 //----------------------------------------------------------------------
 
-double			ANNprEps;				// the error bound
-int				ANNprDim;				// dimension of space
-ANNpoint		ANNprQ;					// query point
-double			ANNprMaxErr;			// max tolerable squared error
-ANNpointArray	ANNprPts;				// the points
-ANNpr_queue		*ANNprBoxPQ;			// priority queue for boxes
-ANNmin_k		*ANNprPointMK;			// set of k closest points
+thread_local double			ANNprEps;				// the error bound
+thread_local int				ANNprDim;				// dimension of space
+thread_local ANNpoint		ANNprQ;					// query point
+thread_local double			ANNprMaxErr;			// max tolerable squared error
+thread_local ANNpointArray	ANNprPts;				// the points
+thread_local ANNpr_queue		*ANNprBoxPQ;			// priority queue for boxes
+thread_local ANNmin_k		*ANNprPointMK;			// set of k closest points
+thread_local int				*ANNprStamp = NULL;		// per-point stamps (or NULL)
+thread_local int				ANNprStampVal;			// stamp of current query
 
 //----------------------------------------------------------------------
 //	annkPriSearch - priority search for k nearest neighbors
@@ -109,8 +111,7 @@ void ANNkd_tree::annkPriSearch(
 	ANNprBoxPQ = new ANNpr_queue(n_pts);// create priority queue for boxes
 	ANNprBoxPQ->insert(box_dist, root); // insert root in priority queue
 
-	while (ANNprBoxPQ->non_empty() &&
-		(!(ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited))) {
+	while (ANNprBoxPQ->non_empty() && !annSearchStop()) {
 		ANNkd_ptr np;					// next box from prior queue
 
 										// extract closest box from queue
@@ -132,6 +133,27 @@ void ANNkd_tree::annkPriSearch(
 	delete ANNprBoxPQ;					// deallocate priority queue
 }
 
+//----------------------------------------------------------------------
+//	annkPriSearch - priority search within a budget
+//		Since boxes are visited in increasing distance from the query,
+//		the neighbors found when the budget runs out are usually close
+//		to the true ones.  Returns ANNtrue if the search finished
+//		before the budget ran out.
+//----------------------------------------------------------------------
+
+ANNbool ANNkd_tree::annkPriSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// dist to near neighbors (returned)
+	double				eps,			// error bound
+	const ANNsearchBudget &budget)		// limits on the search
+{
+	annBudgetStart(budget);
+	annkPriSearch(q, k, nn_idx, dd, eps);
+	return annBudgetEnd();
+}
+
 //----------------------------------------------------------------------
 //	kd_split::ann_pri_search - search a splitting node
 //----------------------------------------------------------------------
@@ -181,32 +203,23 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
 {
 	register ANNdist dist;				// distance to data point
-	register ANNcoord* pp;				// data coordinate pointer
-	register ANNcoord* qq;				// query coordinate pointer
 	register ANNdist min_dist;			// distance to k-th closest point
-	register ANNcoord t;
-	register int d;
 
 	min_dist = ANNprPointMK->max_key(); // k-th smallest distance so far
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
-
-		pp = ANNprPts[bkt[i]];			// first coord of next data point
-		qq = ANNprQ;					// first coord of query point
-		dist = 0;
-
-		for(d = 0; d < ANNprDim; d++) {
-			ANN_COORD(1)				// one more coordinate hit
-			ANN_FLOP(4)					// increment floating ops
-
-			t = *(qq++) - *(pp++);		// compute length and adv coordinate
-										// exceeds dist to k-th smallest?
-			if( (dist = ANN_SUM(dist, ANN_POW(t))) > min_dist) {
-				break;
-			}
+		if (ANNprStamp != NULL) {		// searching several trees?
+			if (ANNprStamp[bkt[i]] == ANNprStampVal)
+				continue;				// already checked in another tree
+			ANNprStamp[bkt[i]] = ANNprStampVal;
 		}
 
-		if (d >= ANNprDim &&					// among the k best?
+		ANN_COORD(ANNprDim)				// coordinates hit (at most)
+		ANN_FLOP(4*ANNprDim)			// increment floating ops
+										// abandoned past k-th smallest
+		dist = annDistBound(ANNprDim, ANNprPts[bkt[i]], ANNprQ, min_dist);
+
+		if (dist <= min_dist &&					// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
 			ANNprPointMK->insert(dist, bkt[i]);
@@ -216,4 +229,5 @@ void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
 	ANNptsVisited += n_pts;				// increment number of points visited
+	ANNleavesVisited++;					// and number of leaves
 }
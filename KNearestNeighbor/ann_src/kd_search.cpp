@@ -76,11 +76,11 @@
 //		These are given below.
 //----------------------------------------------------------------------
 
-int				ANNkdDim;				// dimension of space
-ANNpoint		ANNkdQ;					// query point
-double			ANNkdMaxErr;			// max tolerable squared error
-ANNpointArray	ANNkdPts;				// the points
-ANNmin_k		*ANNkdPointMK;			// set of k closest points
+thread_local int				ANNkdDim;				// dimension of space
+thread_local ANNpoint		ANNkdQ;					// query point
+thread_local double			ANNkdMaxErr;			// max tolerable squared error
+thread_local ANNpointArray	ANNkdPts;				// the points
+thread_local ANNmin_k		*ANNkdPointMK;			// set of k closest points
 
 //----------------------------------------------------------------------
 //	annkSearch - search for the k nearest neighbors
@@ -117,6 +117,25 @@ void ANNkd_tree::annkSearch(
 	delete ANNkdPointMK;				// deallocate closest point set
 }
 
+//----------------------------------------------------------------------
+//	annkSearch - search within a budget
+//		Runs the standard search with the budget in force.  Returns
+//		ANNtrue if the search finished before the budget ran out.
+//----------------------------------------------------------------------
+
+ANNbool ANNkd_tree::annkSearch(
+	ANNpoint			q,				// the query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps,			// the error bound
+	const ANNsearchBudget &budget)		// limits on the search
+{
+	annBudgetStart(budget);
+	annkSearch(q, k, nn_idx, dd, eps);
+	return annBudgetEnd();
+}
+
 //----------------------------------------------------------------------
 //	kd_split::ann_search - search a splitting node
 //----------------------------------------------------------------------
@@ -124,7 +143,7 @@ void ANNkd_tree::annkSearch(
 void ANNkd_split::ann_search(ANNdist box_dist)
 {
 										// check dist calc term condition
-	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited) return;
+	if (annSearchStop()) return;
 
 										// distance to cutting plane
 	ANNcoord cut_diff = ANNkdQ[cut_dim] - cut_val;
@@ -172,32 +191,17 @@ void ANNkd_split::ann_search(ANNdist box_dist)
 void ANNkd_leaf::ann_search(ANNdist box_dist)
 {
 	register ANNdist dist;				// distance to data point
-	register ANNcoord* pp;				// data coordinate pointer
-	register ANNcoord* qq;				// query coordinate pointer
 	register ANNdist min_dist;			// distance to k-th closest point
-	register ANNcoord t;
-	register int d;
 
 	min_dist = ANNkdPointMK->max_key(); // k-th smallest distance so far
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
+		ANN_COORD(ANNkdDim)				// coordinates hit (at most)
+		ANN_FLOP(4*ANNkdDim)			// increment floating ops
+										// abandoned past k-th smallest
+		dist = annDistBound(ANNkdDim, ANNkdPts[bkt[i]], ANNkdQ, min_dist);
 
-		pp = ANNkdPts[bkt[i]];			// first coord of next data point
-		qq = ANNkdQ;					// first coord of query point
-		dist = 0;
-
-		for(d = 0; d < ANNkdDim; d++) {
-			ANN_COORD(1)				// one more coordinate hit
-			ANN_FLOP(4)					// increment floating ops
-
-			t = *(qq++) - *(pp++);		// compute length and adv coordinate
-										// exceeds dist to k-th smallest?
-			if( (dist = ANN_SUM(dist, ANN_POW(t))) > min_dist) {
-				break;
-			}
-		}
-
-		if (d >= ANNkdDim &&					// among the k best?
+		if (dist <= min_dist &&					// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
 			ANNkdPointMK->insert(dist, bkt[i]);
@@ -207,4 +211,5 @@ void ANNkd_leaf::ann_search(ANNdist box_dist)
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
 	ANNptsVisited += n_pts;				// increment number of points visited
+	ANNleavesVisited++;					// and number of leaves
 }
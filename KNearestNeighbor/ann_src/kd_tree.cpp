@@ -33,6 +33,8 @@
 #include "kd_util.h"					// kd-tree utilities
 #include <ANN/ANNperf.h>				// performance evaluation
 
+#include <thread>						// parallel construction
+
 //----------------------------------------------------------------------
 //	Global data
 //
@@ -309,8 +311,28 @@ ANNkd_tree::ANNkd_tree(					// basic constructor
 //		This procedure selects a cutting dimension and cutting value,
 //		partitions pa about these values, and returns the number of
 //		points on the low side of the cut.
+//
+//		The last argument is the number of threads that may be used to
+//		build this subtree.  When it exceeds one and the subtree is
+//		large enough, the low subtree is built by a new thread (with its
+//		own copy of the bounding box) while this thread builds the high
+//		subtree, and the threads are divided between the two sides in
+//		proportion to their number of points.  The two sides permute
+//		disjoint parts of pidx, and so the resulting tree is identical
+//		to the one built sequentially.
 //----------------------------------------------------------------------
 
+int annSplitThreads(					// threads given to low side of cut
+	int					n_thr,			// threads available
+	int					n,				// number of points
+	int					n_lo)			// number on low side of cut
+{
+	int lo_thr = (int) ((double) n_thr * n_lo / n + 0.5);
+	if (lo_thr < 1) lo_thr = 1;			// each side gets at least one
+	if (lo_thr > n_thr-1) lo_thr = n_thr-1;
+	return lo_thr;
+}
+
 ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 	ANNpointArray		pa,				// point array
 	ANNidxArray			pidx,			// point indices to store in subtree
@@ -318,7 +340,8 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 	int					dim,			// dimension of space
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
-	ANNkd_splitter		splitter)		// splitting routine
+	ANNkd_splitter		splitter,		// splitting routine
+	int					n_thr)			// threads available to build it
 {
 	if (n <= bsp) {						// n small, make a leaf node
 		if (n == 0)						// empty leaf node
@@ -332,23 +355,41 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 		int n_lo;						// number on low side of cut
 		ANNkd_node *lo, *hi;			// low and high children
 
+		ANNbuildThrBudget = n_thr;		// threads for splitter's scans
 										// invoke splitting procedure
 		(*splitter)(pa, pidx, bnd_box, n, dim, cd, cv, n_lo);
 
 		ANNcoord lv = bnd_box.lo[cd];	// save bounds for cutting dimension
 		ANNcoord hv = bnd_box.hi[cd];
 
-		bnd_box.hi[cd] = cv;			// modify bounds for left subtree
-		lo = rkd_tree(					// build left subtree
-				pa, pidx, n_lo,			// ...from pidx[0..n_lo-1]
-				dim, bsp, bnd_box, splitter);
-		bnd_box.hi[cd] = hv;			// restore bounds
-
-		bnd_box.lo[cd] = cv;			// modify bounds for right subtree
-		hi = rkd_tree(					// build right subtree
-				pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
-				dim, bsp, bnd_box, splitter);
-		bnd_box.lo[cd] = lv;			// restore bounds
+		if (n_thr > 1 && n >= ANN_PAR_SUBTREE_PTS) {
+			int lo_thr = annSplitThreads(n_thr, n, n_lo);
+			ANNorthRect lo_box(dim, bnd_box);	// bounds for left subtree
+			lo_box.hi[cd] = cv;
+			thread lo_task([&]() {		// build left subtree concurrently
+				lo = rkd_tree(pa, pidx, n_lo,
+						dim, bsp, lo_box, splitter, lo_thr);
+			});
+			bnd_box.lo[cd] = cv;		// modify bounds for right subtree
+			hi = rkd_tree(				// build right subtree
+					pa, pidx + n_lo, n-n_lo,
+					dim, bsp, bnd_box, splitter, n_thr - lo_thr);
+			bnd_box.lo[cd] = lv;		// restore bounds
+			lo_task.join();				// wait for left subtree
+		}
+		else {
+			bnd_box.hi[cd] = cv;		// modify bounds for left subtree
+			lo = rkd_tree(				// build left subtree
+					pa, pidx, n_lo,		// ...from pidx[0..n_lo-1]
+					dim, bsp, bnd_box, splitter, n_thr);
+			bnd_box.hi[cd] = hv;		// restore bounds
+
+			bnd_box.lo[cd] = cv;		// modify bounds for right subtree
+			hi = rkd_tree(				// build right subtree
+					pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
+					dim, bsp, bnd_box, splitter, n_thr);
+			bnd_box.lo[cd] = lv;		// restore bounds
+		}
 
 										// create the splitting node
 		ANNkd_split *ptr = new ANNkd_split(cd, cv, lv, hv, lo, hi);
@@ -376,6 +417,9 @@ ANNkd_tree::ANNkd_tree(					// construct from point array
 	pts = pa;							// where the points are
 	if (n == 0) return;					// no points--no sweat
 
+	int n_thr = annBuildThreadCount();	// threads used to build
+	ANNbuildThrBudget = n_thr;
+
 	ANNorthRect bnd_box(dd);			// bounding box for points
 	annEnclRect(pa, pidx, n, dd, bnd_box);// construct bounding rectangle
 										// copy to tree structure
@@ -384,22 +428,23 @@ ANNkd_tree::ANNkd_tree(					// construct from point array
 
 	switch (split) {					// build by rule
 	case ANN_KD_STD:					// standard kd-splitting rule
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split);
+		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split, n_thr);
 		break;
 	case ANN_KD_MIDPT:					// midpoint split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split);
+		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split, n_thr);
 		break;
 	case ANN_KD_FAIR:					// fair split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split);
+		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split, n_thr);
 		break;
 	case ANN_KD_SUGGEST:				// best (in our opinion)
 	case ANN_KD_SL_MIDPT:				// sliding midpoint split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split);
+		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split, n_thr);
 		break;
 	case ANN_KD_SL_FAIR:				// sliding fair split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, sl_fair_split);
+		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, sl_fair_split, n_thr);
 		break;
 	default:
 		annError("Illegal splitting method", ANNabort);
 	}
+	ANNbuildThrBudget = 1;				// back to sequential scans
 }
@@ -113,6 +113,7 @@ public:
 	virtual void ann_search(ANNdist);			// standard search
 	virtual void ann_pri_search(ANNdist);		// priority search
 	virtual void ann_FR_search(ANNdist);		// fixed-radius search
+	friend class ANNkd_flat_tree;				// flat copy reads our fields
 };
 
 //----------------------------------------------------------------------
@@ -179,6 +180,7 @@ public:
 	virtual void ann_search(ANNdist);			// standard search
 	virtual void ann_pri_search(ANNdist);		// priority search
 	virtual void ann_FR_search(ANNdist);		// fixed-radius search
+	friend class ANNkd_flat_tree;				// flat copy reads our fields
 };
 
 //----------------------------------------------------------------------
@@ -192,6 +194,12 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 	int					dim,			// dimension of space
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
-	ANNkd_splitter		splitter);		// splitting routine
+	ANNkd_splitter		splitter,		// splitting routine
+	int					n_thr = 1);		// threads available to build it
+
+int annSplitThreads(					// threads given to low side of cut
+	int					n_thr,			// threads available
+	int					n,				// number of points
+	int					n_lo);			// number on low side of cut
 
 #endif
@@ -26,6 +26,9 @@
 
 #include <ANN/ANNperf.h>				// performance evaluation
 
+#include <thread>						// parallel point scans
+#include <vector>
+
 //----------------------------------------------------------------------
 // The following routines are utility functions for manipulating
 // points sets, used in determining splitting planes for kd-tree
@@ -43,6 +46,40 @@
 										// accessing a single point
 #define PP(i)			(pa[pidx[(i)]])
 
+//----------------------------------------------------------------------
+//	Parallel point scans
+//		annScanThreads() gives the number of threads to use for a scan
+//		of n items, given the budget of the current construction task.
+//		annParScan() splits [0..n-1] into that many contiguous chunks,
+//		and invokes scan(t, lo, hi) on chunk t, which covers indices
+//		[lo..hi-1].  Chunk 0 is processed by the calling thread.  The
+//		number of (nonempty) chunks is returned.
+//----------------------------------------------------------------------
+
+thread_local int ANNbuildThrBudget = 1;	// threads for point scans
+
+static int annScanThreads(int n)		// threads to use for n items
+{
+	if (ANNbuildThrBudget <= 1 || n < ANN_PAR_SCAN_PTS) return 1;
+	int n_thr = n / (ANN_PAR_SCAN_PTS/2);	// at least half a scan each
+	return (n_thr < ANNbuildThrBudget ? n_thr : ANNbuildThrBudget);
+}
+
+template <class Scan>
+static int annParScan(int n, int n_thr, Scan scan)
+{
+	vector<thread> workers;				// helper threads
+	int chunk = (n + n_thr - 1) / n_thr;// items per thread
+	for (int t = 1; t < n_thr && t*chunk < n; t++) {
+		int hi = (t+1)*chunk < n ? (t+1)*chunk : n;
+		workers.push_back(thread(scan, t, t*chunk, hi));
+	}
+	scan(0, 0, chunk < n ? chunk : n);	// first chunk is ours
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	return (int) workers.size() + 1;
+}
+
 //----------------------------------------------------------------------
 //	annAspectRatio
 //		Compute the aspect ratio (ratio of longest to shortest side)
@@ -77,16 +114,20 @@ void annEnclRect(
 	int					dim,			// dimension
 	ANNorthRect			&bnds)			// bounding cube (returned)
 {
-	for (int d = 0; d < dim; d++) {		// find smallest enclosing rectangle
-		ANNcoord lo_bnd = PA(0,d);		// lower bound on dimension d
-		ANNcoord hi_bnd = PA(0,d);		// upper bound on dimension d
-		for (int i = 0; i < n; i++) {
-			if (PA(i,d) < lo_bnd) lo_bnd = PA(i,d);
-			else if (PA(i,d) > hi_bnd) hi_bnd = PA(i,d);
+	int n_thr = annScanThreads(n);		// each thread takes some dims
+	if (n_thr > dim) n_thr = dim;
+	annParScan(dim, n_thr, [&](int, int d_lo, int d_hi) {
+		for (int d = d_lo; d < d_hi; d++) {	// find smallest enclosing rect
+			ANNcoord lo_bnd = PA(0,d);	// lower bound on dimension d
+			ANNcoord hi_bnd = PA(0,d);	// upper bound on dimension d
+			for (int i = 0; i < n; i++) {
+				if (PA(i,d) < lo_bnd) lo_bnd = PA(i,d);
+				else if (PA(i,d) > hi_bnd) hi_bnd = PA(i,d);
+			}
+			bnds.lo[d] = lo_bnd;
+			bnds.hi[d] = hi_bnd;
 		}
-		bnds.lo[d] = lo_bnd;
-		bnds.hi[d] = hi_bnd;
-	}
+	});
 }
 
 void annEnclCube(						// compute smallest enclosing cube
@@ -157,13 +198,8 @@ ANNcoord annSpread(				// compute point spread along dimension
 	int					n,				// number of points
 	int					d)				// dimension to check
 {
-	ANNcoord min = PA(0,d);				// compute max and min coords
-	ANNcoord max = PA(0,d);
-	for (int i = 1; i < n; i++) {
-		ANNcoord c = PA(i,d);
-		if (c < min) min = c;
-		else if (c > max) max = c;
-	}
+	ANNcoord min, max;					// compute max and min coords
+	annMinMax(pa, pidx, n, d, min, max);
 	return (max - min);					// total spread is difference
 }
 
@@ -175,12 +211,24 @@ void annMinMax(					// compute min and max coordinates along dim
 	ANNcoord			&min,			// minimum value (returned)
 	ANNcoord			&max)			// maximum value (returned)
 {
-	min = PA(0,d);						// compute max and min coords
-	max = PA(0,d);
-	for (int i = 1; i < n; i++) {
-		ANNcoord c = PA(i,d);
-		if (c < min) min = c;
-		else if (c > max) max = c;
+	int n_thr = annScanThreads(n);
+	vector<ANNcoord> t_min(n_thr), t_max(n_thr);	// per-thread results
+	n_thr = annParScan(n, n_thr, [&](int t, int lo, int hi) {
+		ANNcoord mn = PA(lo,d);			// compute max and min coords
+		ANNcoord mx = PA(lo,d);
+		for (int i = lo+1; i < hi; i++) {
+			ANNcoord c = PA(i,d);
+			if (c < mn) mn = c;
+			else if (c > mx) mx = c;
+		}
+		t_min[t] = mn;
+		t_max[t] = mx;
+	});
+	min = t_min[0];						// combine the chunks
+	max = t_max[0];
+	for (int t = 1; t < n_thr; t++) {
+		if (t_min[t] < min) min = t_min[t];
+		if (t_max[t] > max) max = t_max[t];
 	}
 }
 
@@ -364,10 +412,17 @@ int annSplitBalance(			// determine balance factor of a split
 	int					d,				// dimension along which to split
 	ANNcoord			cv)				// cutting value
 {
+	int n_thr = annScanThreads(n);
+	vector<int> t_lo(n_thr);			// per-thread counts
+	n_thr = annParScan(n, n_thr, [&](int t, int lo, int hi) {
+		int cnt = 0;
+		for(int i = lo; i < hi; i++) {	// count number less than cv
+			if (PA(i,d) < cv) cnt++;
+		}
+		t_lo[t] = cnt;
+	});
 	int n_lo = 0;
-	for(int i = 0; i < n; i++) {		// count number less than cv
-		if (PA(i,d) < cv) n_lo++;
-	}
+	for (int t = 0; t < n_thr; t++) n_lo += t_lo[t];
 	return n_lo - n/2;
 }
 
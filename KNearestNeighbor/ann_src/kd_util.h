@@ -27,6 +27,22 @@
 
 #include "kd_tree.h"					// kd-tree declarations
 
+//----------------------------------------------------------------------
+//	Parallel construction
+//		ANNbuildThrBudget is the number of threads that the construction
+//		task running on this thread may use for its own point scans
+//		(annEnclRect, annSpread, annMinMax and annSplitBalance).  It is
+//		set by rkd_tree() and rbd_tree() before invoking a splitter, so
+//		scans only fan out at the top of the tree, where few subtree
+//		tasks are running.  Scans of fewer than ANN_PAR_SCAN_PTS points
+//		are always sequential.
+//----------------------------------------------------------------------
+
+extern thread_local int ANNbuildThrBudget;	// threads for point scans
+
+const int ANN_PAR_SCAN_PTS		= 1 << 16;	// min points for parallel scan
+const int ANN_PAR_SUBTREE_PTS	= 1 << 12;	// min points for subtree task
+
 //----------------------------------------------------------------------
 //	externally accessible functions
 //----------------------------------------------------------------------
@@ -0,0 +1,278 @@
+//----------------------------------------------------------------------
+// File:			metric.cpp
+// Description:		Search structures specialized for a metric
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include "kd_flat.h"					// flat kd-tree declarations
+
+#include <ANN/ANNmetric.h>				// metric policies
+
+#include <cmath>						// sqrt
+
+//----------------------------------------------------------------------
+//	Normalization (for cosine similarity)
+//----------------------------------------------------------------------
+
+void annNormalizePt(
+	int					dim,			// dimension
+	ANNpoint			p)				// the point (modified)
+{
+	double len = 0;
+	for (int d = 0; d < dim; d++)
+		len += (double) p[d] * p[d];
+	if (len == 0) return;				// leave zero points alone
+	len = sqrt(len);
+	for (int d = 0; d < dim; d++)
+		p[d] = (ANNcoord) (p[d] / len);
+}
+
+void annNormalizePts(
+	ANNpointArray		pa,				// the points (modified)
+	int					n,				// number of points
+	int					dim)			// dimension
+{
+	for (int i = 0; i < n; i++)
+		annNormalizePt(dim, pa[i]);
+}
+
+//----------------------------------------------------------------------
+//	ANNbruteForceT
+//		The same as brute.cpp, with Metric::dist() for the distance.
+//----------------------------------------------------------------------
+
+template <class Metric>
+void ANNbruteForceT<Metric>::annkSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// dist to near neighbors (returned)
+	double				eps)			// error bound (ignored)
+{
+	ANNmin_k mk(k);						// construct a k-limited priority queue
+
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
+	}
+	ANNdist min_dist = mk.max_key();	// k-th smallest distance so far
+	for (int i = 0; i < n_pts; i++) {
+		ANNdist dist = Metric::dist(dim, pts[i], q, min_dist);
+		if (dist <= min_dist &&			// among the k best?
+			(ANN_ALLOW_SELF_MATCH || dist != 0)) {
+			mk.insert(dist, i);
+			min_dist = mk.max_key();
+		}
+	}
+	for (int i = 0; i < k; i++) {		// extract the k closest points
+		dd[i] = mk.ith_smallest_key(i);
+		nn_idx[i] = mk.ith_smallest_info(i);
+	}
+}
+
+template <class Metric>
+int ANNbruteForceT<Metric>::annkFRSearch(
+	ANNpoint			q,				// query point
+	ANNdist				sqRad,			// radius (as a distance)
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor array (returned)
+	ANNdistArray		dd,				// dist to near neighbors (returned)
+	double				eps)			// error bound (ignored)
+{
+	ANNmin_k mk(k);						// construct a k-limited priority queue
+	int pts_in_range = 0;				// number of points in query range
+	for (int i = 0; i < n_pts; i++) {
+		ANNdist dist = Metric::dist(dim, pts[i], q, sqRad);
+		if (dist <= sqRad &&			// within radius bound
+			(ANN_ALLOW_SELF_MATCH || dist != 0)) { // ...and no self match
+			mk.insert(dist, i);
+			pts_in_range++;
+		}
+	}
+	for (int i = 0; i < k; i++) {		// extract the k closest points
+		if (dd != NULL)
+			dd[i] = mk.ith_smallest_key(i);
+		if (nn_idx != NULL)
+			nn_idx[i] = mk.ith_smallest_info(i);
+	}
+	return pts_in_range;
+}
+
+//----------------------------------------------------------------------
+//	ANNkd_flat_treeT
+//		The search of kd_flat.cpp, with the box distances computed and
+//		updated by Metric::power(), sum() and diff().  With rad set to
+//		ANN_DIST_INF it is a kNN search bounded by the k-th smallest
+//		distance; otherwise it is bounded by rad and counts the points
+//		in range.
+//----------------------------------------------------------------------
+
+template <class Metric>
+int ANNkd_flat_treeT<Metric>::search(
+	ANNpoint			q,				// query point
+	ANNmin_k			&mk,			// k closest points (modified)
+	ANNdist				rad,			// radius (ANN_DIST_INF for none)
+	double				eps)			// error bound
+{
+	static_assert(Metric::is_metric, "kd-trees need a metric");
+
+	double max_err = Metric::power((ANNcoord) (1.0 + eps));
+	bool fixed_rad = (rad != ANN_DIST_INF);
+	int pts_visited = 0;
+	int pts_in_range = 0;
+
+	ANNkd_flat_stack *stack = annFlatStack(depth);
+	int top = 0;
+	if (n_nodes > 0) {
+		stack[top].node = 0;
+		stack[top].dist = annBoxDistanceT<Metric>(q, bnd_box_lo, bnd_box_hi, dim);
+		top++;
+	}
+
+	while (top > 0) {
+		if (ANNmaxPtsVisited != 0 && pts_visited > ANNmaxPtsVisited)
+			break;
+		top--;
+		int ni = stack[top].node;
+		ANNdist box_dist = stack[top].dist;
+		ANNdist bound = (fixed_rad ? rad : mk.max_key());
+		if (box_dist * max_err > bound || (!fixed_rad && box_dist * max_err == bound))
+			continue;					// box too far
+
+		while (nodes[ni].cut_dim >= 0) {// descend to the closer leaf
+			const ANNkd_flat_node &nd = nodes[ni];
+			ANNcoord cut_diff = q[nd.cut_dim] - nd.cut_val;
+			ANNcoord box_diff;
+			int near_c, far_c;
+			if (cut_diff < 0) {			// left of cutting plane
+				box_diff = nd.cd_bnds[ANN_LO] - q[nd.cut_dim];
+				near_c = nd.first;
+				far_c = nd.first + 1;
+			}
+			else {						// right of cutting plane
+				box_diff = q[nd.cut_dim] - nd.cd_bnds[ANN_HI];
+				near_c = nd.first + 1;
+				far_c = nd.first;
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// stack further child unless empty
+			if (nodes[far_c].cut_dim >= 0 || nodes[far_c].n > 0) {
+				stack[top].node = far_c;
+				stack[top].dist = Metric::sum(box_dist,
+						Metric::diff(Metric::power(box_diff), Metric::power(cut_diff)));
+				top++;
+			}
+			ni = near_c;
+		}
+
+		const ANNkd_flat_node &lf = nodes[ni];
+		const ANNcoord *pp = leaf_pts + (size_t) lf.first*dim;
+		for (int i = 0; i < lf.n; i++, pp += dim) {
+			bound = (fixed_rad ? rad : mk.max_key());
+			ANNdist dist = Metric::dist(dim, pp, q, bound);
+			if (dist <= bound &&				// among the k best?
+			   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
+				mk.insert(dist, leaf_idx[lf.first + i]);
+				pts_in_range++;
+			}
+		}
+		pts_visited += lf.n;
+	}
+	return pts_in_range;
+}
+
+template <class Metric>
+void ANNkd_flat_treeT<Metric>::annkSearch(
+	ANNpoint			q,				// the query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
+	}
+	ANNmin_k mk(k);						// set of k closest points
+	search(q, mk, ANN_DIST_INF, eps);
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		dd[i] = mk.ith_smallest_key(i);
+		nn_idx[i] = mk.ith_smallest_info(i);
+	}
+}
+
+template <class Metric>
+int ANNkd_flat_treeT<Metric>::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// radius (as a distance)
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	ANNmin_k mk(k);						// set of k closest points
+	int pts_in_range = search(q, mk, sqRad, eps);
+	for (int i = 0; i < k; i++) {		// extract the k-th closest points
+		if (dd != NULL)
+			dd[i] = mk.ith_smallest_key(i);
+		if (nn_idx != NULL)
+			nn_idx[i] = mk.ith_smallest_info(i);
+	}
+	return pts_in_range;
+}
+
+//----------------------------------------------------------------------
+//	Instantiations
+//----------------------------------------------------------------------
+
+template class ANNbruteForceT<ANNmetricL2>;
+template class ANNbruteForceT<ANNmetricL1>;
+template class ANNbruteForceT<ANNmetricLinf>;
+template class ANNbruteForceT<ANNmetricIP>;
+
+template class ANNkd_flat_treeT<ANNmetricL2>;
+template class ANNkd_flat_treeT<ANNmetricL1>;
+template class ANNkd_flat_treeT<ANNmetricLinf>;
+
+//----------------------------------------------------------------------
+//	Fixed dimensions
+//		The widths of the feature vectors we use most (MNIST images
+//		have 784 pixels, most learned embeddings 32 to 256).
+//----------------------------------------------------------------------
+
+#define ANN_FIXED_DIMS(X)	X(32) X(64) X(128) X(256) X(784)
+
+#define ANN_FIXED_CLASS(D)	template class ANNbruteForceT<ANNmetricL2fixed<D> >;
+ANN_FIXED_DIMS(ANN_FIXED_CLASS)
+
+ANNdistFunc annL2DistFunc(int dim)
+{
+	switch (dim) {
+#define ANN_FIXED_CASE(D)	case D: return &ANNmetricL2fixed<D>::dist;
+	ANN_FIXED_DIMS(ANN_FIXED_CASE)
+	default: return &ANNmetricL2::dist;
+	}
+}
+
+ANNpointSet* annNewL2BruteForce(
+	ANNpointArray		pa,				// point array
+	int					n,				// number of points
+	int					dd)				// dimension
+{
+	switch (dd) {
+#define ANN_FIXED_NEW(D)	case D: return new ANNbruteForceT<ANNmetricL2fixed<D> >(pa, n, dd);
+	ANN_FIXED_DIMS(ANN_FIXED_NEW)
+	default: return new ANNbruteForce(pa, n, dd);
+	}
+}
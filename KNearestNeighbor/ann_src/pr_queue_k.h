@@ -61,8 +61,17 @@ const PQKinfo	PQ_NULL_INFO =  ANN_NULL_IDX;	// nonexistent info value
 //		
 //		Note that the list contains k+1 entries, but the last entry
 //		is used as a simple placeholder and is otherwise ignored.
+//
+//		For k above ANN_MIN_K_HEAP the insertion shift costs too much,
+//		and the array is kept as a binary max-heap instead, so that an
+//		insertion costs O(log k) and the k-th smallest key is at the
+//		root.  The heap is sorted in decreasing order (which is still
+//		a heap) the first time an item is extracted, and the ith
+//		smallest item is then found at the end of the array.
 //----------------------------------------------------------------------
 
+const int		ANN_MIN_K_HEAP = 64;	// largest k using insertion sort
+
 class ANNmin_k {
 	struct mk_node {					// node in min_k structure
 		PQKkey			key;			// key value
@@ -72,6 +81,64 @@ class ANNmin_k {
 	int			k;						// max number of keys to store
 	int			n;						// number of keys currently active
 	mk_node		*mk;					// the list itself
+	bool		heap;					// kept as a max-heap?
+	bool		sorted;					// heap sorted in decreasing order?
+
+	void heap_insert(					// insert item in max-heap
+		PQKkey kv,						// key value
+		PQKinfo inf)					// item info
+		{
+			register int i;
+			sorted = false;
+			if (n < k) {				// not full--sift up from the end
+				for (i = n++; i > 0; i = (i-1)/2) {
+					if (mk[(i-1)/2].key >= kv) break;
+					mk[i] = mk[(i-1)/2];
+				}
+			}
+			else {						// full--replace the root
+				if (kv >= mk[0].key) return;
+				for (i = 0; 2*i+1 < k; ) {
+					int c = 2*i+1;		// larger child
+					if (c+1 < k && mk[c+1].key > mk[c].key) c++;
+					if (mk[c].key <= kv) break;
+					mk[i] = mk[c];
+					i = c;
+				}
+			}
+			mk[i].key = kv;				// store element here
+			mk[i].info = inf;
+			ANN_FLOP(1)					// increment floating ops
+		}
+
+	void heap_sort()					// sort heap in decreasing order
+		{
+			for (int j = n-1; j > 0; j--) {	// standard heap sort
+				mk_node t = mk[j];
+				mk[j] = mk[0];			// move maximum to the end
+				int i = 0;
+				for (;;) {				// sift t down in mk[0..j-1]
+					int c = 2*i+1;
+					if (c >= j) break;
+					if (c+1 < j && mk[c+1].key > mk[c].key) c++;
+					if (mk[c].key <= t.key) break;
+					mk[i] = mk[c];
+					i = c;
+				}
+				mk[i] = t;
+			}
+			for (int i = 0, j = n-1; i < j; i++, j--) {	// to decreasing
+				mk_node t = mk[i]; mk[i] = mk[j]; mk[j] = t;
+			}
+			sorted = true;
+		}
+
+	int ith(int i)						// position of ith smallest item
+		{
+			if (!heap) return i;
+			if (!sorted) heap_sort();
+			return n-1-i;
+		}
 
 public:
 	ANNmin_k(int max)					// constructor (given max size)
@@ -79,28 +146,34 @@ public:
 			n = 0;						// initially no items
 			k = max;					// maximum number of items
 			mk = new mk_node[max+1];	// sorted array of keys
+			heap = (max > ANN_MIN_K_HEAP);
+			sorted = true;
 		}
 
 	~ANNmin_k()							// destructor
 		{ delete [] mk; }
 	
 	PQKkey ANNmin_key()					// return minimum key
-		{ return (n > 0 ? mk[0].key : PQ_NULL_KEY); }
+		{ return (n > 0 ? mk[ith(0)].key : PQ_NULL_KEY); }
 	
 	PQKkey max_key()					// return maximum key
-		{ return (n == k ? mk[k-1].key : PQ_NULL_KEY); }
+		{ return (n == k ? mk[heap ? 0 : k-1].key : PQ_NULL_KEY); }
 	
 	PQKkey ith_smallest_key(int i)		// ith smallest key (i in [0..n-1])
-		{ return (i < n ? mk[i].key : PQ_NULL_KEY); }
+		{ return (i < n ? mk[ith(i)].key : PQ_NULL_KEY); }
 	
 	PQKinfo ith_smallest_info(int i)	// info for ith smallest (i in [0..n-1])
-		{ return (i < n ? mk[i].info : PQ_NULL_INFO); }
+		{ return (i < n ? mk[ith(i)].info : PQ_NULL_INFO); }
 
 	inline void insert(					// insert item (inlined for speed)
 		PQKkey kv,						// key value
 		PQKinfo inf)					// item info
 		{
 			register int i;
+			if (heap) {					// large k--use the heap
+				heap_insert(kv, inf);
+				return;
+			}
 										// slide larger values up
 			for (i = n; i > 0; i--) {
 				if (mk[i-1].key > kv)
@@ -0,0 +1,150 @@
+//----------------------------------------------------------------------
+// File:			range_search.cpp
+// Description:		Unbounded fixed-radius (range) search
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include <ANN/ANNx.h>					// all ANN includes
+
+#include <algorithm>					// sort
+#include <atomic>						// shared query counter
+#include <thread>						// parallel batches
+#include <utility>						// pair
+#include <vector>						// STL vector
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	ANNrangeResult
+//----------------------------------------------------------------------
+
+ANNrangeResult::~ANNrangeResult()
+{
+	delete [] idx;
+	delete [] dist;
+}
+
+void ANNrangeResult::grow()
+{
+	int new_cap = (cap > 0 ? 2*cap : 16);
+	ANNidxArray new_idx = new ANNidx[new_cap];
+	ANNdistArray new_dist = new ANNdist[new_cap];
+	for (int i = 0; i < n; i++) {
+		new_idx[i] = idx[i];
+		new_dist[i] = dist[i];
+	}
+	delete [] idx;
+	delete [] dist;
+	idx = new_idx;
+	dist = new_dist;
+	cap = new_cap;
+}
+
+void ANNrangeResult::sort(
+	int					from)			// first pair to sort
+{
+	if (n - from < 2) return;
+	vector< pair<ANNdist,ANNidx> > tmp(n - from);
+	for (int i = from; i < n; i++)
+		tmp[i-from] = make_pair(dist[i], idx[i]);
+	std::sort(tmp.begin(), tmp.end());	// by distance, then index
+	for (int i = from; i < n; i++) {
+		dist[i] = tmp[i-from].first;
+		idx[i] = tmp[i-from].second;
+	}
+}
+
+//----------------------------------------------------------------------
+//	annRangeSearch - generic version
+//		Structures without a range search of their own are searched
+//		twice with annkFRSearch, first with k = 0 to count the points
+//		in range and then with k set to the count.  Not every
+//		structure returns them in distance order, so the new pairs are
+//		sorted when asked for.  For approximate structures the second
+//		search may find fewer points than the first counted, and the
+//		missing ones are skipped.
+//----------------------------------------------------------------------
+
+int ANNpointSet::annRangeSearch(
+	ANNpoint			q,				// query point
+	ANNdist				sqRad,			// squared radius
+	ANNrangeResult		&res,			// points in range (appended)
+	ANNbool				sorted,			// sort by distance?
+	double				eps)			// error bound
+{
+	int k = annkFRSearch(q, sqRad, 0, NULL, NULL, eps);
+	if (k <= 0) return 0;
+
+	ANNidxArray nn_idx = new ANNidx[k];
+	ANNdistArray dd = new ANNdist[k];
+	annkFRSearch(q, sqRad, k, nn_idx, dd, eps);
+
+	int first = res.n;
+	for (int i = 0; i < k; i++) {
+		if (nn_idx[i] != ANN_NULL_IDX)
+			res.add(nn_idx[i], dd[i]);
+	}
+	delete [] nn_idx;
+	delete [] dd;
+	if (sorted) res.sort(first);		// sort the new pairs
+	return res.n - first;
+}
+
+//----------------------------------------------------------------------
+//	annBatchRangeSearch - range search for an array of queries
+//		Threads take queries in small blocks from a shared counter, so
+//		that queries with many points in range do not hold up the
+//		others.  Each query has its own result, and the searches share
+//		no state, so the results are the same as those of a loop of
+//		annRangeSearch() calls.
+//----------------------------------------------------------------------
+
+const int ANN_RANGE_BLOCK = 16;			// queries taken at a time
+
+void ANNpointSet::annBatchRangeSearch(
+	ANNpointArray		qa,				// query points
+	int					nq,				// number of queries
+	ANNdist				sqRad,			// squared radius
+	ANNrangeResult		*res,			// one result per query (appended)
+	ANNbool				sorted,			// sort by distance?
+	double				eps,			// error bound
+	int					nThreads)		// threads to use (0 = all cores)
+{
+	int n_thr = nThreads;
+	if (n_thr <= 0) {
+		n_thr = (int) thread::hardware_concurrency();
+		if (n_thr <= 0) n_thr = 1;		// unknown counts as one
+	}
+	int n_blocks = (nq + ANN_RANGE_BLOCK - 1) / ANN_RANGE_BLOCK;
+	if (n_thr > n_blocks) n_thr = (n_blocks > 0 ? n_blocks : 1);
+
+	atomic<int> next(0);				// next block of queries
+	int max_pts = ANNmaxPtsVisited;		// the caller's limit
+	auto worker = [&]() {
+		ANNmaxPtsVisited = max_pts;
+		for (int b = next++; b < n_blocks; b = next++) {
+			int hi = min(nq, (b+1)*ANN_RANGE_BLOCK);
+			for (int i = b*ANN_RANGE_BLOCK; i < hi; i++)
+				annRangeSearch(qa[i], sqRad, res[i], sorted, eps);
+		}
+	};
+
+	vector<thread> helpers;
+	for (int t = 1; t < n_thr; t++)
+		helpers.push_back(thread(worker));
+	worker();
+	for (size_t t = 0; t < helpers.size(); t++)
+		helpers[t].join();
+}
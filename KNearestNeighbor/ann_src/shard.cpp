@@ -0,0 +1,324 @@
+//----------------------------------------------------------------------
+// File:			shard.cpp
+// Description:		Sharded search structure
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include <ANN/ANNshard.h>				// sharded index declarations
+#include <ANN/ANNx.h>					// all ANN includes
+#include "pr_queue_k.h"					// k-element priority queue
+
+#include <fstream>						// NUMA node files (Linux)
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>					// NUMA and thread affinity
+#elif defined(__linux__)
+#include <pthread.h>					// thread affinity
+#include <sched.h>
+#endif
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	NUMA nodes
+//		On Windows the processors of a node come from the system; on
+//		Linux from /sys/devices/system/node/node<i>/cpulist, a list of
+//		ranges such as "0-7,16-23".  Elsewhere pinning does nothing.
+//----------------------------------------------------------------------
+
+int annNumaNodes()
+{
+	int n = 1;
+#if defined(_WIN32)
+	ULONG highest;
+	if (GetNumaHighestNodeNumber(&highest))
+		n = (int) highest + 1;
+#elif defined(__linux__)
+	for (n = 0; ; n++) {
+		ifstream in("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+		if (!in.good()) break;
+	}
+	if (n == 0) n = 1;
+#endif
+	return n;
+}
+
+static void annPinToNode(				// pin this thread to a node
+	int					node)			// the node
+{
+#if defined(_WIN32)
+	GROUP_AFFINITY ga;
+	if (GetNumaNodeProcessorMaskEx((USHORT) node, &ga))
+		SetThreadGroupAffinity(GetCurrentThread(), &ga, NULL);
+#elif defined(__linux__)
+	ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	int lo, hi;
+	char sep;
+	bool any = false;
+	while (in >> lo) {					// "lo" or "lo-hi", comma separated
+		hi = lo;
+		if (in.peek() == '-') in >> sep >> hi;
+		for (int c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+			CPU_SET(c, &cpus);
+			any = true;
+		}
+		if (in.peek() == ',') in >> sep;
+	}
+	if (any)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+}
+
+//----------------------------------------------------------------------
+//	ANNshard
+//		The results of a job are kept per shard, kk per query, with
+//		indices local to the shard.
+//----------------------------------------------------------------------
+
+struct ANNshard {
+	int					first;			// index of its first point
+	int					n;				// number of points
+	int					node;			// NUMA node (-1 if not pinned)
+	ANNpointArray		pts;			// its copy of the points
+	ANNpointSet			*index;			// its search structure
+	int					kk;				// results per query of the job
+	vector<ANNidx>		idx;			// indices found (nq*kk)
+	vector<ANNdist>		dist;			// their distances
+	vector<int>			count;			// points in range (per query)
+	thread				thr;			// its worker
+};
+
+//----------------------------------------------------------------------
+//	Construction and destruction
+//----------------------------------------------------------------------
+
+ANNsharded::ANNsharded(
+	ANNpointArray		pa,				// point array
+	int					n,				// number of points
+	int					dd,				// dimension
+	int					n_shards,		// number of shards (P)
+	ANNshardBuilder		build,			// builds a shard's structure
+	bool				numa)			// pin shards to NUMA nodes?
+{
+	dim = dd;
+	n_pts = n;
+	pts = pa;
+	job_gen = 0;
+	stop = false;
+	job_q = NULL;
+	job_nq = job_k = 0;
+	job_fr = false;
+	job_rad = 0;
+	job_eps = 0;
+	job_max_pts = 0;
+
+	int p = max(1, min(n_shards, n));	// no empty shards
+	int n_nodes = (numa ? annNumaNodes() : 1);
+	for (int s = 0; s < p; s++) {
+		ANNshard *sh = new ANNshard;
+		sh->first = (int) ((long long) s*n/p);
+		sh->n = (int) ((long long) (s+1)*n/p) - sh->first;
+		sh->node = (n_nodes > 1 ? s % n_nodes : -1);
+		sh->pts = NULL;
+		sh->index = NULL;
+		sh->kk = 0;
+		shards.push_back(sh);
+	}
+
+	unique_lock<mutex> lk(lock);		// workers build their shards
+	pending = p;
+	for (int s = 0; s < p; s++)
+		shards[s]->thr = thread(&ANNsharded::worker, this, shards[s], build);
+	done_cv.wait(lk, [this] { return pending == 0; });
+}
+
+ANNsharded::~ANNsharded()
+{
+	{
+		lock_guard<mutex> lk(lock);
+		stop = true;
+	}
+	work_cv.notify_all();
+	for (size_t s = 0; s < shards.size(); s++) {
+		shards[s]->thr.join();
+		delete shards[s]->index;
+		annDeallocPts(shards[s]->pts);
+		delete shards[s];
+	}
+}
+
+//----------------------------------------------------------------------
+//	worker - body of the thread of a shard
+//		It builds the shard, then runs each job posted until stopped.
+//----------------------------------------------------------------------
+
+void ANNsharded::worker(
+	ANNshard			*s,				// the shard
+	ANNshardBuilder		build)			// its builder
+{
+	if (s->node >= 0)
+		annPinToNode(s->node);
+	s->pts = annAllocPts(s->n, dim);	// first touch on this node
+	for (int i = 0; i < s->n; i++)
+		for (int d = 0; d < dim; d++)
+			s->pts[i][d] = pts[s->first + i][d];
+	s->index = build(s->pts, s->n, dim);
+
+	unique_lock<mutex> lk(lock);
+	if (--pending == 0) done_cv.notify_all();
+	unsigned seen = job_gen;
+	for (;;) {
+		work_cv.wait(lk, [&] { return stop || job_gen != seen; });
+		if (stop) return;
+		seen = job_gen;
+		ANNpointArray qa = job_q;
+		int nq = job_nq;
+		bool fr = job_fr;
+		ANNdist rad = job_rad;
+		double eps = job_eps;
+		ANNmaxPtsVisited = job_max_pts;
+		int kk = min(job_k, s->n);		// a shard may have fewer than k
+		lk.unlock();
+
+		s->kk = kk;
+		s->idx.resize((size_t) nq*kk);
+		s->dist.resize((size_t) nq*kk);
+		s->count.assign(nq, 0);
+		for (int q = 0; q < nq; q++) {
+			ANNidx *ii = (kk > 0 ? &s->idx[(size_t) q*kk] : NULL);
+			ANNdist *di = (kk > 0 ? &s->dist[(size_t) q*kk] : NULL);
+			if (fr)
+				s->count[q] = s->index->annkFRSearch(qa[q], rad, kk, ii, di, eps);
+			else if (kk > 0)
+				s->index->annkSearch(qa[q], kk, ii, di, eps);
+		}
+
+		lk.lock();
+		if (--pending == 0) done_cv.notify_all();
+	}
+}
+
+//----------------------------------------------------------------------
+//	run - hand a job to all shards and wait until they are done
+//----------------------------------------------------------------------
+
+void ANNsharded::run(
+	ANNpointArray		qa,				// queries
+	int					nq,				// number of queries
+	int					k,				// neighbors per query
+	bool				fr,				// fixed-radius search?
+	ANNdist				rad,			// its squared radius
+	double				eps)			// error bound
+{
+	unique_lock<mutex> lk(lock);
+	job_q = qa;
+	job_nq = nq;
+	job_k = k;
+	job_fr = fr;
+	job_rad = rad;
+	job_eps = eps;
+	job_max_pts = ANNmaxPtsVisited;
+	pending = (int) shards.size();
+	job_gen++;
+	work_cv.notify_all();
+	done_cv.wait(lk, [this] { return pending == 0; });
+}
+
+//----------------------------------------------------------------------
+//	merge - merge the shard results of query qi of the last job
+//		Returns the total number of points in range (fixed-radius
+//		jobs only).
+//----------------------------------------------------------------------
+
+int ANNsharded::merge(
+	int					qi,				// query within the job
+	int					k,				// neighbors to return
+	ANNidxArray			nn_idx,			// merged indices (modified)
+	ANNdistArray		dd)				// merged distances (modified)
+{
+	int in_range = 0;
+	ANNmin_k mk(k);
+	for (size_t s = 0; s < shards.size(); s++) {
+		const ANNshard &sh = *shards[s];
+		in_range += sh.count[qi];
+		for (int j = 0; j < sh.kk; j++) {
+			ANNidx id = sh.idx[(size_t) qi*sh.kk + j];
+			if (id == ANN_NULL_IDX) break;	// fewer in range
+			mk.insert(sh.dist[(size_t) qi*sh.kk + j], sh.first + id);
+		}
+	}
+	for (int i = 0; i < k; i++) {		// extract the k closest points
+		if (dd != NULL)
+			dd[i] = mk.ith_smallest_key(i);
+		if (nn_idx != NULL)
+			nn_idx[i] = mk.ith_smallest_info(i);
+	}
+	return in_range;
+}
+
+//----------------------------------------------------------------------
+//	Searches
+//----------------------------------------------------------------------
+
+void ANNsharded::annkSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor array (modified)
+	ANNdistArray		dd,				// dist to near neighbors (modified)
+	double				eps)			// error bound
+{
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
+	}
+	lock_guard<mutex> lk(search_lock);
+	ANNpoint qa[1] = { q };
+	run(qa, 1, k, false, 0, eps);
+	merge(0, k, nn_idx, dd);
+}
+
+int ANNsharded::annkFRSearch(
+	ANNpoint			q,				// the query point
+	ANNdist				sqRad,			// squared radius of query ball
+	int					k,				// number of neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor array (modified)
+	ANNdistArray		dd,				// dist to near neighbors (modified)
+	double				eps)			// error bound
+{
+	lock_guard<mutex> lk(search_lock);
+	ANNpoint qa[1] = { q };
+	run(qa, 1, k, true, sqRad, eps);
+	return merge(0, k, nn_idx, dd);
+}
+
+void ANNsharded::annkSearchBatch(
+	ANNpointArray		qa,				// query points
+	int					nq,				// number of queries
+	int					k,				// neighbors per query
+	ANNidxArray			nn_idx,			// nq*k indices (modified)
+	ANNdistArray		dd,				// nq*k distances (modified)
+	double				eps)			// error bound
+{
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
+	}
+	lock_guard<mutex> lk(search_lock);
+	run(qa, nq, k, false, 0, eps);
+	for (int q = 0; q < nq; q++)
+		merge(q, k, nn_idx + (size_t) q*k, dd + (size_t) q*k);
+}
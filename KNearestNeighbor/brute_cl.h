@@ -1,21 +1,54 @@
 #pragma once
 
 #include <ANN\ANN.h>
+#include <ANN\ANNmetric.h>
+#include "compact.h"
+#include <algorithm>
 #include <cstdlib>
 #include <CL\cl.h>
 #include <ctime>
 #include <cstdio>
+#include <string>
+#include <vector>
+
+// Distance used by KNN search.  Each metric is a separate build of the
+// OpenCL program (see KNN_STEP in knn_kernels.cl) and a separate
+// instantiation of the CPU loops, so no metric is chosen per coordinate.
+// KNN_IP ranks by the negated inner product.  KNN_COSINE is L2 on rows and
+// queries normalized by the caller (KNearestNeighbor does this).
+enum KNNMetric { KNN_L2, KNN_L1, KNN_LINF, KNN_IP, KNN_COSINE };
 
 class KNNBruteCL {
+	static const int HEAP_MIN_K = 64; //larger k selects with a heap
+	static const int DEFAULT_WORK_GROUP = 256;
+	static const int TILE_Q = 8; //queries per work-group of update_dist_tiled
+	static const int TILE_D = 16; //dimensions per slice of update_dist_tiled
+	static const int BATCH_QUERIES = 64; //queries per launch of knnBatch
+
 	int k;
+	KNNMetric metric;
+	ANNdistFunc distFn; //distance of the metric, chosen for dataDim in fit
 	int dataLength;
 	int dataDim;
+	int capacity; //rows the host arrays and device buffers have room for
 	float** data;
+	std::vector<float> store; //own copy of the rows, made by the first append
+	std::vector<float*> storeRows; //row pointers into store
+	std::vector<char> removed; //tombstones, sized capacity once remove is used
+	int nRemoved;
+	const KNNCompactRows* compact; //set instead of data for uint8/fp16 rows
+	std::vector<unsigned char> queryCode; //query encoded for compact rows
 	float* allDists;
 	int *allIndexes;
+	std::vector<float> batchDists; //BATCH_QUERIES rows of dataLength distances
+	int workGroupSize; //requested work-group size (0: DEFAULT_WORK_GROUP)
+	size_t localSize; //work-group size of update_dist_kernel
+	size_t tiledLocalSize; //work-group size of update_dist_tiled
 
 	cl_context context;
+	cl_device_id device;
 	cl_kernel update_dist_kernel;
+	cl_kernel tiled_kernel; //NULL for compact rows
 	cl_command_queue queue;
 	cl_program program;
 
@@ -23,6 +56,8 @@ class KNNBruteCL {
 	cl_mem all_data_gpu;
 	cl_mem all_dists_gpu;
 	cl_mem all_index_gpu;
+	cl_mem batch_query_gpu; //made by the first knnBatch
+	cl_mem batch_dists_gpu;
 
 	void check_cl_error(cl_int err, const char *file, int line)
 	{
@@ -45,6 +80,35 @@ class KNNBruteCL {
 		free(build_log);
 	}
 
+	//the float kernels are built for the metric and for dataDim (-D DIM),
+	//so their loops have a constant trip count
+	std::string buildOptions() {
+		if (compact) //compact kernels compute squared L2
+			return "";
+		std::string options = "-D DIM=" + std::to_string(dataDim) +
+			" -D KNN_TILE_Q=" + std::to_string(TILE_Q) + " -D KNN_TILE_D=" + std::to_string(TILE_D);
+		switch (metric) {
+		case KNN_L1: return options + " -D KNN_METRIC_L1";
+		case KNN_LINF: return options + " -D KNN_METRIC_LINF";
+		case KNN_IP: return options + " -D KNN_METRIC_IP";
+		default: return options;
+		}
+	}
+
+	void chooseDist() {
+		switch (metric) {
+		case KNN_L1: distFn = &ANNmetricL1::dist; break;
+		case KNN_LINF: distFn = &ANNmetricLinf::dist; break;
+		case KNN_IP: distFn = &ANNmetricIP::dist; break;
+		default: distFn = annL2DistFunc(dataDim); break;
+		}
+	}
+
+	//distance from a float row, abandoned once it passes bound
+	float rowDist(const float* row, const float* query, float bound) {
+		return distFn(dataDim, row, query, bound);
+	}
+
 	cl_program load_program(char* fileName, cl_context context, cl_device_id device) {
 		FILE* fp = fopen(fileName, "r");
 
@@ -57,7 +121,7 @@ class KNNBruteCL {
 		fread(buffer, 1, length, fp);
 
 		cl_program program = clCreateProgramWithSource(context, 1, (const char**)&buffer, 0, 0);
-		if (clBuildProgram(program, 0, 0, 0, 0, 0) != CL_SUCCESS) {
+		if (clBuildProgram(program, 0, 0, buildOptions().c_str(), 0, 0) != CL_SUCCESS) {
 			print_build_log(program, device);
 		}
 
@@ -67,17 +131,7 @@ class KNNBruteCL {
 		return program;
 	}
 
-	void cleanupCL() {
-		if (update_dist_kernel) {
-			clReleaseKernel(update_dist_kernel);
-			update_dist_kernel = 0;
-		}
-
-		if (program) {
-			clReleaseProgram(program);
-			program = 0;
-		}
-
+	void releaseBuffers() {
 		if (query_gpu) {
 			clReleaseMemObject(query_gpu);
 			query_gpu = 0;
@@ -95,6 +149,32 @@ class KNNBruteCL {
 			clReleaseMemObject(all_index_gpu);
 			all_index_gpu = 0;
 		}
+		if (batch_query_gpu) {
+			clReleaseMemObject(batch_query_gpu);
+			batch_query_gpu = 0;
+		}
+		if (batch_dists_gpu) {
+			clReleaseMemObject(batch_dists_gpu);
+			batch_dists_gpu = 0;
+		}
+	}
+
+	void cleanupCL() {
+		if (update_dist_kernel) {
+			clReleaseKernel(update_dist_kernel);
+			update_dist_kernel = 0;
+		}
+		if (tiled_kernel) {
+			clReleaseKernel(tiled_kernel);
+			tiled_kernel = 0;
+		}
+
+		if (program) {
+			clReleaseProgram(program);
+			program = 0;
+		}
+
+		releaseBuffers();
 
 		if (queue) {
 			clReleaseCommandQueue(queue);
@@ -124,19 +204,72 @@ class KNNBruteCL {
 		cl_device_id* devices = new cl_device_id[cb/sizeof(cl_device_id)];
 		clGetContextInfo(context, CL_CONTEXT_DEVICES, cb, &devices[0], 0);
 
-		queue = clCreateCommandQueue(context, devices[0], 0, 0);
-		program = load_program("knn_kernels.cl", context, devices[0]);
+		device = devices[0];
+		delete[] devices;
+		delete[] platforms;
+
+		queue = clCreateCommandQueue(context, device, 0, 0);
+		program = load_program("knn_kernels.cl", context, device);
 		if (queue == 0 || program == 0) {
 			cout << "Fail to init OpenCL" << endl;
 			return;
 		}
 
-		query_gpu = clCreateBuffer(context, 0, sizeof(cl_float) * dataDim, NULL, NULL);
-		all_data_gpu = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * dataDim*dataLength, data[0], NULL);
-		all_dists_gpu = clCreateBuffer(context, 0, sizeof(cl_float) * dataLength, NULL, NULL);
-		all_index_gpu = clCreateBuffer(context, 0, sizeof(cl_int) * dataLength, NULL, NULL);
+		if (compact) {
+			initCompactCL();
+			chooseLocalSize();
+			return;
+		}
 
 		update_dist_kernel = clCreateKernel(program, "update_dist_local", 0);
+		tiled_kernel = clCreateKernel(program, "update_dist_tiled", 0);
+		chooseLocalSize();
+		createBuffers();
+	}
+
+	//largest work-group size the device runs kernel with
+	size_t kernelMaxGroup(cl_kernel kernel) {
+		size_t maxGroup = 0;
+		if (kernel == 0 || clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+			sizeof(maxGroup), &maxGroup, NULL) != CL_SUCCESS || maxGroup == 0)
+			return 1;
+		return maxGroup;
+	}
+
+	//the requested work-group size, lowered to what each kernel allows; the
+	//tiled kernel is also limited by the local memory its row tile takes
+	void chooseLocalSize() {
+		size_t wanted = workGroupSize > 0 ? workGroupSize : DEFAULT_WORK_GROUP;
+		localSize = std::min(wanted, kernelMaxGroup(update_dist_kernel));
+
+		tiledLocalSize = std::min(wanted, kernelMaxGroup(tiled_kernel));
+		cl_ulong localMem = 0;
+		clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMem), &localMem, NULL);
+		size_t tileFloats = (size_t)TILE_D * (tiledLocalSize + 1) + (size_t)TILE_Q * TILE_D;
+		while (tiledLocalSize > 1 && localMem > 0 && tileFloats * sizeof(cl_float) > localMem) {
+			tiledLocalSize /= 2;
+			tileFloats = (size_t)TILE_D * (tiledLocalSize + 1) + (size_t)TILE_Q * TILE_D;
+		}
+	}
+
+	//the global size for n work-items: n rounded up to a whole number of
+	//work-groups, the kernels skipping the items past the end
+	static size_t roundUp(size_t n, size_t group) {
+		return (n + group - 1) / group * group;
+	}
+
+	//float buffers with room for capacity rows, of which the dataLength
+	//present are uploaded; made again when append outgrows them
+	void createBuffers() {
+		releaseBuffers();
+		int rows = std::max(capacity, 1);
+		query_gpu = clCreateBuffer(context, 0, sizeof(cl_float) * dataDim, NULL, NULL);
+		all_data_gpu = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_float) * dataDim*rows, NULL, NULL);
+		all_dists_gpu = clCreateBuffer(context, 0, sizeof(cl_float) * rows, NULL, NULL);
+		all_index_gpu = clCreateBuffer(context, 0, sizeof(cl_int) * rows, NULL, NULL);
+		if (dataLength > 0)
+			clEnqueueWriteBuffer(queue, all_data_gpu, CL_TRUE, 0, sizeof(cl_float) * dataDim*dataLength, data[0], 0, 0, 0);
+
 		clSetKernelArg(update_dist_kernel, 0, sizeof(cl_mem), &query_gpu);
 		clSetKernelArg(update_dist_kernel, 1, sizeof(cl_mem), &all_data_gpu);
 		clSetKernelArg(update_dist_kernel, 2, sizeof(cl_mem), &all_dists_gpu);
@@ -146,44 +279,92 @@ class KNNBruteCL {
 		clSetKernelArg(update_dist_kernel, 6, sizeof(cl_float)*dataDim, NULL);
 	}
 
+	//uint8 rows use update_dist_u8, fp16 rows update_dist_fp16; both read
+	//rows of stride elements and take the query already encoded
+	void initCompactCL() {
+		int stride = compact->getStride();
+		float invScale2 = compact->getInvScale2();
+		bool u8 = compact->getStorage() == KNN_STORE_U8;
+
+		query_gpu = clCreateBuffer(context, 0, compact->queryBytes(), NULL, NULL);
+		all_data_gpu = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
+			compact->rowBytes() * dataLength, (void*)compact->rows(), NULL);
+		all_dists_gpu = clCreateBuffer(context, 0, sizeof(cl_float) * dataLength, NULL, NULL);
+		all_index_gpu = clCreateBuffer(context, 0, sizeof(cl_int) * dataLength, NULL, NULL);
+
+		update_dist_kernel = clCreateKernel(program, u8 ? "update_dist_u8" : "update_dist_fp16", 0);
+		clSetKernelArg(update_dist_kernel, 0, sizeof(cl_mem), &query_gpu);
+		clSetKernelArg(update_dist_kernel, 1, sizeof(cl_mem), &all_data_gpu);
+		clSetKernelArg(update_dist_kernel, 2, sizeof(cl_mem), &all_dists_gpu);
+		clSetKernelArg(update_dist_kernel, 3, sizeof(cl_mem), &all_index_gpu);
+		clSetKernelArg(update_dist_kernel, 4, sizeof(cl_int), &dataLength);
+		clSetKernelArg(update_dist_kernel, 5, sizeof(cl_int), &stride);
+		clSetKernelArg(update_dist_kernel, 6, u8 ? sizeof(cl_int)*stride : sizeof(cl_float)*stride, NULL);
+		if (u8)
+			clSetKernelArg(update_dist_kernel, 7, sizeof(cl_float), &invScale2);
+	}
+
 	void updateCL(float* query) {
-		int reserveNumber = dataLength % 256;
-		size_t globalSize = dataLength - reserveNumber;
+		size_t globalSize = roundUp(dataLength, localSize);
 
 		cl_int err;
-		clEnqueueWriteBuffer(queue, query_gpu, CL_TRUE, 0, sizeof(float)*dataDim, query, 0, 0, 0);
-		err = clEnqueueNDRangeKernel(queue, update_dist_kernel, 1, 0, (size_t*)&globalSize, 0, 0, 0, 0);
-		err = clEnqueueReadBuffer(queue, all_dists_gpu, CL_TRUE, 0, sizeof(float)*globalSize, allDists, 0, 0, 0);
-		err = clEnqueueReadBuffer(queue, all_index_gpu, CL_TRUE, 0, sizeof(int)*globalSize, allIndexes, 0, 0, 0);
-
-		for (int i = dataLength - reserveNumber; i < dataLength; ++i) {
-			float sum = 0;
-			for (int j = 0; j < dataDim; ++j) {
-				sum += (data[i][j] - query[j])*(data[i][j] - query[j]);
-			}
-			allDists[i] = sum;
-			allIndexes[i] = i;
+		if (compact) {
+			compact->encodeQuery(query, &queryCode[0]);
+			clEnqueueWriteBuffer(queue, query_gpu, CL_TRUE, 0, compact->queryBytes(), &queryCode[0], 0, 0, 0);
 		}
+		else
+			clEnqueueWriteBuffer(queue, query_gpu, CL_TRUE, 0, sizeof(float)*dataDim, query, 0, 0, 0);
+		err = clEnqueueNDRangeKernel(queue, update_dist_kernel, 1, 0, &globalSize, &localSize, 0, 0, 0);
+		check_cl_error(err, __FILE__, __LINE__);
+		err = clEnqueueReadBuffer(queue, all_dists_gpu, CL_TRUE, 0, sizeof(float)*dataLength, allDists, 0, 0, 0);
+		err = clEnqueueReadBuffer(queue, all_index_gpu, CL_TRUE, 0, sizeof(int)*dataLength, allIndexes, 0, 0, 0);
+	}
+
+	//distances of m <= BATCH_QUERIES float queries to every row, into
+	//batchDists; the buffers are made on first use with room for capacity rows
+	void updateTiledCL(float** queries, int m) {
+		if (batch_dists_gpu == 0) {
+			batch_query_gpu = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_float) * dataDim*BATCH_QUERIES, NULL, NULL);
+			batch_dists_gpu = clCreateBuffer(context, 0, sizeof(cl_float) * BATCH_QUERIES*(size_t)std::max(capacity, 1), NULL, NULL);
+		}
+		batchDists.resize((size_t)BATCH_QUERIES * std::max(capacity, 1));
+		for (int i = 0; i < m; ++i)
+			clEnqueueWriteBuffer(queue, batch_query_gpu, CL_FALSE, sizeof(cl_float) * dataDim*i,
+				sizeof(cl_float) * dataDim, queries[i], 0, 0, 0);
+
+		clSetKernelArg(tiled_kernel, 0, sizeof(cl_mem), &batch_query_gpu);
+		clSetKernelArg(tiled_kernel, 1, sizeof(cl_mem), &all_data_gpu);
+		clSetKernelArg(tiled_kernel, 2, sizeof(cl_mem), &batch_dists_gpu);
+		clSetKernelArg(tiled_kernel, 3, sizeof(cl_int), &dataLength);
+		clSetKernelArg(tiled_kernel, 4, sizeof(cl_int), &dataDim);
+		clSetKernelArg(tiled_kernel, 5, sizeof(cl_int), &m);
+		clSetKernelArg(tiled_kernel, 6, sizeof(cl_float) * TILE_D*(tiledLocalSize + 1), NULL);
+
+		size_t globalSize[2] = { roundUp(dataLength, tiledLocalSize), (size_t)(m + TILE_Q - 1) / TILE_Q };
+		size_t groupSize[2] = { tiledLocalSize, 1 };
+		cl_int err = clEnqueueNDRangeKernel(queue, tiled_kernel, 2, 0, globalSize, groupSize, 0, 0, 0);
+		check_cl_error(err, __FILE__, __LINE__);
+		clEnqueueReadBuffer(queue, batch_dists_gpu, CL_TRUE, 0, sizeof(float) * dataLength*(size_t)m, &batchDists[0], 0, 0, 0);
 	}
 
 	void update(float* query) {
 		for (int i = 0; i < dataLength; ++i) {
-			float sum = 0;
-			for (int j = 0; j < dataDim; ++j)
-				sum += (data[i][j] - query[j])*(data[i][j] - query[j]);
-			allDists[i] = sum;
+			allDists[i] = rowDist(data[i], query, ANN_DIST_INF);
 
 			allIndexes[i] = i;
 		}
 	}
 
-	void kNearestPQ(int k, int* nn_idx, float* dists) {
+	//k best of cand (the distances of the rows, in order of allIndexes)
+	void kNearestPQ(int k, const float* cand, int* nn_idx, float* dists) {
 		int currentLength = 0;
 		int i;
 
 		for (int pointIndex = 0; pointIndex < dataLength; ++pointIndex) {
+			if (isRemoved(allIndexes[pointIndex]))
+				continue;
 			for (i = currentLength; i > 0; --i) {
-				if (dists[i - 1] > allDists[pointIndex]) {
+				if (dists[i - 1] > cand[pointIndex]) {
 					if (i == k)
 						continue;
 					dists[i] = dists[i - 1];
@@ -197,12 +378,106 @@ class KNNBruteCL {
 			if (i == k)
 				continue;
 
-			dists[i] = allDists[pointIndex];
+			dists[i] = cand[pointIndex];
 			nn_idx[i] = allIndexes[pointIndex];
 
 			if (currentLength < k)
 				++currentLength;
 		}
+		fillMissing(currentLength, k, nn_idx, dists);
+	}
+
+	//removed rows can leave fewer than k candidates
+	void fillMissing(int from, int k, int* nn_idx, float* dists) {
+		for (int i = from; i < k; ++i) {
+			dists[i] = ANN_DIST_INF;
+			nn_idx[i] = ANN_NULL_IDX;
+		}
+	}
+
+	//max-heap of the k best in nn_idx/dists, for k too large for the
+	//insertion shift of kNearestPQ; distances not below the root are
+	//rejected with one comparison, and the heap is sorted at the end
+	void siftDown(int i, int len, int* nn_idx, float* dists) {
+		float d = dists[i];
+		int idx = nn_idx[i];
+		for (int c = 2 * i + 1; c < len; c = 2 * i + 1) {
+			if (c + 1 < len && dists[c + 1] > dists[c])
+				++c;
+			if (dists[c] <= d)
+				break;
+			dists[i] = dists[c];
+			nn_idx[i] = nn_idx[c];
+			i = c;
+		}
+		dists[i] = d;
+		nn_idx[i] = idx;
+	}
+
+	void kNearestHeap(int k, const float* cand, int* nn_idx, float* dists) {
+		int currentLength = 0;
+
+		for (int pointIndex = 0; pointIndex < dataLength; ++pointIndex) {
+			if (isRemoved(allIndexes[pointIndex]))
+				continue;
+			float d = cand[pointIndex];
+			if (currentLength < k) { //sift up from the end
+				int i = currentLength++;
+				for (; i > 0 && dists[(i - 1) / 2] < d; i = (i - 1) / 2) {
+					dists[i] = dists[(i - 1) / 2];
+					nn_idx[i] = nn_idx[(i - 1) / 2];
+				}
+				dists[i] = d;
+				nn_idx[i] = allIndexes[pointIndex];
+			}
+			else if (d < dists[0]) { //replace the root
+				dists[0] = d;
+				nn_idx[0] = allIndexes[pointIndex];
+				siftDown(0, k, nn_idx, dists);
+			}
+		}
+
+		for (int last = currentLength - 1; last > 0; --last) { //heap sort
+			float d = dists[0];
+			int idx = nn_idx[0];
+			dists[0] = dists[last];
+			nn_idx[0] = nn_idx[last];
+			dists[last] = d;
+			nn_idx[last] = idx;
+			siftDown(0, last, nn_idx, dists);
+		}
+		fillMissing(currentLength, k, nn_idx, dists);
+	}
+
+	//CPU scan fused with the selection, used when OpenCL is not set up;
+	//a float row is abandoned once its partial distance passes the
+	//current k-th best (see rowDist)
+	void knnCPU(float* query, int* nn_idx, float* dists) {
+		int currentLength = 0;
+		float bound = ANN_DIST_INF;
+		if (compact)
+			compact->encodeQuery(query, &queryCode[0]);
+
+		for (int pointIndex = 0; pointIndex < dataLength; ++pointIndex) {
+			if (isRemoved(pointIndex))
+				continue;
+			float d = compact ? compact->dist(pointIndex, &queryCode[0])
+				: rowDist(data[pointIndex], query, bound);
+			if (d > bound || (currentLength == k && d == bound))
+				continue;
+
+			int i = currentLength < k ? currentLength++ : k - 1;
+			for (; i > 0 && dists[i - 1] > d; --i) {
+				dists[i] = dists[i - 1];
+				nn_idx[i] = nn_idx[i - 1];
+			}
+			dists[i] = d;
+			nn_idx[i] = pointIndex;
+			if (currentLength == k)
+				bound = dists[k - 1];
+		}
+
+		fillMissing(currentLength, k, nn_idx, dists);
 	}
 
 	void kNearest(int k, int* nn_idx, float* dists) {
@@ -224,14 +499,64 @@ class KNNBruteCL {
 		}
 	}
 
+	bool isRemoved(int i) {
+		return nRemoved > 0 && removed[i];
+	}
+
+	//host arrays for cap rows; tombstones kept
+	void setCapacity(int cap) {
+		capacity = cap;
+		delete[] allDists;
+		delete[] allIndexes;
+		allDists = new float[cap];
+		allIndexes = new int[cap];
+		if (!removed.empty())
+			removed.resize(cap, 0);
+	}
+
+	//a fit drops the own copy and the tombstones
+	void resetRows(int n) {
+		store.clear();
+		storeRows.clear();
+		removed.clear();
+		nRemoved = 0;
+		setCapacity(n);
+	}
+
+	//copies the rows present into store with room for cap rows, and points
+	//data into it
+	void ownRows(int cap) {
+		std::vector<float> grown((size_t)cap * dataDim);
+		for (int i = 0; i < dataLength; ++i)
+			std::copy(data[i], data[i] + dataDim, &grown[(size_t)i * dataDim]);
+		store.swap(grown);
+		storeRows.resize(cap);
+		for (int i = 0; i < cap; ++i)
+			storeRows[i] = &store[(size_t)i * dataDim];
+		data = &storeRows[0];
+	}
+
 public:
-	KNNBruteCL(int k = 10){
+	KNNBruteCL(int k = 10, KNNMetric metric = KNN_L2){
 		this->k = k;
+		this->metric = metric == KNN_COSINE ? KNN_L2 : metric;
+		distFn = &ANNmetricL2::dist;
 		allDists = NULL;
 		allIndexes = NULL;
+		dataLength = 0;
+		capacity = 0;
+		nRemoved = 0;
+		data = NULL;
+		compact = NULL;
+
+		workGroupSize = 0;
+		localSize = DEFAULT_WORK_GROUP;
+		tiledLocalSize = DEFAULT_WORK_GROUP;
 
 		context = 0;
+		device = 0;
 		update_dist_kernel = 0;
+		tiled_kernel = 0;
 		queue = 0;
 		program = 0;
 
@@ -239,19 +564,42 @@ public:
 		all_data_gpu = 0;
 		all_dists_gpu = 0;
 		all_index_gpu = 0;
+		batch_query_gpu = 0;
+		batch_dists_gpu = 0;
+	}
+
+	//work-group size of the distance kernels (0: 256), lowered to what the
+	//device allows; the row count need not be a multiple of it
+	void setWorkGroupSize(int wg) {
+		workGroupSize = wg;
+		if (update_dist_kernel)
+			chooseLocalSize();
 	}
 
+	int getWorkGroupSize() { return (int)localSize; }
+
+	//rows are not copied and must outlive this, until the first append
 	void fit(float** pa, int n, int dd) {
 		data = pa;
+		compact = NULL;
 		dataLength = n;
 		dataDim = dd;
+		chooseDist();
+		resetRows(n);
 
-		if (allDists)
-			delete[] allDists;
-		if (allIndexes)
-			delete[] allIndexes;
-		allDists = new float[dataLength];
-		allIndexes = new int[dataLength];
+		cleanupCL();
+		initCL();
+	}
+
+	//rows kept as uint8 or fp16; they are not copied and must outlive this.
+	//Compact rows are searched with squared L2 whatever the metric.
+	void fit(const KNNCompactRows* rows) {
+		data = NULL;
+		compact = rows;
+		dataLength = rows->getLength();
+		dataDim = rows->getDim();
+		queryCode.assign(rows->queryBytes() + 16, 0);
+		resetRows(dataLength);
 
 		cleanupCL();
 		initCL();
@@ -265,10 +613,150 @@ public:
 	}
 
 	void knn(float* query, int* nn_idx, float* dists) {
+		if (queue == 0 || update_dist_kernel == 0) {
+			knnCPU(query, nn_idx, dists);
+			return;
+		}
+
 		//update(query);
 		updateCL(query);
 
 		//kNearest(k, nn_idx, dists);		
-		kNearestPQ(k, nn_idx, dists);
+		select(allDists, nn_idx, dists);
+	}
+
+	void select(const float* cand, int* nn_idx, float* dists) {
+		if (k > HEAP_MIN_K)
+			kNearestHeap(k, cand, nn_idx, dists);
+		else
+			kNearestPQ(k, cand, nn_idx, dists);
+	}
+
+	//k nearest of each of nq queries, into nn_idx[i*k..] and dists[i*k..].
+	//Float rows on OpenCL are searched BATCH_QUERIES queries at a time with
+	//update_dist_tiled; otherwise this is knn for each query.
+	void knnBatch(float** queries, int nq, int* nn_idx, float* dists) {
+		if (queue == 0 || tiled_kernel == 0) {
+			for (int i = 0; i < nq; ++i)
+				knn(queries[i], nn_idx + (size_t)i*k, dists + (size_t)i*k);
+			return;
+		}
+
+		for (int i = 0; i < dataLength; ++i)
+			allIndexes[i] = i;
+		for (int q0 = 0; q0 < nq; q0 += BATCH_QUERIES) {
+			int m = std::min(nq - q0, (int)BATCH_QUERIES);
+			updateTiledCL(queries + q0, m);
+			for (int i = 0; i < m; ++i)
+				select(&batchDists[(size_t)i*dataLength], nn_idx + (size_t)(q0 + i)*k, dists + (size_t)(q0 + i)*k);
+		}
+	}
+
+	//adds m rows (copied) after the present ones and returns the index of the
+	//first; indices of the present rows do not change.  Only the new rows are
+	//written to the device, at their offset.  When the room is used up the
+	//rows are copied into buffers twice the size and uploaded once, so the
+	//full uploads are amortized over the appends.  Compact rows cannot be
+	//appended to (returns -1).
+	int append(float** rows, int m) {
+		if (compact)
+			return -1;
+
+		int first = dataLength;
+		bool grow = store.empty() || dataLength + m > capacity;
+		if (grow) {
+			int cap = std::max(2 * (dataLength + m), 256);
+			ownRows(cap);
+			setCapacity(cap);
+		}
+		for (int i = 0; i < m; ++i)
+			std::copy(rows[i], rows[i] + dataDim, data[first + i]);
+		dataLength += m;
+
+		if (queue == 0 || update_dist_kernel == 0)
+			return first;
+		if (grow)
+			createBuffers();
+		else {
+			clEnqueueWriteBuffer(queue, all_data_gpu, CL_TRUE, sizeof(cl_float) * dataDim*first,
+				sizeof(cl_float) * dataDim*m, data[first], 0, 0, 0);
+			clSetKernelArg(update_dist_kernel, 4, sizeof(cl_int), &dataLength);
+		}
+		return first;
+	}
+
+	//marks row i deleted.  It is skipped by the searches, but keeps its index
+	//and its place on the device until the next fit.
+	void remove(int i) {
+		if (i < 0 || i >= dataLength)
+			return;
+		if (removed.empty())
+			removed.assign(capacity, 0);
+		if (!removed[i]) {
+			removed[i] = 1;
+			++nRemoved;
+		}
 	}
-};
\ No newline at end of file
+
+	int size() { return dataLength; } //rows, removed ones included
+	int removedCount() { return nRemoved; }
+};
+
+// ANNpointSet over a KNNBruteCL, so that an OpenCL search can be used where
+// ANN expects a search structure, such as a shard of ANNsharded.  The OpenCL
+// search returns the maxK given here, of which the first k are copied, so k
+// must not exceed maxK.  Fixed-radius searches run on the CPU, with the same
+// metric.
+class KNNBruteCLSet : public ANNpointSet {
+	KNNBruteCL bcl;
+	ANNpointSet* cpu; //for fixed-radius searches
+	int maxK;
+	int dim;
+	int length;
+	ANNpointArray pts;
+	std::vector<int> idx;
+	std::vector<float> dists;
+
+	static ANNpointSet* newCPUSearch(KNNMetric metric, ANNpointArray pa, int n, int dd) {
+		switch (metric) {
+		case KNN_L1: return new ANNbruteForceT<ANNmetricL1>(pa, n, dd);
+		case KNN_LINF: return new ANNbruteForceT<ANNmetricLinf>(pa, n, dd);
+		case KNN_IP: return new ANNbruteForceT<ANNmetricIP>(pa, n, dd);
+		default: return annNewL2BruteForce(pa, n, dd); //KNN_COSINE rows are normalized
+		}
+	}
+
+public:
+	KNNBruteCLSet(ANNpointArray pa, int n, int dd, int maxK, KNNMetric metric = KNN_L2)
+		: bcl(maxK, metric) {
+		cpu = newCPUSearch(metric, pa, n, dd);
+		this->maxK = maxK;
+		dim = dd;
+		length = n;
+		pts = pa;
+		idx.resize(maxK);
+		dists.resize(maxK);
+		bcl.fit(pa, n, dd);
+	}
+
+	~KNNBruteCLSet() {
+		delete cpu;
+	}
+
+	void annkSearch(ANNpoint q, int k, ANNidxArray nn_idx, ANNdistArray dd, double eps = 0.0) {
+		bcl.knn(q, &idx[0], &dists[0]);
+		for (int i = 0; i < k && i < maxK; ++i) {
+			nn_idx[i] = idx[i];
+			dd[i] = dists[i];
+		}
+	}
+
+	int annkFRSearch(ANNpoint q, ANNdist sqRad, int k = 0, ANNidxArray nn_idx = NULL,
+		ANNdistArray dd = NULL, double eps = 0.0) {
+		return cpu->annkFRSearch(q, sqRad, k, nn_idx, dd, eps);
+	}
+
+	int theDim() { return dim; }
+	int nPoints() { return length; }
+	ANNpointArray thePoints() { return pts; }
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <ANN\ANN.h>
+#include <vector>
+#include <queue>
+#include <cstring>
+#include <emmintrin.h>
+
+// Storage of the training rows used by brute force search.  KNN search scans
+// every row per query and is bound by memory bandwidth, so storing a row in
+// fewer bytes scans proportionally faster and fits more rows per node.
+//
+// KNN_STORE_U8 keeps one byte per coordinate.  Data whose values are all
+// integers in 0..255 (such as pixels) is stored exactly; other data is mapped
+// linearly from its [min, max] range onto 0..255.  Distances are accumulated
+// in integers and scaled back to the units of the data.
+// KNN_STORE_FP16 keeps IEEE half floats (11 significant bits, |x| < 65504);
+// the query stays in float.
+enum KNNStorage { KNN_STORE_FLOAT, KNN_STORE_U8, KNN_STORE_FP16 };
+
+class KNNCompactRows {
+	KNNStorage storage;
+	int length;
+	int dim;
+	int stride; //dim padded to 16 bytes (16 for u8, 8 for fp16)
+	float lo; //u8: code = (x - lo) * scale
+	float scale;
+	float invScale2; //converts integer distances back to data units
+	std::vector<unsigned char> u8;
+	std::vector<unsigned short> f16;
+
+	static unsigned short floatToHalf(float f) {
+		unsigned int x;
+		memcpy(&x, &f, sizeof(x));
+		unsigned int sign = (x >> 16) & 0x8000;
+		int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+		unsigned int mant = x & 0x7fffff;
+		if (exp >= 31) //too large, store infinity
+			return (unsigned short)(sign | 0x7c00);
+		if (exp <= 0) { //denormal or zero
+			if (exp < -10)
+				return (unsigned short)sign;
+			mant |= 0x800000;
+			int shift = 14 - exp;
+			unsigned int h = mant >> shift;
+			if ((mant >> (shift - 1)) & 1) //round to nearest
+				++h;
+			return (unsigned short)(sign | h);
+		}
+		unsigned int h = sign | (exp << 10) | (mant >> 13);
+		if (mant & 0x1000) //round to nearest, a carry moves into the exponent
+			++h;
+		return (unsigned short)h;
+	}
+
+	//four halves (low 16 bits of each lane) to floats, finite values only
+	static __m128 halfToFloat4(__m128i h) {
+		const __m128i noSign = _mm_set1_epi32(0x7fff);
+		const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+		__m128i expMant = _mm_and_si128(h, noSign);
+		__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expMant), 16);
+		__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMant, 13)), magic);
+		return _mm_or_ps(scaled, _mm_castsi128_ps(sign));
+	}
+
+	static float hsum(__m128 v) {
+		float s[4];
+		_mm_storeu_ps(s, v);
+		return s[0] + s[1] + s[2] + s[3];
+	}
+
+	static int hsum(__m128i v) {
+		int s[4];
+		_mm_storeu_si128((__m128i*)s, v);
+		return s[0] + s[1] + s[2] + s[3];
+	}
+
+	unsigned char quantize(double x) const {
+		double code = (x - lo) * scale + 0.5;
+		if (code < 0)
+			return 0;
+		if (code > 255)
+			return 255;
+		return (unsigned char)code;
+	}
+
+	void fitRange(double** x, int n) {
+		double mn = x[0][0], mx = x[0][0];
+		bool pixels = true;
+		for (int i = 0; i < n; ++i) {
+			for (int j = 0; j < dim; ++j) {
+				double v = x[i][j];
+				if (v < mn) mn = v;
+				if (v > mx) mx = v;
+				if (v != (int)v)
+					pixels = false;
+			}
+		}
+		if (pixels && mn >= 0 && mx <= 255) { //store exactly
+			lo = 0;
+			scale = 1;
+		}
+		else {
+			lo = (float)mn;
+			scale = mx > mn ? (float)(255.0 / (mx - mn)) : 1.0f;
+		}
+		invScale2 = 1.0f / (scale*scale);
+	}
+
+public:
+	KNNCompactRows() {
+		storage = KNN_STORE_FLOAT;
+		length = 0;
+		dim = 0;
+		stride = 0;
+		lo = 0;
+		scale = 1;
+		invScale2 = 1;
+	}
+
+	void fit(double** x, int n, int dd, KNNStorage storage) {
+		this->storage = storage;
+		length = n;
+		dim = dd;
+		u8.clear();
+		f16.clear();
+
+		if (storage == KNN_STORE_U8) {
+			stride = (dd + 15) / 16 * 16;
+			if (n > 0)
+				fitRange(x, n);
+			u8.assign((size_t)n*stride, 0);
+			for (int i = 0; i < n; ++i)
+				for (int j = 0; j < dd; ++j)
+					u8[(size_t)i*stride + j] = quantize(x[i][j]);
+		}
+		else {
+			stride = (dd + 7) / 8 * 8;
+			f16.assign((size_t)n*stride, 0);
+			for (int i = 0; i < n; ++i)
+				for (int j = 0; j < dd; ++j)
+					f16[(size_t)i*stride + j] = floatToHalf((float)x[i][j]);
+		}
+	}
+
+	KNNStorage getStorage() const { return storage; }
+	int getLength() const { return length; }
+	int getDim() const { return dim; }
+	int getStride() const { return stride; }
+	float getInvScale2() const { return invScale2; }
+
+	//rows for upload, stride elements each
+	const void* rows() const {
+		if (storage == KNN_STORE_U8)
+			return u8.empty() ? NULL : &u8[0];
+		return f16.empty() ? NULL : &f16[0];
+	}
+	size_t rowBytes() const { return storage == KNN_STORE_U8 ? stride : stride * sizeof(unsigned short); }
+	size_t queryBytes() const { return storage == KNN_STORE_U8 ? stride : stride * sizeof(float); }
+
+	//query in the form dist() expects: u8 codes or floats, padded to stride
+	void encodeQuery(const float* q, void* out) const {
+		if (storage == KNN_STORE_U8) {
+			unsigned char* code = (unsigned char*)out;
+			for (int j = 0; j < stride; ++j)
+				code[j] = j < dim ? quantize(q[j]) : 0;
+		}
+		else {
+			float* f = (float*)out;
+			for (int j = 0; j < stride; ++j)
+				f[j] = j < dim ? q[j] : 0;
+		}
+	}
+
+	//squared distance from row i to an encoded query
+	float dist(int i, const void* query) const {
+		if (storage == KNN_STORE_U8) {
+			const unsigned char* a = &u8[(size_t)i*stride];
+			const unsigned char* b = (const unsigned char*)query;
+			const __m128i zero = _mm_setzero_si128();
+			__m128i acc = _mm_setzero_si128();
+			for (int j = 0; j < stride; j += 16) {
+				__m128i va = _mm_loadu_si128((const __m128i*)(a + j));
+				__m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+				__m128i dlo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+				__m128i dhi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(dlo, dlo));
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(dhi, dhi));
+			}
+			return hsum(acc) * invScale2;
+		}
+
+		const unsigned short* a = &f16[(size_t)i*stride];
+		const float* b = (const float*)query;
+		const __m128i zero = _mm_setzero_si128();
+		__m128 acc = _mm_setzero_ps();
+		for (int j = 0; j < stride; j += 8) {
+			__m128i h = _mm_loadu_si128((const __m128i*)(a + j));
+			__m128 t0 = _mm_sub_ps(halfToFloat4(_mm_unpacklo_epi16(h, zero)), _mm_loadu_ps(b + j));
+			__m128 t1 = _mm_sub_ps(halfToFloat4(_mm_unpackhi_epi16(h, zero)), _mm_loadu_ps(b + j + 4));
+			acc = _mm_add_ps(acc, _mm_add_ps(_mm_mul_ps(t0, t0), _mm_mul_ps(t1, t1)));
+		}
+		return hsum(acc);
+	}
+};
+
+// CPU brute force search over compact rows.  The rows are not copied and must
+// outlive the search structure.
+class KNNCompactBrute : public ANNpointSet {
+	const KNNCompactRows* rows;
+	std::vector<unsigned char> query; //encoded query, reused between searches
+
+	typedef std::pair<float, int> Candidate;
+
+public:
+	KNNCompactBrute(const KNNCompactRows* rows) {
+		this->rows = rows;
+		query.resize(rows->queryBytes() + 16);
+	}
+
+	void annkSearch(ANNpoint q, int k, ANNidxArray nn_idx, ANNdistArray dd, double eps = 0.0) {
+		rows->encodeQuery(q, &query[0]);
+		std::priority_queue<Candidate> best;
+		int n = rows->getLength();
+		for (int i = 0; i < n; ++i) {
+			float dist = rows->dist(i, &query[0]);
+			if ((int)best.size() < k)
+				best.push(Candidate(dist, i));
+			else if (dist < best.top().first) {
+				best.pop();
+				best.push(Candidate(dist, i));
+			}
+		}
+
+		for (int i = k - 1; i >= 0; --i) {
+			if (i >= (int)best.size()) {
+				dd[i] = ANN_DIST_INF;
+				nn_idx[i] = ANN_NULL_IDX;
+				continue;
+			}
+			dd[i] = best.top().first;
+			nn_idx[i] = best.top().second;
+			best.pop();
+		}
+	}
+
+	int annkFRSearch(ANNpoint q, ANNdist sqRad, int k = 0, ANNidxArray nn_idx = NULL,
+		ANNdistArray dd = NULL, double eps = 0.0) {
+		rows->encodeQuery(q, &query[0]);
+		std::priority_queue<Candidate> best;
+		int n = rows->getLength();
+		int inRange = 0;
+		for (int i = 0; i < n; ++i) {
+			float dist = rows->dist(i, &query[0]);
+			if (dist > sqRad)
+				continue;
+			++inRange;
+			if ((int)best.size() < k)
+				best.push(Candidate(dist, i));
+			else if (k > 0 && dist < best.top().first) {
+				best.pop();
+				best.push(Candidate(dist, i));
+			}
+		}
+
+		for (int i = k - 1; i >= 0; --i) {
+			float dist = ANN_DIST_INF;
+			int id = ANN_NULL_IDX;
+			if (i < (int)best.size()) {
+				dist = best.top().first;
+				id = best.top().second;
+				best.pop();
+			}
+			if (dd != NULL)
+				dd[i] = dist;
+			if (nn_idx != NULL)
+				nn_idx[i] = id;
+		}
+		return inRange;
+	}
+
+	int theDim() { return rows->getDim(); }
+	int nPoints() { return rows->getLength(); }
+	ANNpointArray thePoints() { return NULL; } //rows are stored only in compact form
+};
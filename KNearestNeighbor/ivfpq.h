@@ -0,0 +1,379 @@
+#pragma once
+
+#include <ANN\ANN.h>
+#include "..\KMeans\kmeanslib.h"
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <random>
+#include <xmmintrin.h>
+
+// Inverted-file index with product-quantized residuals (IVF-PQ).
+//
+// The training rows are clustered into nList coarse cells with KMeans.  Each
+// row is stored in the list of its cell as the residual from the cell
+// centroid, quantized by nSub independent sub-quantizers of 256 codewords
+// each (one byte per sub-vector).  A row therefore costs nSub bytes plus its
+// index, instead of 4*dim bytes as floats; the default nSub = dim/16 gives
+// about 64x compression.
+//
+// A query scans the nProbe cells closest to it.  For each cell it builds a
+// table of distances from the query residual to every codeword, so the
+// distance to a stored row is the sum of nSub table entries.  Four rows are
+// summed at once with SSE.  With rerank > 0 the best rerank candidates are
+// re-ordered by exact distance.  For that a fit with rerank > 0 keeps a float
+// copy of the training rows, 4*dim bytes per row on top of the codes, so the
+// caller's rows need not outlive the fit; a fit with rerank = 0 keeps only
+// the codes, and re-ranking turned on after it starts with the next fit.
+//
+// Fixed-radius searches scan the same probed lists and count the rows whose
+// table distance (or exact distance, when re-ranking) is within the radius.
+class KNNIvfPQ : public ANNpointSet {
+	static const int KSUB = 256; //max codewords per sub-quantizer
+	static const int TRAIN_PER_CENTROID = 64; //training rows per centroid
+
+	int dataLength;
+	int dataDim;
+	int nListParam; //as given to the constructor
+	int nSubParam; //as given (0: dim/16)
+	int nList; //used by the last fit (at most the number of rows)
+	int nSub; //used by the last fit
+	int subLen; //dims per sub-vector
+	int subDim; //subLen padded to a multiple of 4
+	int kSub; //codewords per sub-quantizer
+	int nProbe;
+	int rerank;
+	std::vector<float> exactRows; //[dataLength][dataDim] copy, for re-ranking
+
+	std::vector<float> coarse; //[nList][dataDim]
+	std::vector<float> codebook; //[nSub][kSub][subDim]
+	std::vector<std::vector<int> > listIds;
+	std::vector<std::vector<unsigned char> > listCodes; //nSub bytes per row
+
+	typedef std::pair<float, int> Candidate;
+
+	//rows chosen at random for training; KMeans seeds with its first rows
+	std::vector<int> sampleRows(int n, int count) {
+		std::vector<int> rows(n);
+		for (int i = 0; i < n; ++i)
+			rows[i] = i;
+		std::mt19937 gen(12345);
+		for (int i = 0; i < count; ++i)
+			std::swap(rows[i], rows[i + gen() % (n - i)]);
+		rows.resize(count);
+		return rows;
+	}
+
+	float coarseDist(const float* q, int c) {
+		const float* cp = &coarse[c*dataDim];
+		float dist = 0;
+		for (int j = 0; j < dataDim; ++j)
+			dist += (q[j] - cp[j])*(q[j] - cp[j]);
+		return dist;
+	}
+
+	int nearestCoarse(const double* x) {
+		int best = 0;
+		double bestDist = 0;
+		for (int c = 0; c < nList; ++c) {
+			const float* cp = &coarse[c*dataDim];
+			double dist = 0;
+			for (int j = 0; j < dataDim; ++j)
+				dist += (x[j] - cp[j])*(x[j] - cp[j]);
+			if (c == 0 || dist < bestDist) {
+				bestDist = dist;
+				best = c;
+			}
+		}
+		return best;
+	}
+
+	//residual of x from centroid c; sub-vector s holds dims
+	//s*subLen .. s*subLen+subLen-1 and is zero padded to subDim
+	template <class T>
+	void residual(const T* x, int c, float* r) {
+		const float* cp = &coarse[c*dataDim];
+		for (int s = 0; s < nSub; ++s) {
+			for (int t = 0; t < subDim; ++t) {
+				int j = s*subLen + t;
+				r[s*subDim + t] = (t < subLen && j < dataDim) ? (float)(x[j] - cp[j]) : 0;
+			}
+		}
+	}
+
+	static float distSSE(const float* a, const float* b, int d) {
+		__m128 acc = _mm_setzero_ps();
+		for (int j = 0; j < d; j += 4) {
+			__m128 t = _mm_sub_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j));
+			acc = _mm_add_ps(acc, _mm_mul_ps(t, t));
+		}
+		float s[4];
+		_mm_storeu_ps(s, acc);
+		return s[0] + s[1] + s[2] + s[3];
+	}
+
+	void encode(const float* r, unsigned char* code) {
+		for (int s = 0; s < nSub; ++s) {
+			const float* book = &codebook[s*kSub*subDim];
+			int best = 0;
+			float bestDist = distSSE(r + s*subDim, book, subDim);
+			for (int t = 1; t < kSub; ++t) {
+				float dist = distSSE(r + s*subDim, book + t*subDim, subDim);
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = t;
+				}
+			}
+			code[s] = (unsigned char)best;
+		}
+	}
+
+	void trainCoarse(double** x, const std::vector<int>& rows) {
+		std::vector<double*> sample(rows.size());
+		for (size_t i = 0; i < rows.size(); ++i)
+			sample[i] = x[rows[i]];
+
+		KMeans km(nList);
+		km.fit(&sample[0], (int)sample.size(), dataDim);
+
+		coarse.assign(nList*dataDim, 0);
+		for (int c = 0; c < nList; ++c)
+			for (int j = 0; j < dataDim; ++j)
+				coarse[c*dataDim + j] = (float)km.get_cluster(c)[j];
+	}
+
+	void trainCodebooks(double** x, const std::vector<int>& rows) {
+		int ns = (int)rows.size();
+		int width = nSub*subDim;
+		std::vector<float> res(ns*width);
+		for (int i = 0; i < ns; ++i)
+			residual(x[rows[i]], nearestCoarse(x[rows[i]]), &res[i*width]);
+
+		codebook.assign(nSub*kSub*subDim, 0);
+		std::vector<double> block(ns*subDim);
+		std::vector<double*> sub(ns);
+		KMeans km(kSub);	//one for all sub-quantizers: its OpenCL program is built once
+		for (int s = 0; s < nSub; ++s) {
+			for (int i = 0; i < ns; ++i) {
+				sub[i] = &block[i*subDim];
+				for (int j = 0; j < subDim; ++j)
+					sub[i][j] = res[i*width + s*subDim + j];
+			}
+
+			km.fit(&sub[0], ns, subDim);
+			for (int t = 0; t < kSub; ++t)
+				for (int j = 0; j < subDim; ++j)
+					codebook[(s*kSub + t)*subDim + j] = (float)km.get_cluster(t)[j];
+		}
+	}
+
+	//distance tables from a query residual to every codeword
+	void buildTable(const float* r, float* table) {
+		for (int s = 0; s < nSub; ++s) {
+			const float* book = &codebook[s*kSub*subDim];
+			for (int t = 0; t < kSub; ++t)
+				table[s*kSub + t] = distSSE(r + s*subDim, book + t*subDim, subDim);
+		}
+	}
+
+	void pushCandidate(std::priority_queue<Candidate>& best, int kk, float dist, int id) {
+		if ((int)best.size() < kk)
+			best.push(Candidate(dist, id));
+		else if (dist < best.top().first) {
+			best.pop();
+			best.push(Candidate(dist, id));
+		}
+	}
+
+	//calls visit(dist, id) for the rows of list c, using the distance table
+	template <class Visit>
+	void scanList(int c, const float* table, Visit visit) {
+		const std::vector<int>& ids = listIds[c];
+		const unsigned char* codes = listCodes[c].empty() ? NULL : &listCodes[c][0];
+		int len = (int)ids.size();
+		int i = 0;
+
+		for (; i + 4 <= len; i += 4) { //four rows per pass
+			const unsigned char* c0 = codes + i*nSub;
+			const unsigned char* c1 = c0 + nSub;
+			const unsigned char* c2 = c1 + nSub;
+			const unsigned char* c3 = c2 + nSub;
+			__m128 acc = _mm_setzero_ps();
+			for (int s = 0; s < nSub; ++s) {
+				const float* t = table + s*kSub;
+				acc = _mm_add_ps(acc, _mm_set_ps(t[c3[s]], t[c2[s]], t[c1[s]], t[c0[s]]));
+			}
+			float dist[4];
+			_mm_storeu_ps(dist, acc);
+			for (int j = 0; j < 4; ++j)
+				visit(dist[j], ids[i + j]);
+		}
+		for (; i < len; ++i) {
+			const unsigned char* code = codes + i*nSub;
+			float dist = 0;
+			for (int s = 0; s < nSub; ++s)
+				dist += table[s*kSub + code[s]];
+			visit(dist, ids[i]);
+		}
+	}
+
+	//calls visit(dist, id) for the rows of the nProbe cells nearest q
+	template <class Visit>
+	void scanProbes(ANNpoint q, Visit visit) {
+		std::vector<Candidate> cells(nList);
+		for (int c = 0; c < nList; ++c)
+			cells[c] = Candidate(coarseDist(q, c), c);
+		int probes = std::min(nProbe, nList);
+		std::partial_sort(cells.begin(), cells.begin() + probes, cells.end());
+
+		std::vector<float> r(nSub*subDim);
+		std::vector<float> table(nSub*kSub);
+		for (int p = 0; p < probes; ++p) {
+			int c = cells[p].second;
+			if (listIds[c].empty())
+				continue;
+			residual(q, c, &r[0]);
+			buildTable(&r[0], &table[0]);
+			scanList(c, &table[0], visit);
+		}
+	}
+
+	bool canRerank() { return rerank > 0 && !exactRows.empty(); }
+
+	float exactDist(ANNpoint q, int id) {
+		const float* row = &exactRows[(size_t)id*dataDim];
+		double dist = 0;
+		for (int j = 0; j < dataDim; ++j)
+			dist += ((double)row[j] - q[j])*((double)row[j] - q[j]);
+		return (float)dist;
+	}
+
+	//the candidates of best in increasing distance order
+	static std::vector<Candidate> drain(std::priority_queue<Candidate>& best) {
+		std::vector<Candidate> found(best.size());
+		for (int i = (int)best.size() - 1; i >= 0; --i) {
+			found[i] = best.top();
+			best.pop();
+		}
+		return found;
+	}
+
+	static void fillResults(const std::vector<Candidate>& found, int k, ANNidxArray nn_idx, ANNdistArray dd) {
+		for (int i = 0; i < k; ++i) {
+			bool has = i < (int)found.size();
+			if (dd != NULL)
+				dd[i] = has ? found[i].first : ANN_DIST_INF;
+			if (nn_idx != NULL)
+				nn_idx[i] = has ? found[i].second : ANN_NULL_IDX;
+		}
+	}
+
+public:
+	// nSub = 0 picks dim/16 sub-quantizers; rerank = 0 disables re-ranking
+	KNNIvfPQ(int nList = 256, int nSub = 0, int nProbe = 8, int rerank = 0) {
+		nListParam = nList;
+		nSubParam = nSub;
+		this->nList = 0;
+		this->nSub = 0;
+		this->nProbe = nProbe;
+		this->rerank = rerank;
+		dataLength = 0;
+		dataDim = 0;
+		subLen = 0;
+		subDim = 0;
+		kSub = 0;
+	}
+
+	void setProbe(int nProbe) { this->nProbe = nProbe; }
+	void setRerank(int rerank) { this->rerank = rerank; }
+
+	void fit(double** x, int n, int dd) {
+		dataLength = n;
+		dataDim = dd;
+
+		nSub = nSubParam > 0 ? nSubParam : (dd + 15) / 16;
+		if (nSub > dd)
+			nSub = dd;
+		subLen = (dd + nSub - 1) / nSub;
+		subDim = (subLen + 3) / 4 * 4;
+		nList = std::min(nListParam, n);
+
+		exactRows.clear();
+		if (rerank > 0) {
+			exactRows.resize((size_t)n*dd);
+			for (int i = 0; i < n; ++i)
+				for (int j = 0; j < dd; ++j)
+					exactRows[(size_t)i*dd + j] = (float)x[i][j];
+		}
+
+		std::vector<int> rows = sampleRows(n, std::min(n, nList*TRAIN_PER_CENTROID));
+		trainCoarse(x, rows);
+		if ((int)rows.size() < KSUB) //codebooks need one row per codeword
+			rows = sampleRows(n, n);
+		kSub = std::min(KSUB, (int)rows.size());
+		trainCodebooks(x, rows);
+
+		listIds.assign(nList, std::vector<int>());
+		listCodes.assign(nList, std::vector<unsigned char>());
+		std::vector<float> r(nSub*subDim);
+		std::vector<unsigned char> code(nSub);
+		for (int i = 0; i < n; ++i) {
+			int c = nearestCoarse(x[i]);
+			residual(x[i], c, &r[0]);
+			encode(&r[0], &code[0]);
+			listIds[c].push_back(i);
+			listCodes[c].insert(listCodes[c].end(), code.begin(), code.end());
+		}
+	}
+
+	void annkSearch(ANNpoint q, int k, ANNidxArray nn_idx, ANNdistArray dd, double eps = 0.0) {
+		int kk = std::max(k, canRerank() ? rerank : 0);
+		std::priority_queue<Candidate> best;
+		scanProbes(q, [&](float dist, int id) { pushCandidate(best, kk, dist, id); });
+
+		std::vector<Candidate> found = drain(best);
+		if (canRerank()) { //exact distances for the candidates
+			for (size_t i = 0; i < found.size(); ++i)
+				found[i].first = exactDist(q, found[i].second);
+			std::sort(found.begin(), found.end());
+		}
+		fillResults(found, k, nn_idx, dd);
+	}
+
+	//rows of the probed cells within sqRad (by exact distance when
+	//re-ranking, checked for the rows whose table distance is within it);
+	//the nearest k of them are returned
+	int annkFRSearch(ANNpoint q, ANNdist sqRad, int k = 0, ANNidxArray nn_idx = NULL,
+		ANNdistArray dd = NULL, double eps = 0.0) {
+		bool exact = canRerank();
+		int count = 0;
+		std::priority_queue<Candidate> best;
+		scanProbes(q, [&](float dist, int id) {
+			if (dist > sqRad)
+				return;
+			if (exact) {
+				dist = exactDist(q, id);
+				if (dist > sqRad)
+					return;
+			}
+			++count;
+			if (k > 0)
+				pushCandidate(best, k, dist, id);
+		});
+
+		fillResults(drain(best), k, nn_idx, dd);
+		return count;
+	}
+
+	int theDim() { return dataDim; }
+	int nPoints() { return dataLength; }
+	ANNpointArray thePoints() { return NULL; } //rows are stored only as codes
+
+	size_t codeBytes() { //memory used by the compressed rows
+		return (size_t)dataLength * (nSub + sizeof(int));
+	}
+
+	size_t rerankBytes() { //memory used by the row copy kept for re-ranking
+		return exactRows.size() * sizeof(float);
+	}
+};
@@ -4,6 +4,13 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include <CL\cl.hpp>
 
 using namespace std;
@@ -14,6 +21,30 @@ class NaiveBayesBase {
 	float** thetaHatLog;
 	float** oneMinusThetaHatLog;
 	int* attribThresh;
+	int nClassPad; //nClass rounded up to a multiple of 4
+	int nWords; //64-bit words of a packed query
+	vector<float> baseLog; //piHatLog + sum of oneMinusThetaHatLog, per class
+	vector<float> deltaLog; //dim rows of nClassPad: thetaHatLog - oneMinusThetaHatLog
+
+	static const int MIN_ROWS_PER_THREAD = 256;
+	static const int MAX_CL_GROUP = 256;
+
+	//OpenCL engine, set up by the first predictBatchCL and kept with the
+	//model: the tables are uploaded once, and the query and result buffers
+	//are reused until a larger batch needs bigger ones
+	bool clTried; //setup attempted
+	bool clReady; //setup succeeded
+	cl::Context clContext;
+	cl::Device clDevice;
+	cl::CommandQueue clQueue;
+	cl::Kernel clKernel;
+	cl::Buffer baseLogCL;
+	cl::Buffer deltaLogCL;
+	cl::Buffer bitsCL;
+	cl::Buffer resultCL;
+	int clCapacity; //queries bitsCL and resultCL have room for
+	size_t clGroupSize; //work-items per query
+	vector<uint64_t> batchBits;
 
 	int** alloc2D(int d1, int d2) {
 		int* block = new int[d1*d2];
@@ -91,39 +122,165 @@ class NaiveBayesBase {
 		return result;
 	}
 
-	void posterior(int* point, float* result) {
-		for (int i = 0; i < nClass; ++i)
-			result[i] = 0;
-
+	//Scoring of binarized queries.  A class's log posterior is its baseline
+	//(every attribute off) plus, for each attribute on, the difference of its
+	//two table entries, so only the set bits of a query are visited, each
+	//adding one row of deltaLog to all the classes four at a time.
+	void calcPackedTables() {
+		nClassPad = (nClass + 3) / 4 * 4;
+		nWords = (dim + 63) / 64;
+		baseLog.assign(nClassPad, 0.0f);
+		deltaLog.assign((size_t)dim * nClassPad, 0.0f);
 		for (int c = 0; c < nClass; ++c) {
-			result[c] += piHatLog[c];
-			for (int j = 0; j < dim; ++j) {
-				if (point[j] > attribThresh[j])
-					result[c] += thetaHatLog[j][c];
-				else
-					result[c] += oneMinusThetaHatLog[j][c];
+			double sum = piHatLog[c];
+			for (int j = 0; j < dim; ++j)
+				sum += oneMinusThetaHatLog[j][c];
+			baseLog[c] = (float)sum;
+		}
+		for (int j = 0; j < dim; ++j)
+			for (int c = 0; c < nClass; ++c)
+				deltaLog[(size_t)j * nClassPad + c] = thetaHatLog[j][c] - oneMinusThetaHatLog[j][c];
+	}
+
+	//bit j of bits is set when attribute j is above its threshold
+	void packQuery(const int* point, uint64_t* bits) {
+		for (int w = 0; w < nWords; ++w) {
+			uint64_t word = 0;
+			int end = min(dim - w * 64, 64);
+			for (int b = 0; b < end; ++b)
+				word |= (uint64_t)(point[w * 64 + b] > attribThresh[w * 64 + b]) << b;
+			bits[w] = word;
+		}
+	}
+
+	static int lowestBit(uint64_t word) {
+#ifdef _MSC_VER
+		unsigned long i;
+#if defined(_M_X64) || defined(_M_ARM64)
+		_BitScanForward64(&i, word);
+#else
+		//no 64-bit scan on 32-bit targets: scan the low half, then the high
+		if (!_BitScanForward(&i, (unsigned long)word)) {
+			_BitScanForward(&i, (unsigned long)(word >> 32));
+			i += 32;
+		}
+#endif
+		return (int)i;
+#else
+		return __builtin_ctzll(word);
+#endif
+	}
+
+	//result holds nClassPad scores, the padding ones meaningless
+	void scorePacked(const uint64_t* bits, float* result) {
+		for (int c = 0; c < nClassPad; c += 4)
+			_mm_storeu_ps(result + c, _mm_loadu_ps(&baseLog[c]));
+		for (int w = 0; w < nWords; ++w) {
+			for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+				const float* row = &deltaLog[(size_t)(w * 64 + lowestBit(word)) * nClassPad];
+				for (int c = 0; c < nClassPad; c += 4)
+					_mm_storeu_ps(result + c, _mm_add_ps(_mm_loadu_ps(result + c), _mm_loadu_ps(row + c)));
 			}
 		}
 	}
 
-	int** calcPixelFreq(int* label, int* data, int* classifierFreq) {
-		int** result = alloc2D(dim, nClass);
-		for (int i = 0; i < dim; ++i)
-			for (int j = 0; j < nClass; ++j)
-				result[i][j] = 1;
-		for (int i = 0; i < nTrain; ++i) {
-			int c = label[i];
-			for (int j = 0; j < dim; ++j) {
-				if (data[i*dim + j] > attribThresh[j]) {
-					result[j][c] += 1;
+	int argmax(const float* probs) {
+		int result = 0;
+		for (int i = 1; i < nClass; ++i)
+			if (probs[i] > probs[result])
+				result = i;
+		return result;
+	}
+
+	static int threadCount(int n) {
+		int t = (int)std::thread::hardware_concurrency();
+		t = min(max(t, 1), max(n / MIN_ROWS_PER_THREAD, 1));
+		return t;
+	}
+
+	//runs body(part, lo, hi) for parts 0..t-1 of [0, n), one per thread
+	template <typename Body>
+	static void parallelParts(int n, int t, Body body) {
+		vector<std::thread> workers;
+		for (int i = 1; i < t; ++i)
+			workers.push_back(std::thread(body, i, (int)((long long)i * n / t), (int)((long long)(i + 1) * n / t)));
+		body(0, 0, (int)((long long)n / t));
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	//runs body(lo, hi) over [0, n) split among the cores
+	template <typename Body>
+	static void parallelRows(int n, Body body) {
+		parallelParts(n, threadCount(n), [&](int, int lo, int hi) { body(lo, hi); });
+	}
+
+	//Training reads the caller's rows in order, split among the cores.  The
+	//attributes are truncated to int as the queries are.  The first pass
+	//takes each thread's min and max of every attribute and merges them into
+	//the thresholds; the second counts the attributes above threshold into a
+	//table per thread, one contiguous row of dim counts per class, and the
+	//tables are summed.  Counts start at 1 (Laplace smoothing).
+	int* calcAttribThresh(double** x) {
+		int t = threadCount(nTrain);
+		vector<vector<int> > minVal(t), maxVal(t);
+		parallelParts(nTrain, t, [&](int part, int lo, int hi) {
+			vector<int>& mn = minVal[part];
+			vector<int>& mx = maxVal[part];
+			mn.assign(dim, 0);
+			mx.assign(dim, 0);
+			if (lo == hi)
+				return;
+			for (int j = 0; j < dim; ++j)
+				mn[j] = mx[j] = (int)x[lo][j];
+			for (int i = lo + 1; i < hi; ++i) {
+				const double* row = x[i];
+				for (int j = 0; j < dim; ++j) {
+					int v = (int)row[j];
+					mn[j] = min(mn[j], v);
+					mx[j] = max(mx[j], v);
 				}
 			}
+		});
+
+		int* result = new int[dim];
+		for (int j = 0; j < dim; ++j) {
+			int lo = minVal[0][j], hi = maxVal[0][j];
+			for (int p = 1; p < t; ++p) {
+				lo = min(lo, minVal[p][j]);
+				hi = max(hi, maxVal[p][j]);
+			}
+			result[j] = (lo + hi) / 2;
 		}
+		return result;
+	}
 
+	int** calcPixelFreq(double** x, const int* label) {
+		int t = threadCount(nTrain);
+		vector<vector<int> > counts(t);
+		parallelParts(nTrain, t, [&](int part, int lo, int hi) {
+			vector<int>& cnt = counts[part];
+			cnt.assign((size_t)nClass * dim, 0);
+			for (int i = lo; i < hi; ++i) {
+				const double* row = x[i];
+				int* classRow = &cnt[(size_t)label[i] * dim];
+				for (int j = 0; j < dim; ++j)
+					classRow[j] += (int)row[j] > attribThresh[j];
+			}
+		});
+
+		int** result = alloc2D(dim, nClass);
+		for (int j = 0; j < dim; ++j)
+			for (int c = 0; c < nClass; ++c) {
+				int sum = 1;
+				for (int p = 0; p < t; ++p)
+					sum += counts[p][(size_t)c * dim + j];
+				result[j][c] = sum;
+			}
 		return result;
 	}
 
-	int* calcClassifierFreq(int* label) {
+	int* calcClassifierFreq(const int* label) {
 		int* result = new int[nClass];
 		for (int i = 0; i < nClass; ++i)
 			result[i] = 1;
@@ -134,34 +291,89 @@ class NaiveBayesBase {
 		return result;
 	}
 
-	int* calcAttribThresh(int* data) {
-		int* result = new int[dim];
-		for (int i = 0; i < dim; ++i) {
-			int minVal = data[i];
-			int maxVal = data[i];
-			for (int j = 0; j < nTrain; ++j) {
-				minVal = min(minVal, data[j*dim + i]);
-				maxVal = max(maxVal, data[j*dim + i]);
-			}
-			result[i] = (minVal + maxVal) / 2;
+	//builds nb_kernel.cl and uploads the packed tables (predictPacked)
+	void initCL() {
+		clTried = true;
+		cl_int err = CL_SUCCESS;
+		std::vector<cl::Platform> platforms;
+		cl::Platform::get(&platforms);
+
+		vector<cl::Device> devices;
+		for (size_t i = 0; i < platforms.size() && devices.empty(); ++i) {
+			cl_context_properties properties[] =
+				{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platforms[i])(), 0 };
+			clContext = cl::Context(CL_DEVICE_TYPE_GPU, properties, NULL, NULL, &err);
+			if (err == CL_SUCCESS)
+				devices = clContext.getInfo<CL_CONTEXT_DEVICES>();
 		}
+		if (devices.empty())
+			return;
+		clDevice = devices[0];
+		clQueue = cl::CommandQueue(clContext, clDevice, 0, &err);
 
-		return result;
+		ifstream sourceFile("nb_kernel.cl");
+		stringstream ss;
+		ss << sourceFile.rdbuf();
+		sourceFile.close();
+
+		string sourceStr = ss.str();
+		cl::Program::Sources source(1,
+			make_pair(sourceStr.data(), sourceStr.length()));
+		cl::Program program = cl::Program(clContext, source);
+		vector<cl::Device> buildDevices(1, clDevice);
+		err = program.build(buildDevices);
+		if (err != CL_SUCCESS) {
+			cout << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(clDevice) << endl;
+			cout << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(clDevice) << endl;
+			return;
+		}
+		clKernel = cl::Kernel(program, "predictPacked", &err);
+		if (err != CL_SUCCESS)
+			return;
+
+		//a power of two covering the classes, within the device's limit
+		size_t maxGroup = clKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(clDevice);
+		size_t limit = min(maxGroup, (size_t)MAX_CL_GROUP);
+		clGroupSize = 1;
+		while (clGroupSize < (size_t)nClass && clGroupSize * 2 <= limit)
+			clGroupSize *= 2;
+
+		baseLogCL = cl::Buffer(clContext, CL_MEM_READ_ONLY, sizeof(float)*nClassPad, NULL, &err);
+		deltaLogCL = cl::Buffer(clContext, CL_MEM_READ_ONLY, sizeof(float)*deltaLog.size(), NULL, &err);
+		err = clQueue.enqueueWriteBuffer(baseLogCL, CL_TRUE, 0, sizeof(float)*nClassPad, &baseLog[0]);
+		err = clQueue.enqueueWriteBuffer(deltaLogCL, CL_TRUE, 0, sizeof(float)*deltaLog.size(), &deltaLog[0]);
+
+		err = clKernel.setArg(3, baseLogCL);
+		err = clKernel.setArg(4, deltaLogCL);
+		err = clKernel.setArg(5, nWords);
+		err = clKernel.setArg(6, nClass);
+		err = clKernel.setArg(7, nClassPad);
+		err = clKernel.setArg(8, cl::Local(sizeof(float)*clGroupSize));
+		err = clKernel.setArg(9, cl::Local(sizeof(int)*clGroupSize));
+		clCapacity = 0;
+		clReady = err == CL_SUCCESS;
 	}
-	
+
 public:
-	NaiveBayesBase(int* data, int* label, int n, int dim, int nClass)
+	//x is n rows of dim attributes, label the class (0..nClass-1) of each;
+	//neither is copied or kept
+	NaiveBayesBase(double** x, const int* label, int n, int dim, int nClass)
 		: nClass(nClass), dim(dim), nTrain(n) {
 
-		attribThresh = calcAttribThresh(data);		
+		attribThresh = calcAttribThresh(x);
 		int* classifierFreq = calcClassifierFreq(label);
-		int** pixelFreq = calcPixelFreq(label, data, classifierFreq);		
+		int** pixelFreq = calcPixelFreq(x, label);
 
 		float* piHat = calcPIHat(classifierFreq, n);
 		piHatLog = calcPIHatLog(piHat);
 		float** thetaHat = calcThetaHat(pixelFreq, classifierFreq);
 		thetaHatLog = calcThetaHatLog(thetaHat);
 		oneMinusThetaHatLog = calcOneMinusThetaHatLog(thetaHat);
+		calcPackedTables();
+		clTried = false;
+		clReady = false;
+		clCapacity = 0;
+		clGroupSize = 1;
 
 		delete[] piHat;
 		free2Df(thetaHat);
@@ -176,79 +388,56 @@ public:
 		delete[] attribThresh;
 	}
 
+	//the buffers are per thread and reused
 	int predict(int* point) {
-		float* probs = new float[nClass];
-		posterior(point, probs);
-
-		float maxProb = probs[0];
-		int result = 0;
-		for (int i = 0; i < nClass; ++i)
-			if (probs[i] > maxProb) {
-				maxProb = probs[i];
-				result = i;
-			}
-
-		delete[] probs;
-		return result;
+		static thread_local vector<uint64_t> bits;
+		static thread_local vector<float> probs;
+		bits.resize(nWords);
+		probs.resize(nClassPad);
+		packQuery(point, &bits[0]);
+		scorePacked(&bits[0], &probs[0]);
+		return argmax(&probs[0]);
 	}
 
+	//the points are split among the cores
 	void predictBatch(int* points, int n, int* result) {
-		for (int i = 0; i < n; ++i)
-			result[i] = predict(points + i*dim);
+		parallelRows(n, [&](int lo, int hi) {
+			for (int i = lo; i < hi; ++i)
+				result[i] = predict(points + (size_t)i*dim);
+		});
 	}
 
+	//like predictBatch, on the first GPU found; without one it is predictBatch
 	void predictBatchCL(int* points, int n, int* result) {
-		cl_int err = CL_SUCCESS;
-		std::vector<cl::Platform> platforms;
-		cl::Platform::get(&platforms);
-
-		cl_context_properties properties[] =
-			{ CL_CONTEXT_PLATFORM, (cl_context_properties)(platforms[1])(), 0 };
-		cl::Context context(CL_DEVICE_TYPE_GPU, properties);
-		vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
-		//cout << devices[0].getInfo<CL_DEVICE_NAME>() << endl;
-
-		cl::Buffer pointsCL(context, CL_MEM_READ_ONLY, sizeof(int)*dim*n, &err);
-		cl::Buffer resultCL(context, CL_MEM_READ_WRITE, sizeof(int)*n, &err);
-		cl::Buffer piHatLogCL(context, CL_MEM_READ_ONLY, sizeof(float)*nClass, NULL, &err);
-		cl::Buffer thetaHatLogCL(context, CL_MEM_READ_ONLY, sizeof(float)*dim*nClass, NULL, &err);
-		cl::Buffer oneMinuxThetaHatLogCL(context, CL_MEM_READ_ONLY, sizeof(float)*dim*nClass, NULL, &err);
-		cl::Buffer attribThreshCL(context, CL_MEM_READ_ONLY, sizeof(int)*dim, NULL, &err);
-
-		cl::CommandQueue queue(context, devices[0], 0, &err);
-		err = queue.enqueueWriteBuffer(pointsCL, CL_TRUE, 0, sizeof(int)*dim*n, points, NULL);
-		err = queue.enqueueWriteBuffer(piHatLogCL, CL_TRUE, 0, sizeof(float)*nClass, piHatLog, NULL);
-		err = queue.enqueueWriteBuffer(thetaHatLogCL, CL_TRUE, 0, sizeof(float)*dim*nClass, thetaHatLog[0], NULL);
-		err = queue.enqueueWriteBuffer(oneMinuxThetaHatLogCL, CL_TRUE, 0, sizeof(float)*dim*nClass, oneMinusThetaHatLog[0], NULL);
-
-		ifstream sourceFile("nb_kernel.cl");
-		stringstream ss;
-		ss << sourceFile.rdbuf();
-		sourceFile.close();
+		if (!clTried)
+			initCL();
+		if (!clReady) {
+			predictBatch(points, n, result);
+			return;
+		}
+		if (n <= 0)
+			return;
 
-		string sourceStr = ss.str();
-		cl::Program::Sources source(1,
-			make_pair(sourceStr.data(), sourceStr.length()));
-		cl::Program program = cl::Program(context, source);
-		err = program.build(devices);
-		if (err != CL_SUCCESS) {
-			cout << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[0]) << endl;
-			cout << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << endl;
+		cl_int err = CL_SUCCESS;
+		if (n > clCapacity) {
+			clCapacity = max(n, 2 * clCapacity);
+			bitsCL = cl::Buffer(clContext, CL_MEM_READ_ONLY, sizeof(cl_ulong)*nWords*clCapacity, NULL, &err);
+			resultCL = cl::Buffer(clContext, CL_MEM_WRITE_ONLY, sizeof(int)*clCapacity, NULL, &err);
+			err = clKernel.setArg(0, bitsCL);
+			err = clKernel.setArg(2, resultCL);
 		}
 
-		cl::Kernel kernel(program, "predictBatch", &err);
-		err = kernel.setArg(0, pointsCL);
-		err = kernel.setArg(1, n);
-		err = kernel.setArg(2, resultCL);
-		err = kernel.setArg(3, piHatLogCL);
-		err = kernel.setArg(4, thetaHatLogCL);
-		err = kernel.setArg(5, oneMinuxThetaHatLogCL);
-		err = kernel.setArg(6, attribThreshCL);
-		err = kernel.setArg(7, dim);
-		err = kernel.setArg(8, nClass);
-		queue.finish();
-
-		err = queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n), cl::NullRange, NULL, NULL);
-		err = queue.enqueueReadBuffer(resultCL, CL_TRUE, 0, sizeof(int)*n, result);
+		batchBits.resize((size_t)nWords*n);
+		parallelRows(n, [&](int lo, int hi) {
+			for (int i = lo; i < hi; ++i)
+				packQuery(points + (size_t)i*dim, &batchBits[(size_t)i*nWords]);
+		});
+
+		err = clQueue.enqueueWriteBuffer(bitsCL, CL_FALSE, 0, sizeof(cl_ulong)*nWords*n, &batchBits[0]);
+		err = clKernel.setArg(1, n);
+		err = clQueue.enqueueNDRangeKernel(clKernel, cl::NullRange, cl::NDRange(clGroupSize*n), cl::NDRange(clGroupSize));
+		err = clQueue.enqueueReadBuffer(resultCL, CL_TRUE, 0, sizeof(int)*n, result);
+		if (err != CL_SUCCESS)
+			cout << "predictBatchCL failed: " << err << endl;
 	}
 };
@@ -0,0 +1,168 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+// Bounded cache of predicted labels for repeated queries.  The key is a 64-bit
+// hash of the query with each feature quantized to a multiple of step (step 0
+// uses the exact bits of the double), so with step > 0 queries that differ by
+// less than about step share an entry.  With verify the quantized query is
+// stored and compared on a hit, so a hash collision is a miss rather than a
+// wrong label; without it an entry holds just the key and label.
+// The entries are split into shards by hash, each with its own lock and LRU
+// order, so concurrent predict calls rarely wait on each other.
+class PredictCache {
+	struct Entry {
+		uint64_t key;
+		double label;
+		std::vector<int64_t> codes; //quantized query (verify only)
+	};
+
+	struct Shard {
+		std::mutex lock;
+		std::list<Entry> lru; //most recently used first
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> map;
+	};
+
+	std::vector<Shard*> shards;
+	size_t shardCapacity;
+	double step;
+	bool verify;
+	std::atomic<long long> hits, misses;
+
+	int64_t code(double v) const {
+		if (step > 0)
+			return (int64_t)std::floor(v / step + 0.5);
+		if (v == 0) //+0 and -0 predict the same
+			return 0;
+		int64_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		return bits;
+	}
+
+	//FNV-1a over the codes, then a final mix so the shard bits are spread
+	uint64_t hash(const double* x, int dim) const {
+		uint64_t h = 1469598103934665603ULL;
+		for (int i = 0; i < dim; ++i) {
+			h ^= (uint64_t)code(x[i]);
+			h *= 1099511628211ULL;
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	bool sameCodes(const Entry& e, const double* x, int dim) const {
+		if ((int)e.codes.size() != dim)
+			return false;
+		for (int i = 0; i < dim; ++i)
+			if (e.codes[i] != code(x[i]))
+				return false;
+		return true;
+	}
+
+	Shard& shardOf(uint64_t key) {
+		return *shards[(key >> 48) % shards.size()];
+	}
+
+public:
+	//capacity is the total number of labels kept, split evenly over nShards
+	PredictCache(size_t capacity, int nShards = 16, double step = 0, bool verify = false)
+		: hits(0), misses(0) {
+		if (nShards < 1)
+			nShards = 1;
+		for (int i = 0; i < nShards; ++i)
+			shards.push_back(new Shard());
+		shardCapacity = capacity / nShards > 0 ? capacity / nShards : 1;
+		this->step = step;
+		this->verify = verify;
+	}
+
+	~PredictCache() {
+		for (size_t i = 0; i < shards.size(); ++i)
+			delete shards[i];
+	}
+
+	//the cached label of x, if any; counts a hit or a miss
+	bool lookup(const double* x, int dim, double& label) {
+		uint64_t key = hash(x, dim);
+		Shard& s = shardOf(key);
+		{
+			std::lock_guard<std::mutex> lk(s.lock);
+			auto it = s.map.find(key);
+			if (it != s.map.end() && (!verify || sameCodes(*it->second, x, dim))) {
+				s.lru.splice(s.lru.begin(), s.lru, it->second);
+				label = it->second->label;
+				++hits;
+				return true;
+			}
+		}
+		++misses;
+		return false;
+	}
+
+	//stores the label of x, evicting the least recently used entry of its
+	//shard when the shard is full
+	void insert(const double* x, int dim, double label) {
+		uint64_t key = hash(x, dim);
+		Shard& s = shardOf(key);
+		std::lock_guard<std::mutex> lk(s.lock);
+		auto it = s.map.find(key);
+		if (it != s.map.end()) { //refresh (or replace a colliding query)
+			s.lru.erase(it->second);
+			s.map.erase(it);
+		}
+		else if (s.lru.size() >= shardCapacity) {
+			s.map.erase(s.lru.back().key);
+			s.lru.pop_back();
+		}
+
+		s.lru.push_front(Entry());
+		Entry& e = s.lru.front();
+		e.key = key;
+		e.label = label;
+		if (verify) {
+			e.codes.resize(dim);
+			for (int i = 0; i < dim; ++i)
+				e.codes[i] = code(x[i]);
+		}
+		s.map[key] = s.lru.begin();
+	}
+
+	//drops every entry; called when the model changes
+	void clear() {
+		for (size_t i = 0; i < shards.size(); ++i) {
+			std::lock_guard<std::mutex> lk(shards[i]->lock);
+			shards[i]->lru.clear();
+			shards[i]->map.clear();
+		}
+	}
+
+	size_t size() {
+		size_t n = 0;
+		for (size_t i = 0; i < shards.size(); ++i) {
+			std::lock_guard<std::mutex> lk(shards[i]->lock);
+			n += shards[i]->lru.size();
+		}
+		return n;
+	}
+
+	long long getHits() { return hits; }
+	long long getMisses() { return misses; }
+
+	double hitRate() {
+		long long h = hits, m = misses;
+		return h + m > 0 ? (double)h / (h + m) : 0.0;
+	}
+
+	void resetStats() {
+		hits = 0;
+		misses = 0;
+	}
+};
@@ -0,0 +1,638 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <emmintrin.h>
+
+// Linear map of the rows onto fewer dimensions, fitted once and then applied
+// to every training row and query, so that the distance-based methods work in
+// nComponents instead of dim coordinates.
+//
+// PROJ_PCA is exact PCA: the covariance matrix (dim x dim) is built in one
+// pass over the rows and its eigenvectors found by Householder reduction and
+// QL iteration; the components are the nComponents of largest variance.
+// PROJ_RANDOMIZED_PCA finds the same subspace approximately from the product
+// of the centered rows with nComponents + oversample random directions, with
+// a few power iterations, so it never forms the covariance matrix; use it
+// when dim is large.
+// PROJ_SPARSE_RANDOM is a sparse random projection (entries +-sqrt(s/k) with
+// probability 1/2s each and 0 otherwise, s = sqrt(dim)); it needs no pass
+// over the data and keeps distances within a small factor with high
+// probability.  Its rows are not centered.
+enum ProjectionType { PROJ_PCA, PROJ_RANDOMIZED_PCA, PROJ_SPARSE_RANDOM };
+
+class Projection {
+	static const int ROW_BLOCK = 64; //rows per covariance update
+	static const int MIN_ROWS_PER_THREAD = 256;
+
+	ProjectionType type;
+	int nComponents;
+	int dim;
+	unsigned seed;
+	int oversample; //extra random directions (randomized PCA)
+	int powerIters; //power iterations (randomized PCA)
+	std::vector<double> mean; //subtracted before projecting (zero for sparse)
+	std::vector<double> components; //nComponents x dim, one row per component
+	std::vector<double> bias; //mean . component, so rows need no centering
+	std::vector<double> variance; //variance along each component (PCA)
+	std::vector<int> spStart, spIdx; //sparse: nonzeros of component c are
+	std::vector<double> spVal; //spIdx/spVal[spStart[c] .. spStart[c+1])
+
+	static int threadCount(int n) {
+		int t = (int)std::thread::hardware_concurrency();
+		t = std::min(std::max(t, 1), std::max(n / MIN_ROWS_PER_THREAD, 1));
+		return t;
+	}
+
+	//runs body(lo, hi) over [0, n) split among the cores
+	template <typename Body>
+	static void parallelRows(int n, Body body) {
+		int t = threadCount(n);
+		if (t == 1) {
+			body(0, n);
+			return;
+		}
+		std::vector<std::thread> workers;
+		for (int i = 1; i < t; ++i)
+			workers.push_back(std::thread(body, (int)((long long)i * n / t), (int)((long long)(i + 1) * n / t)));
+		body(0, (int)((long long)n / t));
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	static double hsum(__m128d v) {
+		return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+	}
+
+	//out[r][c] = x[r] . w[c] - b[c] for rows lo..hi-1 and m rows of w.  Four
+	//rows by two components are done at once, so each loaded pair of
+	//coordinates is used in eight multiply-adds.
+	static void multiply(double** x, int lo, int hi, int d, const double* w, int m,
+		const double* b, double** out) {
+		int r = lo;
+		for (; r + 4 <= hi; r += 4) {
+			const double* x0 = x[r];
+			const double* x1 = x[r + 1];
+			const double* x2 = x[r + 2];
+			const double* x3 = x[r + 3];
+			int c = 0;
+			for (; c + 2 <= m; c += 2) {
+				const double* w0 = w + (size_t)c * d;
+				const double* w1 = w0 + d;
+				__m128d a00 = _mm_setzero_pd(), a01 = _mm_setzero_pd();
+				__m128d a10 = _mm_setzero_pd(), a11 = _mm_setzero_pd();
+				__m128d a20 = _mm_setzero_pd(), a21 = _mm_setzero_pd();
+				__m128d a30 = _mm_setzero_pd(), a31 = _mm_setzero_pd();
+				int j = 0;
+				for (; j + 2 <= d; j += 2) {
+					__m128d v0 = _mm_loadu_pd(w0 + j);
+					__m128d v1 = _mm_loadu_pd(w1 + j);
+					__m128d p = _mm_loadu_pd(x0 + j);
+					a00 = _mm_add_pd(a00, _mm_mul_pd(p, v0));
+					a01 = _mm_add_pd(a01, _mm_mul_pd(p, v1));
+					p = _mm_loadu_pd(x1 + j);
+					a10 = _mm_add_pd(a10, _mm_mul_pd(p, v0));
+					a11 = _mm_add_pd(a11, _mm_mul_pd(p, v1));
+					p = _mm_loadu_pd(x2 + j);
+					a20 = _mm_add_pd(a20, _mm_mul_pd(p, v0));
+					a21 = _mm_add_pd(a21, _mm_mul_pd(p, v1));
+					p = _mm_loadu_pd(x3 + j);
+					a30 = _mm_add_pd(a30, _mm_mul_pd(p, v0));
+					a31 = _mm_add_pd(a31, _mm_mul_pd(p, v1));
+				}
+				double s00 = hsum(a00), s01 = hsum(a01), s10 = hsum(a10), s11 = hsum(a11);
+				double s20 = hsum(a20), s21 = hsum(a21), s30 = hsum(a30), s31 = hsum(a31);
+				for (; j < d; ++j) { //odd dim
+					s00 += x0[j] * w0[j]; s01 += x0[j] * w1[j];
+					s10 += x1[j] * w0[j]; s11 += x1[j] * w1[j];
+					s20 += x2[j] * w0[j]; s21 += x2[j] * w1[j];
+					s30 += x3[j] * w0[j]; s31 += x3[j] * w1[j];
+				}
+				out[r][c] = s00 - b[c]; out[r][c + 1] = s01 - b[c + 1];
+				out[r + 1][c] = s10 - b[c]; out[r + 1][c + 1] = s11 - b[c + 1];
+				out[r + 2][c] = s20 - b[c]; out[r + 2][c + 1] = s21 - b[c + 1];
+				out[r + 3][c] = s30 - b[c]; out[r + 3][c + 1] = s31 - b[c + 1];
+			}
+			for (; c < m; ++c) //odd component count
+				for (int i = 0; i < 4; ++i)
+					out[r + i][c] = dot(x[r + i], w + (size_t)c * d, d) - b[c];
+		}
+		for (; r < hi; ++r) //last rows
+			for (int c = 0; c < m; ++c)
+				out[r][c] = dot(x[r], w + (size_t)c * d, d) - b[c];
+	}
+
+	static double dot(const double* a, const double* b, int d) {
+		__m128d acc = _mm_setzero_pd();
+		int j = 0;
+		for (; j + 2 <= d; j += 2)
+			acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + j), _mm_loadu_pd(b + j)));
+		double s = hsum(acc);
+		for (; j < d; ++j)
+			s += a[j] * b[j];
+		return s;
+	}
+
+	//out (n x m) = centered x times the transpose of w (m x d), in parallel
+	void multiplyAll(double** x, int n, const double* w, int m, double** out) {
+		std::vector<double> b(m);
+		for (int c = 0; c < m; ++c)
+			b[c] = dot(&mean[0], w + (size_t)c * dim, dim);
+		parallelRows(n, [&](int lo, int hi) {
+			multiply(x, lo, hi, dim, w, m, &b[0], out);
+		});
+	}
+
+	//z (m x d) = q^T times the centered x, for q of m columns of length n
+	//(stored column by column); each thread sums its rows, then the parts
+	//are added
+	void multiplyTransposed(double** x, int n, const std::vector<double>& q, int m,
+		std::vector<double>& z) {
+		int t = threadCount(n);
+		std::vector<std::vector<double> > part(t, std::vector<double>((size_t)m * dim, 0.0));
+		std::vector<std::thread> workers;
+		for (int i = 0; i < t; ++i) {
+			workers.push_back(std::thread([&, i] {
+				int lo = (int)((long long)i * n / t), hi = (int)((long long)(i + 1) * n / t);
+				std::vector<double>& p = part[i];
+				for (int r = lo; r < hi; ++r)
+					for (int c = 0; c < m; ++c) {
+						double a = q[(size_t)c * n + r];
+						double* pc = &p[(size_t)c * dim];
+						for (int j = 0; j < dim; ++j)
+							pc[j] += a * (x[r][j] - mean[j]);
+					}
+			}));
+		}
+		for (int i = 0; i < t; ++i)
+			workers[i].join();
+
+		z.assign((size_t)m * dim, 0.0);
+		for (int i = 0; i < t; ++i)
+			for (size_t e = 0; e < z.size(); ++e)
+				z[e] += part[i][e];
+	}
+
+	//modified Gram-Schmidt on the m rows of a (each of length len), twice
+	//for stability; rows that vanish are left zero
+	static void orthonormalize(std::vector<double>& a, int m, int len) {
+		for (int pass = 0; pass < 2; ++pass)
+			for (int c = 0; c < m; ++c) {
+				double* ac = &a[(size_t)c * len];
+				for (int p = 0; p < c; ++p) {
+					const double* ap = &a[(size_t)p * len];
+					double s = dot(ac, ap, len);
+					for (int j = 0; j < len; ++j)
+						ac[j] -= s * ap[j];
+				}
+				double norm = std::sqrt(dot(ac, ac, len));
+				for (int j = 0; j < len; ++j)
+					ac[j] = norm > 1e-12 ? ac[j] / norm : 0.0;
+			}
+	}
+
+	//eigenvalues (val) and eigenvectors (rows of vec) of the symmetric n x n
+	//matrix a: Householder reduction to tridiagonal form, then implicit QL
+	//(tred2 and tql2 of EISPACK).  The vectors are transposed between the
+	//two steps so that each QL rotation updates two contiguous rows.
+	static void symmetricEigen(std::vector<double>& a, int n, std::vector<double>& val,
+		std::vector<double>& vec) {
+		std::vector<double>& V = a;
+		std::vector<double> d(n), e(n);
+#define V_(i, j) V[(size_t)(i) * n + (j)]
+		for (int j = 0; j < n; ++j)
+			d[j] = V_(n - 1, j);
+
+		for (int i = n - 1; i > 0; --i) { //Householder reduction
+			double scale = 0.0, h = 0.0;
+			for (int k = 0; k < i; ++k)
+				scale += std::fabs(d[k]);
+			if (scale == 0.0) {
+				e[i] = d[i - 1];
+				for (int j = 0; j < i; ++j) {
+					d[j] = V_(i - 1, j);
+					V_(i, j) = 0.0;
+					V_(j, i) = 0.0;
+				}
+			}
+			else {
+				for (int k = 0; k < i; ++k) {
+					d[k] /= scale;
+					h += d[k] * d[k];
+				}
+				double f = d[i - 1];
+				double g = std::sqrt(h);
+				if (f > 0)
+					g = -g;
+				e[i] = scale * g;
+				h -= f * g;
+				d[i - 1] = f - g;
+				for (int j = 0; j < i; ++j)
+					e[j] = 0.0;
+				for (int j = 0; j < i; ++j) {
+					f = d[j];
+					V_(j, i) = f;
+					g = e[j] + V_(j, j) * f;
+					for (int k = j + 1; k <= i - 1; ++k) {
+						g += V_(k, j) * d[k];
+						e[k] += V_(k, j) * f;
+					}
+					e[j] = g;
+				}
+				f = 0.0;
+				for (int j = 0; j < i; ++j) {
+					e[j] /= h;
+					f += e[j] * d[j];
+				}
+				double hh = f / (h + h);
+				for (int j = 0; j < i; ++j)
+					e[j] -= hh * d[j];
+				for (int j = 0; j < i; ++j) {
+					f = d[j];
+					g = e[j];
+					for (int k = j; k <= i - 1; ++k)
+						V_(k, j) -= (f * e[k] + g * d[k]);
+					d[j] = V_(i - 1, j);
+					V_(i, j) = 0.0;
+				}
+			}
+			d[i] = h;
+		}
+
+		for (int i = 0; i < n - 1; ++i) { //accumulate the transformations
+			V_(n - 1, i) = V_(i, i);
+			V_(i, i) = 1.0;
+			double h = d[i + 1];
+			if (h != 0.0) {
+				for (int k = 0; k <= i; ++k)
+					d[k] = V_(k, i + 1) / h;
+				for (int j = 0; j <= i; ++j) {
+					double g = 0.0;
+					for (int k = 0; k <= i; ++k)
+						g += V_(k, i + 1) * V_(k, j);
+					for (int k = 0; k <= i; ++k)
+						V_(k, j) -= g * d[k];
+				}
+			}
+			for (int k = 0; k <= i; ++k)
+				V_(k, i + 1) = 0.0;
+		}
+		for (int j = 0; j < n; ++j) {
+			d[j] = V_(n - 1, j);
+			V_(n - 1, j) = 0.0;
+		}
+		V_(n - 1, n - 1) = 1.0;
+		e[0] = 0.0;
+#undef V_
+
+		vec.resize((size_t)n * n); //row i is the vector of d[i]
+		for (int i = 0; i < n; ++i)
+			for (int k = 0; k < n; ++k)
+				vec[(size_t)i * n + k] = V[(size_t)k * n + i];
+
+		for (int i = 1; i < n; ++i) //QL iteration
+			e[i - 1] = e[i];
+		e[n - 1] = 0.0;
+		double f = 0.0, tst1 = 0.0;
+		const double eps = std::ldexp(1.0, -52);
+		for (int l = 0; l < n; ++l) {
+			tst1 = std::max(tst1, std::fabs(d[l]) + std::fabs(e[l]));
+			int m = l;
+			while (m < n - 1 && std::fabs(e[m]) > eps * tst1)
+				++m;
+			if (m > l) {
+				do {
+					double g = d[l];
+					double p = (d[l + 1] - g) / (2.0 * e[l]);
+					double r = std::sqrt(p * p + 1.0);
+					if (p < 0)
+						r = -r;
+					d[l] = e[l] / (p + r);
+					d[l + 1] = e[l] * (p + r);
+					double dl1 = d[l + 1];
+					double h = g - d[l];
+					for (int i = l + 2; i < n; ++i)
+						d[i] -= h;
+					f += h;
+
+					p = d[m];
+					double c = 1.0, c2 = 1.0, c3 = 1.0;
+					double el1 = e[l + 1];
+					double s = 0.0, s2 = 0.0;
+					for (int i = m - 1; i >= l; --i) {
+						c3 = c2;
+						c2 = c;
+						s2 = s;
+						g = c * e[i];
+						h = c * p;
+						r = std::sqrt(p * p + e[i] * e[i]);
+						e[i + 1] = s * r;
+						s = e[i] / r;
+						c = p / r;
+						p = c * d[i] - s * g;
+						d[i + 1] = h + s * (c * g + s * d[i]);
+						double* vi = &vec[(size_t)i * n];
+						double* vi1 = vi + n;
+						for (int k = 0; k < n; ++k) {
+							h = vi1[k];
+							vi1[k] = s * vi[k] + c * h;
+							vi[k] = c * vi[k] - s * h;
+						}
+					}
+					p = -s * s2 * c3 * el1 * e[l] / dl1;
+					e[l] = s * p;
+					d[l] = c * p;
+				} while (std::fabs(e[l]) > eps * tst1);
+			}
+			d[l] += f;
+			e[l] = 0.0;
+		}
+		val = d;
+	}
+
+	//keeps the k eigenvectors of largest eigenvalue as the components
+	void takeLargest(const std::vector<double>& val, const std::vector<double>& vec, int n,
+		int k, double scale) {
+		std::vector<int> order(n);
+		for (int i = 0; i < n; ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return val[a] > val[b]; });
+		variance.resize(k);
+		for (int c = 0; c < k; ++c)
+			variance[c] = std::max(val[order[c]], 0.0) * scale;
+		components.assign((size_t)k * n, 0.0);
+		for (int c = 0; c < k; ++c)
+			std::copy(&vec[(size_t)order[c] * n], &vec[(size_t)order[c] * n] + n, &components[(size_t)c * n]);
+	}
+
+	void fitMean(double** x, int n) {
+		mean.assign(dim, 0.0);
+		for (int i = 0; i < n; ++i)
+			for (int j = 0; j < dim; ++j)
+				mean[j] += x[i][j];
+		for (int j = 0; j < dim; ++j)
+			mean[j] /= std::max(n, 1);
+	}
+
+	//covariance from blocks of ROW_BLOCK centered rows, stored transposed so
+	//that each entry is a contiguous dot product; each thread keeps its own
+	//upper triangle, and the parts are added
+	void fitPCA(double** x, int n) {
+		fitMean(x, n);
+		int t = threadCount(n);
+		std::vector<std::vector<double> > part(t, std::vector<double>((size_t)dim * dim, 0.0));
+		std::vector<std::thread> workers;
+		for (int w = 0; w < t; ++w) {
+			workers.push_back(std::thread([&, w] {
+				int lo = (int)((long long)w * n / t), hi = (int)((long long)(w + 1) * n / t);
+				std::vector<double> blockT((size_t)dim * ROW_BLOCK);
+				std::vector<double>& cov = part[w];
+				for (int r0 = lo; r0 < hi; r0 += ROW_BLOCK) {
+					int rows = hi - r0 < ROW_BLOCK ? hi - r0 : ROW_BLOCK;
+					for (int r = 0; r < rows; ++r)
+						for (int j = 0; j < dim; ++j)
+							blockT[(size_t)j * ROW_BLOCK + r] = x[r0 + r][j] - mean[j];
+					for (int i = 0; i < dim; ++i) {
+						const double* bi = &blockT[(size_t)i * ROW_BLOCK];
+						for (int j = i; j < dim; ++j)
+							cov[(size_t)i * dim + j] += dot(bi, &blockT[(size_t)j * ROW_BLOCK], rows);
+					}
+				}
+			}));
+		}
+		for (int w = 0; w < t; ++w)
+			workers[w].join();
+
+		std::vector<double> cov((size_t)dim * dim, 0.0);
+		for (int w = 0; w < t; ++w)
+			for (size_t e = 0; e < cov.size(); ++e)
+				cov[e] += part[w][e];
+		for (int i = 0; i < dim; ++i)
+			for (int j = 0; j < i; ++j)
+				cov[(size_t)i * dim + j] = cov[(size_t)j * dim + i];
+
+		std::vector<double> val, vec;
+		symmetricEigen(cov, dim, val, vec);
+		takeLargest(val, vec, dim, nComponents, 1.0 / std::max(n - 1, 1));
+	}
+
+	//Halko, Martinsson and Tropp: an orthonormal basis q of the range of the
+	//centered x times random directions, sharpened by power iterations, then
+	//the small matrix b = q^T x, whose leading right singular vectors are
+	//the components
+	void fitRandomizedPCA(double** x, int n) {
+		fitMean(x, n);
+		int l = std::min(nComponents + oversample, std::min(dim, n));
+		std::mt19937 rng(seed);
+		std::normal_distribution<double> gauss(0.0, 1.0);
+
+		std::vector<double> omega((size_t)l * dim); //l directions
+		for (size_t e = 0; e < omega.size(); ++e)
+			omega[e] = gauss(rng);
+
+		std::vector<double> yBlock((size_t)n * l);
+		std::vector<double*> y(n);
+		for (int i = 0; i < n; ++i)
+			y[i] = &yBlock[(size_t)i * l];
+		std::vector<double> q((size_t)l * n); //columns of x*omega, by column
+		std::vector<double> b;
+		for (int it = 0; ; ++it) {
+			multiplyAll(x, n, &omega[0], l, &y[0]);
+			for (int i = 0; i < n; ++i)
+				for (int c = 0; c < l; ++c)
+					q[(size_t)c * n + i] = y[i][c];
+			orthonormalize(q, l, n);
+			multiplyTransposed(x, n, q, l, b); //l x dim
+			if (it == powerIters)
+				break;
+			omega = b;
+			orthonormalize(omega, l, dim);
+		}
+
+		std::vector<double> bbt((size_t)l * l); //b b^T = u s^2 u^T
+		for (int i = 0; i < l; ++i)
+			for (int j = i; j < l; ++j)
+				bbt[(size_t)i * l + j] = bbt[(size_t)j * l + i] =
+					dot(&b[(size_t)i * dim], &b[(size_t)j * dim], dim);
+		std::vector<double> val, u;
+		symmetricEigen(bbt, l, val, u);
+		std::vector<int> order(l);
+		for (int i = 0; i < l; ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](int a, int c) { return val[a] > val[c]; });
+
+		int k = std::min(nComponents, l);
+		components.assign((size_t)nComponents * dim, 0.0);
+		variance.assign(nComponents, 0.0);
+		for (int c = 0; c < k; ++c) { //v = b^T u / s
+			double s2 = val[order[c]];
+			if (s2 <= 0)
+				continue;
+			const double* uc = &u[(size_t)order[c] * l];
+			double* v = &components[(size_t)c * dim];
+			for (int i = 0; i < l; ++i)
+				for (int j = 0; j < dim; ++j)
+					v[j] += uc[i] * b[(size_t)i * dim + j];
+			double inv = 1.0 / std::sqrt(s2);
+			for (int j = 0; j < dim; ++j)
+				v[j] *= inv;
+			variance[c] = s2 / std::max(n - 1, 1);
+		}
+	}
+
+	void fitSparseRandom() {
+		mean.assign(dim, 0.0);
+		variance.clear();
+		double s = std::sqrt((double)dim);
+		double value = std::sqrt(s / nComponents);
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<double> unif(0.0, 1.0);
+		components.assign((size_t)nComponents * dim, 0.0);
+		for (size_t e = 0; e < components.size(); ++e) {
+			double u = unif(rng) * s;
+			if (u < 0.5)
+				components[e] = value;
+			else if (u < 1.0)
+				components[e] = -value;
+		}
+	}
+
+	//bias for dense projection, nonzero lists for sparse
+	void prepare() {
+		bias.resize(nComponents);
+		for (int c = 0; c < nComponents; ++c)
+			bias[c] = dot(&mean[0], &components[(size_t)c * dim], dim);
+
+		spStart.clear();
+		spIdx.clear();
+		spVal.clear();
+		if (type != PROJ_SPARSE_RANDOM)
+			return;
+		for (int c = 0; c < nComponents; ++c) {
+			spStart.push_back(spIdx.size());
+			for (int j = 0; j < dim; ++j)
+				if (components[(size_t)c * dim + j] != 0) {
+					spIdx.push_back(j);
+					spVal.push_back(components[(size_t)c * dim + j]);
+				}
+		}
+		spStart.push_back(spIdx.size());
+	}
+
+	void transformSparse(const double* x, double* out) const {
+		for (int c = 0; c < nComponents; ++c) {
+			double s = 0;
+			for (int e = spStart[c]; e < spStart[c + 1]; ++e)
+				s += spVal[e] * x[spIdx[e]];
+			out[c] = s;
+		}
+	}
+
+public:
+	Projection(int nComponents, ProjectionType type = PROJ_PCA, unsigned seed = 1,
+		int oversample = 10, int powerIters = 2)
+		: type(type), nComponents(nComponents), dim(0), seed(seed),
+		oversample(oversample), powerIters(powerIters) {}
+
+	//nComponents must not exceed dim
+	void fit(double** x, int n, int dim) {
+		this->dim = dim;
+		if (nComponents > dim)
+			nComponents = dim;
+		switch (type) {
+		case PROJ_PCA: fitPCA(x, n); break;
+		case PROJ_RANDOMIZED_PCA: fitRandomizedPCA(x, n); break;
+		default: fitSparseRandom(); break;
+		}
+		prepare();
+	}
+
+	//one row; out has nComponents entries
+	void transform(const double* x, double* out) const {
+		if (type == PROJ_SPARSE_RANDOM) {
+			transformSparse(x, out);
+			return;
+		}
+		for (int c = 0; c < nComponents; ++c)
+			out[c] = dot(x, &components[(size_t)c * dim], dim) - bias[c];
+	}
+
+	//n rows into out (n x nComponents), spread over the cores
+	void transform(double** x, int n, double** out) {
+		if (type == PROJ_SPARSE_RANDOM) {
+			parallelRows(n, [&](int lo, int hi) {
+				for (int i = lo; i < hi; ++i)
+					transformSparse(x[i], out[i]);
+			});
+			return;
+		}
+		parallelRows(n, [&](int lo, int hi) {
+			multiply(x, lo, hi, dim, &components[0], nComponents, &bias[0], out);
+		});
+	}
+
+	//allocates the projected rows (one block, free with freeRows); NULL when n <= 0
+	double** transformAlloc(double** x, int n) {
+		if (n <= 0)
+			return NULL;
+		double* block = new double[(size_t)n * nComponents];
+		double** out = new double*[n];
+		for (int i = 0; i < n; ++i)
+			out[i] = block + (size_t)i * nComponents;
+		transform(x, n, out);
+		return out;
+	}
+
+	static void freeRows(double** rows) {
+		if (!rows)
+			return;
+		delete[] rows[0];
+		delete[] rows;
+	}
+
+	int getComponents() const { return nComponents; }
+	int getDim() const { return dim; }
+	ProjectionType getType() const { return type; }
+	const std::vector<double>& getVariance() const { return variance; }
+
+	//text file: type, dim and nComponents, then the mean and the components
+	bool save(const char* fileName) const {
+		std::ofstream out(fileName);
+		if (!out)
+			return false;
+		out << "projection " << (int)type << " " << dim << " " << nComponents << "\n";
+		out << std::setprecision(17);
+		for (int j = 0; j < dim; ++j)
+			out << mean[j] << (j + 1 < dim ? " " : "\n");
+		for (int c = 0; c < nComponents; ++c)
+			for (int j = 0; j < dim; ++j)
+				out << components[(size_t)c * dim + j] << (j + 1 < dim ? " " : "\n");
+		return out.good();
+	}
+
+	bool load(const char* fileName) {
+		std::ifstream in(fileName);
+		std::string tag;
+		int t;
+		if (!(in >> tag >> t >> dim >> nComponents) || tag != "projection")
+			return false;
+		type = (ProjectionType)t;
+		mean.resize(dim);
+		components.resize((size_t)nComponents * dim);
+		for (int j = 0; j < dim; ++j)
+			in >> mean[j];
+		for (size_t e = 0; e < components.size(); ++e)
+			in >> components[e];
+		if (!in)
+			return false;
+		variance.clear();
+		prepare();
+		return true;
+	}
+};
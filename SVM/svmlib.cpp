@@ -35,12 +35,32 @@ SVM::SVM()
 	param.weight_label = NULL;
 	param.weight = NULL;
 	svm_set_print_string_function(&print_null);
+	cache = NULL;
+}
+
+SVM::~SVM()
+{
+	delete cache;
+}
+
+void SVM::enable_cache(size_t capacity, double step, bool verify)
+{
+	delete cache;
+	cache = new PredictCache(capacity, 16, step, verify);
+}
+
+void SVM::disable_cache()
+{
+	delete cache;
+	cache = NULL;
 }
 
 void SVM::fit(double **x, double *y, int n, int dim)
 {
 	if (param.gamma == 0 && dim > 0)
 		param.gamma = 1.0 / dim;
+	if (cache)
+		cache->clear();
 	prob.l = n;
 	prob.y = (double*)malloc(sizeof(double)*n);
 	for (int i = 0; i < n; i++) {
@@ -85,6 +105,10 @@ void SVM::fit(double **x, double *y, int n, int dim)
 
 double SVM::predict(double *x, int n)
 {
+	double label;
+	if (cache && cache->lookup(x, n, label))
+		return label;
+
 	int cnt = 0;
 	for (int i = 0; i < n; i++) {
 		if (x[i] != 0) {
@@ -101,20 +125,33 @@ double SVM::predict(double *x, int n)
 		}
 	}
 	node[k].index = -1;
+	label = svm_predict(model, node);
 	free(node);
-	return svm_predict(model, node);
+	if (cache)
+		cache->insert(x, n, label);
+	return label;
 }
 
 void SVM::predict_multiple(double ** x, int n, int dim, double * label)
 {
+	// only the rows not in the cache go to the device
+	vector<int> rows;
+	for (int i = 0; i < n; i++) {
+		if (!cache || !cache->lookup(x[i], dim, label[i]))
+			rows.push_back(i);
+	}
+	if (rows.empty())
+		return;
+
 	ocl_load_model2(model, false);
-	size_t num_predict = n;
+	size_t num_predict = rows.size();
 	vector<int> x_index;
 	vector<double> x_value;
 	vector<int> head_index;
-	vector<double> vtarget_label;
+	vector<double> vtarget_label(num_predict);
 
-	for (int i = 0; i < n; i++) {
+	for (size_t r = 0; r < rows.size(); r++) {
+		int i = rows[r];
 		head_index.push_back(x_index.size());
 		for (int j = 0; j < dim; j++) {
 			if (x[i][j] != 0) {
@@ -150,7 +187,12 @@ void SVM::predict_multiple(double ** x, int n, int dim, double * label)
 	}
 	err = clEnqueueNDRangeKernel(queue, cl_kernel_predict, 1, 0, &num_predict, 0, 0, 0, 0);
 	if (err == CL_SUCCESS) {
-		err = clEnqueueReadBuffer(queue, cl_predict_label, CL_TRUE, 0, sizeof(cl_double) * num_predict, label, 0, 0, NULL);
+		err = clEnqueueReadBuffer(queue, cl_predict_label, CL_TRUE, 0, sizeof(cl_double) * num_predict, &vtarget_label[0], 0, 0, NULL);
+		for (size_t r = 0; r < rows.size(); r++) {
+			label[rows[r]] = vtarget_label[r];
+			if (cache)
+				cache->insert(x[rows[r]], dim, vtarget_label[r]);
+		}
 	}
 	else {
 		printf("%d\n", err);
@@ -2,10 +2,12 @@
 #define SVMLIB
 #include "svm.h"
 #include "Classify.h"
+#include "PredictCache.h"
 class SVM: public Classify
 {
 public:
 	SVM();
+	~SVM();
 	/**
 	x: train data<br>
 	y: label<br>
@@ -23,9 +25,17 @@ public:
 	void set_linear();
 	void set_polynomial(int degree = 3, double gamma = 0, double coef0 = 0);
 	void set_sigmoid(double gamma = 0, double coef0 = 0);
+	/**
+	caches up to capacity predicted labels (see PredictCache);
+	fit clears it
+	*/
+	void enable_cache(size_t capacity, double step = 0, bool verify = false);
+	void disable_cache();
+	PredictCache *get_cache() { return cache; }
 private:
 	struct svm_parameter param;
 	struct svm_problem prob;
 	struct svm_model *model;
+	PredictCache *cache;
 };
 #endif
\ No newline at end of file
@@ -1,3 +1,10 @@
+// Built with -D DIM=<numCoords>, so the loop count below is a constant
+#ifdef DIM
+#define KM_DIM DIM
+#else
+#define KM_DIM numCoords
+#endif
+
 double euclid_dist_2(int    numCoords,
                     int    numObjs,
                     int    numClusters,
@@ -9,12 +16,12 @@ double euclid_dist_2(int    numCoords,
     int i;
     double ans=0.0;
 
-    for (i = 0; i < numCoords; i++) {
+    for (i = 0; i < KM_DIM; i++) {
         //ans += (objects[numObjs * i + objectId] - clusters[numClusters * i + clusterId]) *
         //       (objects[numObjs * i + objectId] - clusters[numClusters * i + clusterId]);
         //printf("##%f %f\n",objects[objectId * numCoords + i] ,clusters[clusterId * numCoords + i]);
-        ans += (objects[objectId * numCoords + i] - clusters[clusterId * numCoords + i]) *
-               (objects[objectId * numCoords + i] - clusters[clusterId * numCoords + i]);
+        ans += (objects[objectId * KM_DIM + i] - clusters[clusterId * KM_DIM + i]) *
+               (objects[objectId * KM_DIM + i] - clusters[clusterId * KM_DIM + i]);
     }
     return ans;
 }
@@ -1,5 +1,26 @@
 //#pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
+// The distance is fixed when the program is built: -D KNN_METRIC_L1,
+// -D KNN_METRIC_LINF or -D KNN_METRIC_IP (negated inner product), squared L2
+// otherwise.  KNN_STEP(sum, a, b) adds the coordinate pair a, b to sum.
+#if defined(KNN_METRIC_L1)
+#define KNN_STEP(sum, a, b) sum += fabs((a) - (b))
+#elif defined(KNN_METRIC_LINF)
+#define KNN_STEP(sum, a, b) sum = fmax(sum, fabs((a) - (b)))
+#elif defined(KNN_METRIC_IP)
+#define KNN_STEP(sum, a, b) sum -= (a)*(b)
+#else
+#define KNN_STEP(sum, a, b) do { float t_ = (a) - (b); sum += t_*t_; } while (0)
+#endif
+
+// Float rows are built with -D DIM=<dim>, which replaces the dim argument
+// by a constant so that the compiler can unroll the loops.
+#ifdef DIM
+#define KNN_DIM DIM
+#else
+#define KNN_DIM dim
+#endif
+
 __kernel void update_dist_local(__global float* query, __global float* allData, 
 		__global float* allDists, __global int* allIndexes, int length, int dim,
 		__local float* query_local) 
@@ -9,14 +30,17 @@ __kernel void update_dist_local(__global float* query, __global float* allData,
 	size_t local_size = get_local_size(0);
 	size_t global_size = get_global_size(0);
 	
-	for (int i = lid; i < dim; i += local_size) {
+	for (int i = lid; i < KNN_DIM; i += local_size) {
 		query_local[i] = query[i];
 	}
 	barrier(CLK_LOCAL_MEM_FENCE);
 
+	if (gid >= length) //the global size is rounded up to the work-group size
+		return;
+
 	float sum = 0;
-	for (int i = 0; i < dim; ++i)
-		sum += (allData[gid*dim + i] - query_local[i])*(allData[gid*dim + i] - query_local[i]);
+	for (int i = 0; i < KNN_DIM; ++i)
+		KNN_STEP(sum, allData[gid*KNN_DIM + i], query_local[i]);
 	allDists[gid] = sum;
 
 	allIndexes[gid] = gid;
@@ -27,11 +51,126 @@ __kernel void update_dist(__global float* query, __global float* allData,
 	__local float* query_local) 
 {
 	size_t gid = get_global_id(0);
+	if (gid >= length)
+		return;
+
+	float sum = 0;
+	for (int i = 0; i < KNN_DIM; ++i)
+		KNN_STEP(sum, allData[gid*KNN_DIM + i], query[i]);
+	allDists[gid] = sum;
+
+	allIndexes[gid] = gid;
+}
+
+// Rows stored as uint8, dim is the padded row length.  Distances are summed
+// in integers and scaled back to the units of the data (squared L2 only).
+__kernel void update_dist_u8(__global uchar* query, __global uchar* allData,
+	__global float* allDists, __global int* allIndexes, int length, int dim,
+	__local int* query_local, float invScale2)
+{
+	size_t gid = get_global_id(0);
+	size_t lid = get_local_id(0);
+	size_t local_size = get_local_size(0);
+
+	for (int i = lid; i < dim; i += local_size) {
+		query_local[i] = query[i];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (gid >= length)
+		return;
+
+	__global uchar* row = allData + gid*dim;
+	int sum = 0;
+	for (int i = 0; i < dim; ++i) {
+		int t = (int)row[i] - query_local[i];
+		sum += t*t;
+	}
+	allDists[gid] = sum*invScale2;
+
+	allIndexes[gid] = gid;
+}
+
+// Rows stored as half floats (read with vload_half, so cl_khr_fp16 is not
+// needed), dim is the padded row length.
+__kernel void update_dist_fp16(__global float* query, __global half* allData,
+	__global float* allDists, __global int* allIndexes, int length, int dim,
+	__local float* query_local)
+{
+	size_t gid = get_global_id(0);
+	size_t lid = get_local_id(0);
+	size_t local_size = get_local_size(0);
+
+	for (int i = lid; i < dim; i += local_size) {
+		query_local[i] = query[i];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (gid >= length)
+		return;
 
 	float sum = 0;
 	for (int i = 0; i < dim; ++i)
-		sum += (allData[gid*dim + i] - query[i])*(allData[gid*dim + i] - query[i]);
+		KNN_STEP(sum, vload_half(gid*dim + i, allData), query_local[i]);
 	allDists[gid] = sum;
 
 	allIndexes[gid] = gid;
 }
+
+// Distances of a block of queries to all rows, tiled like a matrix product.
+// A work-group covers get_local_size(0) rows and KNN_TILE_Q queries (group
+// id 1).  The dimensions are walked in slices of KNN_TILE_D: each slice of
+// the group's rows is read into row_tile with consecutive work-items reading
+// consecutive floats, and the same slice of its queries into query_tile.
+// Each work-item then keeps the KNN_TILE_Q sums of its row in registers, so
+// a row is read from global memory once per KNN_TILE_Q queries.  row_tile
+// holds KNN_TILE_D*(local size + 1) floats, stored by dimension and padded
+// against bank conflicts.  allDists is nQueries rows of length distances;
+// the rows past length in the last group are computed but not stored.
+#ifndef KNN_TILE_Q
+#define KNN_TILE_Q 8
+#endif
+#ifndef KNN_TILE_D
+#define KNN_TILE_D 16
+#endif
+
+__kernel void update_dist_tiled(__global float* queries, __global float* allData,
+	__global float* allDists, int length, int dim, int nQueries,
+	__local float* row_tile)
+{
+	__local float query_tile[KNN_TILE_Q*KNN_TILE_D];
+	int lid = get_local_id(0);
+	int local_size = get_local_size(0);
+	int stride = local_size + 1;
+	int row0 = get_group_id(0)*local_size;
+	int q0 = get_group_id(1)*KNN_TILE_Q;
+
+	float sum[KNN_TILE_Q];
+	for (int q = 0; q < KNN_TILE_Q; ++q)
+		sum[q] = 0;
+
+	for (int d0 = 0; d0 < KNN_DIM; d0 += KNN_TILE_D) {
+		int dn = min(KNN_TILE_D, KNN_DIM - d0);
+		for (int t = lid; t < local_size*dn; t += local_size) {
+			int r = t / dn, d = t - r*dn;
+			int row = row0 + r;
+			row_tile[d*stride + r] = row < length ? allData[(size_t)row*KNN_DIM + d0 + d] : 0;
+		}
+		for (int t = lid; t < KNN_TILE_Q*dn; t += local_size) {
+			int q = t / dn, d = t - q*dn;
+			query_tile[q*KNN_TILE_D + d] = q0 + q < nQueries ? queries[(size_t)(q0 + q)*KNN_DIM + d0 + d] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (int d = 0; d < dn; ++d) {
+			float x = row_tile[d*stride + lid];
+			for (int q = 0; q < KNN_TILE_Q; ++q)
+				KNN_STEP(sum[q], x, query_tile[q*KNN_TILE_D + d]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	int row = row0 + lid;
+	if (row >= length)
+		return;
+	for (int q = 0; q < KNN_TILE_Q && q0 + q < nQueries; ++q)
+		allDists[(size_t)(q0 + q)*length + row] = sum[q];
+}
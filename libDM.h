@@ -1,26 +1,111 @@
 #pragma once
 #include "Classify.h"
+#include "PredictCache.h"
 #include "NaiveBayes\NaiveBayesBase.h"
 #include "KNearestNeighbor\brute_cl.h"
+#include "KNearestNeighbor\ivfpq.h"
+#include <ANN\ANNhnsw.h>
+#include <ANN\ANNshard.h>
+#include <ANN\ANNdynamic.h>
 #include "KMeans\kmeanslib.h"
 #include "SVM\svmlib.h"
+#include "Projection\projection.h"
 
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <chrono>
+#include <thread>
 #include <CL\cl.h>
 
 using namespace std;
 
+// Search structure used by KNearestNeighbor.  KNN_BRUTE uses the OpenCL
+// brute force search when a platform is present, ANNbruteForce otherwise.
+// KNN_KD searches a flattened copy of the kd-tree.
+// KNN_PRI searches a kd-tree in priority order.  KNN_AUTO picks between
+// brute force and the kd-tree from n, dim and a short timing run.
+// KNN_HNSW is an approximate graph index for high-dimensional data.
+// KNN_IVFPQ keeps only compressed codes of the training rows, so no float
+// copy of the training set is made.
+// KNN_SHARDED splits the training rows into shards searched in parallel (see
+// ANNsharded), spread over the NUMA nodes.  With OpenCL there is one shard per
+// node, each with its own OpenCL brute force search; otherwise one shard per
+// core, each a kd-tree when dim is small and brute force otherwise.
+// KNN_DYNAMIC is a set of kd-trees that takes new rows (append) and
+// deletions (remove) without a rebuild (see ANNkd_dynamic).  The OpenCL
+// KNN_BRUTE search also takes both; other index types are rebuilt by append
+// and do not support remove.
+// KNN_BALL is a ball tree (see ANNball_tree), whose node bounds are spheres
+// rather than boxes, so it suits data spread along directions other than the
+// coordinate axes.
+// For KNN_BRUTE the training rows can also be stored as uint8 or fp16 (see
+// KNNStorage in compact.h) instead of float; the other index types need
+// float coordinates and ignore the storage mode.
+// The distance is set by KNNMetric (see brute_cl.h).  KNN_COSINE normalizes
+// the training rows and queries and then works with every index type.
+// KNN_L1 and KNN_LINF are supported by KNN_BRUTE and KNN_KD, KNN_IP only by
+// KNN_BRUTE; other index types fall back to KNN_BRUTE for them.  Compact
+// storage and KNN_IVFPQ are used only with KNN_L2.
+enum KNNIndexType { KNN_BRUTE, KNN_KD, KNN_BD, KNN_PRI, KNN_HNSW, KNN_IVFPQ, KNN_AUTO, KNN_SHARDED, KNN_DYNAMIC, KNN_BALL };
+
+// How the k neighbors vote.  KNN_VOTE_MAJORITY counts one vote each;
+// KNN_VOTE_DISTANCE weights each by 1/dist, where dist is the distance
+// reported by the search (squared for L2), so an exact match dominates.
+// Distance weighting falls back to majority for KNN_IP, whose distances can
+// be negative.  Ties go to the smallest label.
+enum KNNVote { KNN_VOTE_MAJORITY, KNN_VOTE_DISTANCE };
+
 class KNearestNeighbor : public Classify {
 	bool isValidCL;
 	KNNBruteCL *knnbcl;
-	ANNbruteForce *knnbf;
+	ANNpointSet *knnIndex;
+	KNNIndexType indexType;
+	KNNIndexType usedType; //the type actually built (differs for KNN_AUTO)
+	double eps;
+	int maxPtsVisit; //0 = no limit
+	KNNStorage storage;
+	KNNMetric metric;
+	KNNCompactRows* compactRows; //training rows for uint8/fp16 storage
 	float** trainData;
-	double* trainLabel; //use the data from the outside of class
+	vector<double> classLabel; //sorted distinct labels, indexed by class id
+	vector<int> trainClass; //class id of each training row
+	KNNVote vote;
+	PredictCache* cache; //labels of repeated queries (NULL: off)
+	int workGroupSize; //OpenCL work-group size (0: the default)
 	int k;
 	int nClass;
 
+	static const int AUTO_MAX_DIM = 16; //kd-trees rarely beat brute force above this
+	static const int AUTO_MIN_PTS = 1024; //below this brute force is always cheap
+	static const int AUTO_CALIB_QUERIES = 32;
+
+	//labels to dense class ids 0..nClass-1, in increasing label order
+	void encodeLabels(double* y, int n) {
+		classLabel.assign(y, y + n);
+		sort(classLabel.begin(), classLabel.end());
+		classLabel.erase(unique(classLabel.begin(), classLabel.end()), classLabel.end());
+		nClass = classLabel.size();
+
+		trainClass.resize(n);
+		for (int i = 0; i < n; ++i)
+			trainClass[i] = lower_bound(classLabel.begin(), classLabel.end(), y[i]) - classLabel.begin();
+	}
+
+	//class id of a label, adding it (and shifting the ids above) if new
+	int classOf(double label) {
+		vector<double>::iterator it = lower_bound(classLabel.begin(), classLabel.end(), label);
+		int c = it - classLabel.begin();
+		if (it == classLabel.end() || *it != label) {
+			classLabel.insert(it, label);
+			nClass = classLabel.size();
+			for (size_t i = 0; i < trainClass.size(); ++i)
+				if (trainClass[i] >= c)
+					++trainClass[i];
+		}
+		return c;
+	}
+
 	float** allocFloat2D(int d1, int d2) {
 		float* block = new float[d1*d2];
 		float** result = new float*[d1];
@@ -29,12 +114,206 @@ class KNearestNeighbor : public Classify {
 		return result;
 	}
 
+	//label of the k neighbors' vote; votes holds nClass zeros
+	double voteLabel(const int* nn_idx, const float* dists, vector<double>& votes) {
+		const double minDist = 1e-12; //keeps 1/dist finite
+		bool weighted = vote == KNN_VOTE_DISTANCE && metric != KNN_IP;
+		for (int i = 0; i < k; ++i) {
+			if (nn_idx[i] < 0) //fewer than k points
+				continue;
+			votes[trainClass[nn_idx[i]]] += weighted ? 1.0 / max((double)dists[i], minDist) : 1.0;
+		}
+
+		int best = 0;
+		for (int c = 1; c < nClass; ++c)
+			if (votes[c] > votes[best])
+				best = c;
+		return classLabel[best];
+	}
+
+	void releaseIndex() {
+		if (knnbcl) {
+			delete knnbcl;
+			knnbcl = NULL;
+		}
+		if (knnIndex) {
+			delete knnIndex;
+			knnIndex = NULL;
+		}
+		if (compactRows) {
+			delete compactRows;
+			compactRows = NULL;
+		}
+	}
+
+	//index types that can search with the metric
+	bool supportsMetric(KNNIndexType type) {
+		if (metric == KNN_L2)
+			return true;
+		if (metric == KNN_COSINE)
+			return type != KNN_IVFPQ;
+		return type == KNN_BRUTE || type == KNN_SHARDED || (type == KNN_KD && metric != KNN_IP);
+	}
+
+	ANNpointSet* newFlatTree(ANNkd_tree& tree) {
+		switch (metric) {
+		case KNN_L1: return new ANNkd_flat_treeT<ANNmetricL1>(tree);
+		case KNN_LINF: return new ANNkd_flat_treeT<ANNmetricLinf>(tree);
+		default: return new ANNkd_flat_tree(tree);
+		}
+	}
+
+	ANNpointSet* newBruteForce(float** pa, int n, int dim) {
+		switch (metric) {
+		case KNN_L1: return new ANNbruteForceT<ANNmetricL1>(pa, n, dim);
+		case KNN_LINF: return new ANNbruteForceT<ANNmetricLinf>(pa, n, dim);
+		case KNN_IP: return new ANNbruteForceT<ANNmetricIP>(pa, n, dim);
+		default: return annNewL2BruteForce(pa, n, dim);
+		}
+	}
+
+	ANNpointSet* newSharded(int n, int dim) {
+		bool useCL = isValidCL;
+		int nShards = useCL ? annNumaNodes() : (int)thread::hardware_concurrency();
+		ANNshardBuilder build = [this, useCL](float** pa, int m, int dd) -> ANNpointSet* {
+			if (useCL)
+				return new KNNBruteCLSet(pa, m, dd, k, metric);
+			if (dd <= AUTO_MAX_DIM && metric != KNN_IP) {
+				//the shards already build in parallel: one thread per tree
+				int savedThreads = annLocalBuildThreads(1);
+				ANNkd_tree tree(pa, m, dd);
+				annLocalBuildThreads(savedThreads);
+				return newFlatTree(tree);
+			}
+			return newBruteForce(pa, m, dd);
+		};
+		return new ANNsharded(trainData, n, dim, max(nShards, 1), build, true);
+	}
+
+	void buildIndex(KNNIndexType type, int n, int dim) {
+		if (!supportsMetric(type))
+			type = KNN_BRUTE;
+		usedType = type;
+		switch (type) {
+		case KNN_KD: {
+			ANNkd_tree tree(trainData, n, dim);
+			knnIndex = newFlatTree(tree);
+			break;
+		}
+		case KNN_PRI:
+			knnIndex = new ANNkd_tree(trainData, n, dim);
+			break;
+		case KNN_BD:
+			knnIndex = new ANNbd_tree(trainData, n, dim);
+			break;
+		case KNN_HNSW:
+			knnIndex = new ANNhnsw(trainData, n, dim);
+			break;
+		case KNN_SHARDED:
+			knnIndex = newSharded(n, dim);
+			break;
+		case KNN_DYNAMIC:
+			knnIndex = new ANNkd_dynamic(trainData, n, dim);
+			break;
+		case KNN_BALL:
+			knnIndex = new ANNball_tree(trainData, n, dim);
+			break;
+		default:
+			if (isValidCL) {
+				knnbcl = new KNNBruteCL(k, metric);
+				knnbcl->setWorkGroupSize(workGroupSize);
+				knnbcl->fit(trainData, n, dim);
+			}
+			else
+				knnIndex = newBruteForce(trainData, n, dim);
+			break;
+		}
+	}
+
+	//the maxPtsVisit limit is set for the calling thread only, and put back
+	//after the query
+	void search(float* query, int* nn_idx, float* dists) {
+		int savedMaxPts;
+		switch (usedType) {
+		case KNN_KD:
+		case KNN_BD:
+		case KNN_BALL:
+			savedMaxPts = annMaxPtsVisit(maxPtsVisit);
+			knnIndex->annkSearch(query, k, nn_idx, dists, eps);
+			annMaxPtsVisit(savedMaxPts);
+			break;
+		case KNN_PRI:
+			savedMaxPts = annMaxPtsVisit(maxPtsVisit);
+			((ANNkd_tree*)knnIndex)->annkPriSearch(query, k, nn_idx, dists, eps);
+			annMaxPtsVisit(savedMaxPts);
+			break;
+		default:
+			if (knnbcl)
+				knnbcl->knn(query, nn_idx, dists);
+			else
+				knnIndex->annkSearch(query, k, nn_idx, dists, eps);
+			break;
+		}
+	}
+
+	//average seconds per query over a sample of the training rows
+	double timeQueries(int n) {
+		int nq = min(n, (int)AUTO_CALIB_QUERIES);
+		int* nn_idx = new int[k];
+		float* dists = new float[k];
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int i = 0; i < nq; ++i)
+			search(trainData[(int)((long long)i * n / nq)], nn_idx, dists);
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		delete[] nn_idx;
+		delete[] dists;
+		return elapsed / nq;
+	}
+
+	void buildAuto(int n, int dim) {
+		if (dim > AUTO_MAX_DIM || n < AUTO_MIN_PTS || !supportsMetric(KNN_PRI)) {
+			buildIndex(KNN_BRUTE, n, dim);
+			return;
+		}
+
+		buildIndex(KNN_PRI, n, dim);
+		double treeTime = timeQueries(n);
+		ANNpointSet* tree = knnIndex;
+		knnIndex = NULL;
+
+		buildIndex(KNN_BRUTE, n, dim);
+		double bruteTime = timeQueries(n);
+
+		if (treeTime < bruteTime) {
+			releaseIndex();
+			knnIndex = tree;
+			usedType = KNN_PRI;
+		}
+		else
+			delete tree;
+	}
+
 public:
-	KNearestNeighbor(int k = 10) {
+	KNearestNeighbor(int k = 10, KNNIndexType indexType = KNN_BRUTE,
+		double eps = 0.0, int maxPtsVisit = 0, KNNStorage storage = KNN_STORE_FLOAT,
+		KNNMetric metric = KNN_L2, KNNVote vote = KNN_VOTE_MAJORITY) {
 		knnbcl = NULL;
-		knnbf = NULL;
+		knnIndex = NULL;
+		compactRows = NULL;
 		trainData = NULL;
+		cache = NULL;
+		workGroupSize = 0;
 		this->k = k;
+		this->indexType = indexType;
+		this->usedType = indexType;
+		this->eps = eps;
+		this->maxPtsVisit = maxPtsVisit;
+		this->storage = storage;
+		this->metric = metric;
+		this->vote = vote;
+		nClass = 0;
 
 		cl_uint num;
 		clGetPlatformIDs(0, 0, &num);
@@ -48,142 +327,243 @@ public:
 	}
 
 	~KNearestNeighbor() {
-		if (knnbcl)
-			delete knnbcl;
-		if (knnbf)
-			delete knnbf;
+		releaseIndex();
+		delete cache;
 		if (trainData) {
 			delete[] trainData[0];
 			delete trainData;
 		}
 	}
 
+	KNNIndexType getIndexType() { return usedType; }
+
+	//caches up to capacity predicted labels (see PredictCache); fit, append
+	//and remove clear it
+	void enableCache(size_t capacity, double step = 0, bool verify = false) {
+		delete cache;
+		cache = new PredictCache(capacity, 16, step, verify);
+	}
+
+	void disableCache() {
+		delete cache;
+		cache = NULL;
+	}
+
+	PredictCache* getCache() { return cache; }
+
+	//work-group size of the OpenCL brute force kernels (0: 256); applies to
+	//the index now built and later fits
+	void setWorkGroupSize(int wg) {
+		workGroupSize = wg;
+		if (knnbcl)
+			knnbcl->setWorkGroupSize(wg);
+	}
+
 	virtual void fit(double **x, double *y, int n, int dim) {
-		vector<double> classCount;
-		for (int i = 0; i < n; ++i)
-			if (find(classCount.begin(), classCount.end(), y[i]) == classCount.end())
-				classCount.push_back(y[i]);
-		nClass = classCount.size();
+		encodeLabels(y, n);
+		if (cache)
+			cache->clear();
 
+		releaseIndex();
 		if (trainData) {
 			delete[] trainData[0];
 			delete[] trainData;
 			trainData = NULL;
 		}
 
+		if (indexType == KNN_IVFPQ && supportsMetric(KNN_IVFPQ)) {
+			KNNIvfPQ* ivf = new KNNIvfPQ();
+			ivf->fit(x, n, dim);
+			knnIndex = ivf;
+			usedType = KNN_IVFPQ;
+			return;
+		}
+
+		if (indexType == KNN_BRUTE && storage != KNN_STORE_FLOAT && metric == KNN_L2) {
+			compactRows = new KNNCompactRows();
+			compactRows->fit(x, n, dim, storage);
+			usedType = KNN_BRUTE;
+			if (isValidCL) {
+				knnbcl = new KNNBruteCL(k);
+				knnbcl->setWorkGroupSize(workGroupSize);
+				knnbcl->fit(compactRows);
+			}
+			else
+				knnIndex = new KNNCompactBrute(compactRows);
+			return;
+		}
+
 		trainData = allocFloat2D(n, dim);
 		for (int i = 0; i < n; ++i)
 			for (int j = 0; j < dim; ++j)
 				trainData[i][j] = x[i][j];
+		if (metric == KNN_COSINE)
+			annNormalizePts(trainData, n, dim);
 
-		trainLabel = y;
+		if (indexType == KNN_AUTO)
+			buildAuto(n, dim);
+		else
+			buildIndex(indexType, n, dim);
+	}
 
-		if (isValidCL) {
-			if (knnbcl) {
-				delete knnbcl;
-				knnbcl = NULL;
-			}
-			knnbcl = new KNNBruteCL(k);
-			knnbcl->fit(trainData, n, dim);
+	//adds training rows.  KNN_DYNAMIC and the OpenCL KNN_BRUTE search take
+	//them in place; other index types are rebuilt over all the rows.  Rows
+	//are numbered on from the ones fitted, which keep their numbers.
+	//Returns false for compact storage and KNN_IVFPQ, which keep no float rows.
+	bool append(double **x, double *y, int n, int dim) {
+		bool inPlace = usedType == KNN_DYNAMIC || (knnbcl && !compactRows);
+		if (!inPlace && !trainData)
+			return false;
+		if (n <= 0)
+			return true;
+		if (cache)
+			cache->clear();
+
+		float** rows = allocFloat2D(n, dim);
+		for (int i = 0; i < n; ++i)
+			for (int j = 0; j < dim; ++j)
+				rows[i][j] = x[i][j];
+		if (metric == KNN_COSINE)
+			annNormalizePts(rows, n, dim);
+
+		int nOld = trainClass.size();
+		for (int i = 0; i < n; ++i)
+			trainClass.push_back(classOf(y[i]));
+
+		if (usedType == KNN_DYNAMIC) {
+			ANNkd_dynamic* dyn = (ANNkd_dynamic*)knnIndex;
+			for (int i = 0; i < n; ++i)
+				dyn->insert(rows[i]);
 		}
+		else if (inPlace)
+			knnbcl->append(rows, n);
 		else {
-			if (knnbf) {
-				delete knnbf;
-				knnbf = NULL;
-			}
-			knnbf = new ANNbruteForce(trainData, n, dim);
+			float** all = allocFloat2D(nOld + n, dim);
+			copy(trainData[0], trainData[0] + nOld*dim, all[0]);
+			copy(rows[0], rows[0] + n*dim, all[nOld]);
+			delete[] trainData[0];
+			delete[] trainData;
+			trainData = all;
+			KNNIndexType type = usedType;
+			releaseIndex();
+			buildIndex(type, nOld + n, dim);
 		}
+
+		delete[] rows[0];
+		delete[] rows;
+		return true;
 	}
 
+	//deletes training row i; it no longer votes.  Only KNN_DYNAMIC and the
+	//OpenCL KNN_BRUTE search support this; returns false for the others.
+	bool remove(int i) {
+		if (cache)
+			cache->clear();
+		if (usedType == KNN_DYNAMIC) {
+			((ANNkd_dynamic*)knnIndex)->remove(i);
+			return true;
+		}
+		if (knnbcl) {
+			knnbcl->remove(i);
+			return true;
+		}
+		return false;
+	}
+
+	//the buffers are per thread and reused, so a query allocates nothing
+	//once they have grown to k and nClass
 	virtual double predict(double *x, int dim) {
-		float* tempData = new float[dim];
-		float* allDists = new float[k];
-		int* allIndexes = new int[k];
+		double label;
+		if (cache && cache->lookup(x, dim, label))
+			return label;
+
+		static thread_local vector<float> query, dists;
+		static thread_local vector<int> nn_idx;
+		static thread_local vector<double> votes;
+		query.resize(dim);
+		dists.resize(k);
+		nn_idx.resize(k);
+		votes.assign(nClass, 0.0);
 
 		for (int i = 0; i < dim; ++i)
-			tempData[i] = x[i];
+			query[i] = x[i];
+		if (metric == KNN_COSINE)
+			annNormalizePt(dim, &query[0]);
 
-		if (isValidCL) {
-			knnbcl->knn(tempData, allIndexes, allDists);
-		}
-		else {
-			knnbf->annkSearch(tempData, k, allIndexes, allDists);
-		}
+		search(&query[0], &nn_idx[0], &dists[0]);
 
-		map<double, int> freqCount;
-		for (int i = 0; i < k; ++i) {
-			if (freqCount.find(trainLabel[allIndexes[i]]) == freqCount.end())
-				freqCount[trainLabel[allIndexes[i]]] = 1;
-			else
-				freqCount[trainLabel[allIndexes[i]]] += 1;
-		}
+		double result = voteLabel(&nn_idx[0], &dists[0], votes);
+		if (cache)
+			cache->insert(x, dim, result);
+		return result;
+	}
 
-		double maxKey = freqCount.begin()->first;
-		int maxValue = freqCount.begin()->second;
-		for (map<double, int>::iterator iter = freqCount.begin(); iter != freqCount.end(); ++iter) {
-			if (iter->second > maxValue) {
-				maxValue = iter->second;
-				maxKey = iter->first;
+	//the OpenCL brute force search takes the queries in batches (see
+	//KNNBruteCL::knnBatch); the other searches go one query at a time
+	virtual void predict_multiple(double **x, int n, int dim, double *label) {
+		if (!knnbcl) {
+			for (int i = 0; i < n; ++i) {
+				if (i % 200 == 0)
+					cout << ".";
+				label[i] = predict(x[i], dim);
 			}
+			return;
 		}
 
-		delete[] tempData;
-		delete[] allDists;
-		delete[] allIndexes;
-
-		return maxKey;
-	}
+		vector<int> miss; //rows not in the cache
+		for (int i = 0; i < n; ++i)
+			if (!cache || !cache->lookup(x[i], dim, label[i]))
+				miss.push_back(i);
+		int m = miss.size();
+		if (m == 0)
+			return;
+
+		float** queries = allocFloat2D(m, dim);
+		for (int j = 0; j < m; ++j) {
+			for (int i = 0; i < dim; ++i)
+				queries[j][i] = x[miss[j]][i];
+			if (metric == KNN_COSINE)
+				annNormalizePt(dim, queries[j]);
+		}
+		vector<int> nn_idx((size_t)m * k);
+		vector<float> dists((size_t)m * k);
+		knnbcl->knnBatch(queries, m, &nn_idx[0], &dists[0]);
 
-	virtual void predict_multiple(double **x, int n, int dim, double *label) {
-		for (int i = 0; i < n; ++i) {
-			if (i % 200 == 0)
+		vector<double> votes;
+		for (int j = 0; j < m; ++j) {
+			if (j % 200 == 0)
 				cout << ".";
-			label[i] = predict(x[i], dim);
+			votes.assign(nClass, 0.0);
+			label[miss[j]] = voteLabel(&nn_idx[(size_t)j * k], &dists[(size_t)j * k], votes);
+			if (cache)
+				cache->insert(x[miss[j]], dim, label[miss[j]]);
 		}
+		delete[] queries[0];
+		delete[] queries;
 	}
 };
 
 class NaiveBayes : public Classify {
 	NaiveBayesBase *nbb;
-	int *data;
-	int *trainLabel;
 
 public:
 	NaiveBayes() {
 		nbb = NULL;
-		data = NULL;
-		trainLabel = NULL;
 	}
 
 	~NaiveBayes() {
 		if (nbb != NULL)
 			delete nbb;
-		if (data != NULL)
-			delete[] data;
-		if (trainLabel != NULL)
-			delete[] trainLabel;
 	}
 
+	//the model is built from x directly; only the labels are converted
 	virtual void fit(double **x, double *y, int n, int dim) {
 		if (nbb) {
 			delete nbb;
 			nbb = NULL;
 		}
-		if (data) {
-			delete[] data;
-			data = NULL;
-		}
-		if (trainLabel) {
-			delete[] trainLabel;
-			trainLabel = NULL;
-		}
-
-		data = new int[n*dim];
-		for (int i = 0; i < n; ++i)
-			for (int j = 0; j < dim; ++j)
-				data[i*dim + j] = (int) x[i][j];
 
-		trainLabel = new int[n];
+		vector<int> trainLabel(n);
 		for (int i = 0; i < n; ++i)
 			trainLabel[i] = (int)y[i];
 
@@ -193,7 +573,7 @@ public:
 				classCount.push_back(trainLabel[i]);
 		}
 
-		nbb = new NaiveBayesBase(data, trainLabel, n, dim, classCount.size());
+		nbb = new NaiveBayesBase(x, &trainLabel[0], n, dim, classCount.size());
 	}
 
 	virtual double predict(double *x, int dim) {
@@ -233,4 +613,39 @@ public:
 		delete[] tempData;
 		delete[] tempLabel;
 	}
-};
\ No newline at end of file
+};
+
+// Any classifier fitted and queried in the reduced space of a Projection.  The
+// projection is fitted on the training rows by fit; both objects are owned by
+// the caller.  KMeans is not a Classify: pass it Projection::transformAlloc
+// of the rows instead.
+class ProjectedClassify : public Classify {
+	Projection* proj;
+	Classify* inner;
+
+public:
+	ProjectedClassify(Projection* proj, Classify* inner) {
+		this->proj = proj;
+		this->inner = inner;
+	}
+
+	virtual void fit(double **x, double *y, int n, int dim) {
+		proj->fit(x, n, dim);
+		double** z = proj->transformAlloc(x, n);
+		inner->fit(z, y, n, proj->getComponents());
+		Projection::freeRows(z);
+	}
+
+	virtual double predict(double *x, int dim) {
+		static thread_local vector<double> z;
+		z.resize(proj->getComponents());
+		proj->transform(x, &z[0]);
+		return inner->predict(&z[0], proj->getComponents());
+	}
+
+	virtual void predict_multiple(double **x, int n, int dim, double *label) {
+		double** z = proj->transformAlloc(x, n);
+		inner->predict_multiple(z, n, proj->getComponents(), label);
+		Projection::freeRows(z);
+	}
+};
@@ -1,37 +1,50 @@
-void posterior(__global int* point, float* result, int nClass, __global float* piHatLog,
-	__global float* thetaHatLog, __global float* oneMinusThetaHatLog, __global int* attribThresh, int dim) {
-	for (int i = 0; i < nClass; ++i)
-		result[i] = 0;
+// One work-group per query.  A query is its attributes binarized on the host
+// and packed into nWords 64-bit words (bit j set when attribute j is above
+// its threshold).  The classes are spread over the work-items: each scores
+// its classes from baseLog plus the deltaLog row of every set bit (consecutive
+// work-items read consecutive classes of a row), keeps its best, and the
+// work-group reduces the bests in local memory.  The local size must be a
+// power of two; any number of classes works.  Ties go to the smaller class.
+__kernel void predictPacked(__global ulong* bits, int n, __global int* allResults,
+	__global float* baseLog, __global float* deltaLog, int nWords, int nClass, int nClassPad,
+	__local float* best_prob, __local int* best_class)
+{
+	int q = get_group_id(0);
+	int lid = get_local_id(0);
+	int local_size = get_local_size(0);
+	__global ulong* qbits = bits + (size_t)q*nWords;
 
-	for (int c = 0; c < nClass; ++c) {
-		result[c] += piHatLog[c];
-		for (int j = 0; j < dim; ++j) {
-			if (point[j] > attribThresh[j])
-				result[c] += thetaHatLog[j*nClass + c];
-			else
-				result[c] += oneMinusThetaHatLog[j*nClass + c];
+	float bestProb = -INFINITY;
+	int bestClass = nClass;
+	for (int c = lid; c < nClass; c += local_size) {
+		float sum = baseLog[c];
+		for (int w = 0; w < nWords; ++w) {
+			for (ulong word = qbits[w]; word != 0; word &= word - 1) {
+				int b = 63 - (int)clz(word & (0 - word)); //lowest set bit
+				sum += deltaLog[(size_t)(w*64 + b)*nClassPad + c];
+			}
+		}
+		if (sum > bestProb) {
+			bestProb = sum;
+			bestClass = c;
 		}
 	}
-}
-
-__kernel void predictBatch(__global int* points, int n, __global int* allResults,
-	__global float* piHatLog, __global float* thetaHatLog, __global float* oneMinusThetaHatLog,
-	__global int* attribThresh, int dim, int nClass) {
-	size_t gid = get_global_id(0);
+	best_prob[lid] = bestProb;
+	best_class[lid] = bestClass;
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	//TODO: the 10 is the max number of class this kernel can handle
-	float probs[10];
-	posterior(points + gid*dim, probs, nClass, piHatLog,
-		thetaHatLog, oneMinusThetaHatLog, attribThresh, dim);
-
-	float maxProb = probs[0];
-	int result = 0;
-	for (int i = 0; i < nClass; ++i) {
-		if (probs[i] > maxProb) {
-			maxProb = probs[i];
-			result = i;
+	for (int s = local_size / 2; s > 0; s >>= 1) {
+		if (lid < s) {
+			float p = best_prob[lid + s];
+			int c = best_class[lid + s];
+			if (p > best_prob[lid] || (p == best_prob[lid] && c < best_class[lid])) {
+				best_prob[lid] = p;
+				best_class[lid] = c;
+			}
 		}
+		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	allResults[gid] = result;
-}
\ No newline at end of file
+	if (lid == 0)
+		allResults[q] = best_class[0];
+}